@@ -0,0 +1,323 @@
+#ifndef ARROW_H
+#define ARROW_H
+
+#include "vector.h"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+/*
+Обмен векторами через Arrow C Data Interface без копирования.
+
+Структуры ArrowSchema и ArrowArray описаны в спецификации Arrow как
+обычные структуры C, поэтому они объявлены здесь же и библиотека Arrow
+не нужна. Если ее заголовки уже подключены, берется их определение (оба
+защищены одним и тем же макросом ARROW_C_DATA_INTERFACE).
+
+export_arrow забирает содержимое вектора (и, если передан, битовой карты
+валидности) обменом, как deferred_reclaimer::retire, и передает буферы
+потребителю как есть. Буферы живут, пока потребитель не вызовет release
+у ArrowArray; release у ArrowSchema освобождает только описание типа.
+
+arrow_view принимает чужой ArrowArray во владение (по правилам
+спецификации структура переносится, а у исходной release обнуляется) и
+дает к значениям доступ как к вектору только для чтения. Деструктор
+arrow_view вызывает release производителя.
+
+Поддерживаются примитивные числовые типы. bool в Arrow хранится битами, а
+vector<bool> байтами, поэтому он не поддерживается. Битовая карта
+валидности -- биты в порядке от младшего, 1 означает, что значение есть.
+*/
+
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+extern "C"
+{
+    struct ArrowSchema
+    {
+        const char* format;
+        const char* name;
+        const char* metadata;
+        int64_t flags;
+        int64_t n_children;
+        struct ArrowSchema** children;
+        struct ArrowSchema* dictionary;
+
+        void (*release)(struct ArrowSchema*);
+        void* private_data;
+    };
+
+    struct ArrowArray
+    {
+        int64_t length;
+        int64_t null_count;
+        int64_t offset;
+        int64_t n_buffers;
+        int64_t n_children;
+        const void** buffers;
+        struct ArrowArray** children;
+        struct ArrowArray* dictionary;
+
+        void (*release)(struct ArrowArray*);
+        void* private_data;
+    };
+}
+
+#endif // ARROW_C_DATA_INTERFACE
+
+namespace arrow_detail
+{
+    // Строка формата Arrow для примитивного типа.
+    template <typename T>
+    char const* format()
+    {
+        static_assert(std::is_arithmetic<T>::value && !std::is_same<T, bool>::value,
+                      "only primitive numeric types map to Arrow directly");
+
+        if (std::is_floating_point<T>::value)
+        {
+            static_assert(!std::is_floating_point<T>::value || sizeof(T) == 4 || sizeof(T) == 8,
+                          "Arrow has no floating point type of this size");
+            return sizeof(T) == 4 ? "f" : "g";
+        }
+
+        static char const* const signed_formats[] = {"c", "s", nullptr, "i", nullptr, nullptr, nullptr, "l"};
+        static char const* const unsigned_formats[] = {"C", "S", nullptr, "I", nullptr, nullptr, nullptr, "L"};
+        return std::is_signed<T>::value ? signed_formats[sizeof(T) - 1] : unsigned_formats[sizeof(T) - 1];
+    }
+
+    inline bool bit(uint8_t const* bitmap, size_t i)
+    {
+        return (bitmap[i / 8] >> (i % 8) & 1) != 0;
+    }
+
+    inline size_t count_nulls(uint8_t const* bitmap, size_t length)
+    {
+        size_t valid = 0;
+        for (size_t i = 0; i != length / 8; ++i)
+            valid += __builtin_popcount(bitmap[i]);
+        for (size_t i = length / 8 * 8; i != length; ++i)
+            valid += bit(bitmap, i);
+        return length - valid;
+    }
+
+    // Владелец экспортированных буферов.
+    template <typename T, typename Alloc, typename SizeT>
+    struct exported
+    {
+        vector<T, Alloc, SizeT> values;
+        vector<uint8_t> validity;
+        void const* buffers[2];
+    };
+
+    inline void release_schema(ArrowSchema* schema)
+    {
+        schema->release = nullptr;
+    }
+
+    template <typename T, typename Alloc, typename SizeT>
+    void release_array(ArrowArray* array)
+    {
+        delete static_cast<exported<T, Alloc, SizeT>*>(array->private_data);
+        array->release = nullptr;
+    }
+}
+
+inline void set_valid(vector<uint8_t>& bitmap, size_t i, bool valid)
+{
+    while (bitmap.size() <= i / 8)
+        bitmap.push_back(0);
+
+    uint8_t mask = static_cast<uint8_t>(1u << (i % 8));
+    if (valid)
+        bitmap[i / 8] |= mask;
+    else
+        bitmap[i / 8] &= ~mask;
+}
+
+// Описывает тип T в schema. Схему освобождает потребитель через release.
+template <typename T>
+void export_arrow_schema(ArrowSchema* schema, bool nullable)
+{
+    schema->format = arrow_detail::format<T>();
+    schema->name = "";
+    schema->metadata = nullptr;
+    schema->flags = nullable ? ARROW_FLAG_NULLABLE : 0;
+    schema->n_children = 0;
+    schema->children = nullptr;
+    schema->dictionary = nullptr;
+    schema->release = &arrow_detail::release_schema;
+    schema->private_data = nullptr;
+}
+
+// Забирает содержимое v (и validity, если передан) и описывает его в array
+// и schema. validity должен содержать не меньше (v.size() + 7) / 8 байт.
+template <typename T, typename Alloc, typename SizeT>
+void export_arrow(vector<T, Alloc, SizeT>& v, ArrowArray* array, ArrowSchema* schema,
+                  vector<uint8_t>* validity = nullptr)
+{
+    if (validity != nullptr && validity->size() < (v.size() + 7) / 8)
+        throw std::invalid_argument("export_arrow: validity bitmap is too short");
+
+    typedef arrow_detail::exported<T, Alloc, SizeT> exported;
+    exported* owner = new exported;
+    owner->values.swap(v);
+    if (validity != nullptr)
+        owner->validity.swap(*validity);
+
+    size_t length = owner->values.size();
+    uint8_t const* bitmap = validity != nullptr ? owner->validity.data() : nullptr;
+    owner->buffers[0] = bitmap;
+    owner->buffers[1] = owner->values.data();
+
+    array->length = length;
+    array->null_count = bitmap != nullptr ? arrow_detail::count_nulls(bitmap, length) : 0;
+    array->offset = 0;
+    array->n_buffers = 2;
+    array->n_children = 0;
+    array->buffers = owner->buffers;
+    array->children = nullptr;
+    array->dictionary = nullptr;
+    array->release = &arrow_detail::release_array<T, Alloc, SizeT>;
+    array->private_data = owner;
+
+    export_arrow_schema<T>(schema, validity != nullptr);
+}
+
+template <typename T>
+struct arrow_view
+{
+    typedef T value_type;
+    typedef T const* const_iterator;
+
+    // Проверяет, что schema описывает массив типа T, и переносит array во
+    // владение view. Если проверка не прошла, бросает std::invalid_argument
+    // и array остается у вызывающего.
+    arrow_view(ArrowArray* array, ArrowSchema const* schema);
+    ~arrow_view();
+
+    T const& operator[](size_t i) const;
+    T const* data() const;
+
+    size_t size() const;
+    bool empty() const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    // Без битовой карты валидны все значения.
+    bool is_valid(size_t i) const;
+    size_t null_count() const;
+
+private:
+    arrow_view(arrow_view const&);
+    arrow_view& operator=(arrow_view const&);
+
+private:
+    ArrowArray array_;
+    T const* data_;
+    uint8_t const* validity_;
+    size_t offset_;
+    size_t size_;
+    size_t null_count_;
+};
+
+template <typename T>
+arrow_view<T>::arrow_view(ArrowArray* array, ArrowSchema const* schema)
+{
+    if (array->release == nullptr)
+        throw std::invalid_argument("arrow_view: array is already released");
+    if (schema == nullptr || schema->format == nullptr
+        || strcmp(schema->format, arrow_detail::format<T>()) != 0)
+        throw std::invalid_argument("arrow_view: schema does not describe this element type");
+    if (array->n_buffers != 2 || array->n_children != 0 || array->dictionary != nullptr
+        || array->length < 0 || array->offset < 0
+        || (array->length != 0 && array->buffers[1] == nullptr))
+        throw std::invalid_argument("arrow_view: array is not a primitive array");
+
+    array_ = *array;
+    array->release = nullptr;
+
+    offset_ = array_.offset;
+    size_ = array_.length;
+    data_ = static_cast<T const*>(array_.buffers[1]);
+    if (data_ != nullptr)
+        data_ += offset_;
+    validity_ = static_cast<uint8_t const*>(array_.buffers[0]);
+
+    if (array_.null_count >= 0)
+    {
+        null_count_ = array_.null_count;
+    }
+    else
+    {
+        // -1 означает, что производитель не посчитал пропуски.
+        null_count_ = 0;
+        for (size_t i = 0; validity_ != nullptr && i != size_; ++i)
+            null_count_ += !is_valid(i);
+    }
+}
+
+template <typename T>
+arrow_view<T>::~arrow_view()
+{
+    if (array_.release != nullptr)
+        array_.release(&array_);
+}
+
+template <typename T>
+T const& arrow_view<T>::operator[](size_t i) const
+{
+    return data_[i];
+}
+
+template <typename T>
+T const* arrow_view<T>::data() const
+{
+    return data_;
+}
+
+template <typename T>
+size_t arrow_view<T>::size() const
+{
+    return size_;
+}
+
+template <typename T>
+bool arrow_view<T>::empty() const
+{
+    return size_ == 0;
+}
+
+template <typename T>
+typename arrow_view<T>::const_iterator arrow_view<T>::begin() const
+{
+    return data_;
+}
+
+template <typename T>
+typename arrow_view<T>::const_iterator arrow_view<T>::end() const
+{
+    return data_ + size_;
+}
+
+template <typename T>
+bool arrow_view<T>::is_valid(size_t i) const
+{
+    return validity_ == nullptr || arrow_detail::bit(validity_, offset_ + i);
+}
+
+template <typename T>
+size_t arrow_view<T>::null_count() const
+{
+    return null_count_;
+}
+
+#endif // ARROW_H
@@ -0,0 +1,611 @@
+#ifndef ASYNC_LOADER_H
+#define ASYNC_LOADER_H
+
+#include "vector.h"
+#include "vector_io.h"
+#include "numa.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define VECTOR_HAVE_IO_URING 1
+#endif
+#endif
+
+/*
+Асинхронная загрузка файла в неинициализированный хвост вектора.
+
+Файл делится на блоки по block_bytes, и до queue_depth блоков читаются
+одновременно через io_uring прямо в память вектора, без промежуточного
+буфера. io_uring используется через системные вызовы напрямую, без
+liburing. Если ядро его не поддерживает, он запрещен (seccomp,
+io_uring_disabled) или ядро не знает IORING_OP_READ (до 5.6; проверяется
+через IORING_REGISTER_PROBE), блоки читаются pread'ом из threads потоков.
+
+С direct = true файл открывается с O_DIRECT, чтобы не вытеснять из page
+cache остальные данные. O_DIRECT требует выровненных адреса, смещения и
+длины, а хвост вектора и начало данных в файле обычно не выровнены,
+поэтому в этом режиме блоки читаются в выровненные промежуточные буферы
+и копируются в вектор. Если файловая система не поддерживает O_DIRECT
+(например, tmpfs), загрузка идет обычным чтением.
+
+load_file читает файл целиком как массив T, load_binary -- файл в формате
+vector_io.h. Элементы дописываются в конец вектора; при ошибке вектор не
+меняется.
+*/
+
+struct load_options
+{
+    size_t block_bytes;
+    size_t queue_depth;
+    size_t threads;
+    bool direct;
+    bool use_io_uring;
+
+    load_options()
+        : block_bytes(1 << 20)
+        , queue_depth(32)
+        , threads(4)
+        , direct(false)
+        , use_io_uring(true)
+    {}
+};
+
+struct load_stats
+{
+    size_t bytes;
+    size_t requests;
+    bool used_io_uring;
+    bool used_direct;
+};
+
+namespace async_loader_detail
+{
+    size_t const direct_alignment = 4096;
+
+    inline size_t align_down(size_t x, size_t a)
+    {
+        return x / a * a;
+    }
+
+    inline size_t align_up(size_t x, size_t a)
+    {
+        return (x + a - 1) / a * a;
+    }
+
+    struct fd_guard
+    {
+        explicit fd_guard(int fd)
+            : fd(fd)
+        {}
+
+        ~fd_guard()
+        {
+            if (fd != -1)
+                close(fd);
+        }
+
+        int fd;
+    };
+
+    /*
+    Блок -- это отрезок файла [file_offset, file_offset + length), из
+    которого в вектор попадают байты [skip, skip + dst_length). Без O_DIRECT
+    skip всегда 0 и блок читается прямо в dst. С O_DIRECT отрезок выровнен
+    и может захватывать байты до и после нужных, а в конце файла чтение
+    законно возвращает меньше length байт.
+    */
+    struct block
+    {
+        uint64_t file_offset;
+        size_t length;
+        size_t skip;
+        char* dst;
+        size_t dst_length;
+
+        size_t needed() const
+        {
+            return skip + dst_length;
+        }
+    };
+
+    inline vector<block> split(char* dst, size_t offset, size_t bytes,
+                               size_t block_bytes, bool direct)
+    {
+        size_t first = offset;
+        size_t last = offset + bytes;
+        if (direct)
+        {
+            first = align_down(first, direct_alignment);
+            last = align_up(last, direct_alignment);
+            block_bytes = align_up(block_bytes, direct_alignment);
+        }
+
+        vector<block> result;
+        for (size_t pos = first; pos < last; pos += block_bytes)
+        {
+            block b;
+            b.file_offset = pos;
+            b.length = std::min(block_bytes, last - pos);
+
+            size_t useful_first = std::max(pos, offset);
+            size_t useful_last = std::min(pos + b.length, offset + bytes);
+            b.skip = useful_first - pos;
+            b.dst = dst + (useful_first - offset);
+            b.dst_length = useful_last - useful_first;
+            result.push_back(b);
+        }
+        return result;
+    }
+
+    // Промежуточные буферы для O_DIRECT, выровненные на страницу.
+    struct bounce_buffers
+    {
+        bounce_buffers(size_t count, size_t bytes)
+            : count_(count)
+            , bytes_(align_up(bytes, direct_alignment))
+            , data_(count != 0 ? static_cast<char*>(map_pages(count_ * bytes_)) : nullptr)
+        {}
+
+        ~bounce_buffers()
+        {
+            if (data_ != nullptr)
+                unmap_pages(data_, count_ * bytes_);
+        }
+
+        char* get(size_t i) const
+        {
+            return data_ + i * bytes_;
+        }
+
+    private:
+        bounce_buffers(bounce_buffers const&);
+        bounce_buffers& operator=(bounce_buffers const&);
+
+    private:
+        size_t count_;
+        size_t bytes_;
+        char* data_;
+    };
+
+    inline void finish_block(block const& b, char const* target)
+    {
+        if (target != b.dst)
+            memcpy(b.dst, target + b.skip, b.dst_length);
+    }
+
+    // Учитывает результат очередного чтения блока. Возвращает true, если
+    // блок прочитан, и бросает исключение, если файл кончился раньше.
+    inline bool account(block const& b, size_t& done, ssize_t result)
+    {
+        if (result < 0)
+            throw std::system_error(static_cast<int>(-result), std::generic_category(), "read");
+
+        done += result;
+        if (done >= b.needed())
+            return true;
+        if (result == 0)
+            throw std::runtime_error("async_loader: unexpected end of file");
+        return false;
+    }
+
+    inline void pread_block(int fd, block const& b, char* target)
+    {
+        size_t done = 0;
+        for (;;)
+        {
+            ssize_t r = pread(fd, target + done, b.length - done, b.file_offset + done);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (account(b, done, r < 0 ? -errno : r))
+                break;
+        }
+        finish_block(b, target);
+    }
+
+    inline void load_with_threads(int fd, vector<block> const& blocks, bool direct,
+                                  load_options const& options)
+    {
+        size_t threads = std::max<size_t>(1, std::min(options.threads, blocks.size()));
+        bounce_buffers bounce(direct ? threads : 0, options.block_bytes);
+        std::unique_ptr<std::exception_ptr[]> errors(new std::exception_ptr[threads]);
+
+        run_parallel(threads, [&](size_t t) {
+            try
+            {
+                for (size_t i = t; i < blocks.size(); i += threads)
+                    pread_block(fd, blocks[i], direct ? bounce.get(t) : blocks[i].dst);
+            }
+            catch (...)
+            {
+                errors[t] = std::current_exception();
+            }
+        });
+
+        for (size_t t = 0; t != threads; ++t)
+            if (errors[t])
+                std::rethrow_exception(errors[t]);
+    }
+
+#ifdef VECTOR_HAVE_IO_URING
+    // Минимальная обертка над кольцами io_uring: только чтение.
+    struct io_ring
+    {
+        io_ring()
+            : fd_(-1)
+            , sq_ptr_(MAP_FAILED)
+            , cq_ptr_(MAP_FAILED)
+            , sqes_(static_cast<io_uring_sqe*>(MAP_FAILED))
+            , sq_bytes_(0)
+            , cq_bytes_(0)
+            , sqes_bytes_(0)
+            , to_submit_(0)
+        {}
+
+        ~io_ring()
+        {
+            if (sqes_ != MAP_FAILED)
+                munmap(sqes_, sqes_bytes_);
+            if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_)
+                munmap(cq_ptr_, cq_bytes_);
+            if (sq_ptr_ != MAP_FAILED)
+                munmap(sq_ptr_, sq_bytes_);
+            if (fd_ != -1)
+                close(fd_);
+        }
+
+        // Возвращает false, если io_uring недоступен.
+        bool init(unsigned entries)
+        {
+            io_uring_params p;
+            memset(&p, 0, sizeof p);
+
+            fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+            if (fd_ < 0)
+            {
+                fd_ = -1;
+                return false;
+            }
+
+            sq_bytes_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            cq_bytes_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+            bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single_mmap)
+                sq_bytes_ = cq_bytes_ = std::max(sq_bytes_, cq_bytes_);
+
+            sq_ptr_ = mmap(nullptr, sq_bytes_, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+            if (sq_ptr_ == MAP_FAILED)
+                return false;
+
+            if (single_mmap)
+                cq_ptr_ = sq_ptr_;
+            else
+                cq_ptr_ = mmap(nullptr, cq_bytes_, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+            if (cq_ptr_ == MAP_FAILED)
+                return false;
+
+            sqes_bytes_ = p.sq_entries * sizeof(io_uring_sqe);
+            sqes_ = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_bytes_, PROT_READ | PROT_WRITE,
+                                                    MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+            if (sqes_ == MAP_FAILED)
+                return false;
+
+            char* sq = static_cast<char*>(sq_ptr_);
+            sq_head_  = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+            sq_tail_  = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+            sq_mask_  = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+            sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+            sq_entries_ = p.sq_entries;
+
+            char* cq = static_cast<char*>(cq_ptr_);
+            cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+            cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+            cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+            cqes_    = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+            return true;
+        }
+
+        unsigned capacity() const
+        {
+            return sq_entries_;
+        }
+
+        // Ядра без IORING_REGISTER_PROBE не знают и IORING_OP_READ, так что
+        // ошибка самой проверки тоже означает, что операции нет.
+        bool supports(unsigned op) const
+        {
+            size_t const ops = 256;
+            std::unique_ptr<char[]> buffer(new char[sizeof(io_uring_probe) + ops * sizeof(io_uring_probe_op)]());
+            io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buffer.get());
+
+            if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, ops) < 0)
+                return false;
+            return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+        }
+
+        // Кладет чтение в очередь отправки; отправляет submit.
+        void prepare_read(int fd, void* buf, unsigned len, uint64_t offset, uint64_t user_data)
+        {
+            unsigned tail = *sq_tail_;
+            unsigned index = tail & sq_mask_;
+
+            io_uring_sqe& sqe = sqes_[index];
+            memset(&sqe, 0, sizeof sqe);
+            sqe.opcode = IORING_OP_READ;
+            sqe.fd = fd;
+            sqe.addr = reinterpret_cast<uint64_t>(buf);
+            sqe.len = len;
+            sqe.off = offset;
+            sqe.user_data = user_data;
+
+            sq_array_[index] = index;
+            __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+            ++to_submit_;
+        }
+
+        // Отправляет подготовленные запросы и ждет хотя бы одного завершения.
+        void submit_and_wait()
+        {
+            for (;;)
+            {
+                long r = syscall(__NR_io_uring_enter, fd_, to_submit_, 1u,
+                                 IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (r >= 0)
+                {
+                    to_submit_ -= static_cast<unsigned>(r);
+                    return;
+                }
+                if (errno != EINTR)
+                    throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+            }
+        }
+
+        bool pop_completion(uint64_t& user_data, int& result)
+        {
+            unsigned head = *cq_head_;
+            if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+                return false;
+
+            io_uring_cqe const& cqe = cqes_[head & cq_mask_];
+            user_data = cqe.user_data;
+            result = cqe.res;
+            __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+    private:
+        io_ring(io_ring const&);
+        io_ring& operator=(io_ring const&);
+
+    private:
+        int fd_;
+        void* sq_ptr_;
+        void* cq_ptr_;
+        io_uring_sqe* sqes_;
+        size_t sq_bytes_;
+        size_t cq_bytes_;
+        size_t sqes_bytes_;
+
+        unsigned* sq_head_;
+        unsigned* sq_tail_;
+        unsigned sq_mask_;
+        unsigned* sq_array_;
+        unsigned sq_entries_;
+        unsigned to_submit_;
+
+        unsigned* cq_head_;
+        unsigned* cq_tail_;
+        unsigned cq_mask_;
+        io_uring_cqe* cqes_;
+    };
+
+    // Возвращает false, если io_uring недоступен и нужно читать потоками.
+    inline bool load_with_io_uring(int fd, vector<block> const& blocks, bool direct,
+                                   load_options const& options, size_t& requests)
+    {
+        io_ring ring;
+        if (!ring.init(static_cast<unsigned>(std::max<size_t>(1, options.queue_depth)))
+            || !ring.supports(IORING_OP_READ))
+            return false;
+
+        // Запросов в полете не больше, чем мест в очереди отправки, поэтому
+        // очередь завершений (она вдвое больше) никогда не переполняется.
+        size_t depth = std::min<size_t>(ring.capacity(), blocks.size());
+        bounce_buffers bounce(direct ? depth : 0, options.block_bytes);
+
+        // Слот -- это запрос в полете: какой блок и сколько уже прочитано.
+        vector<size_t> slot_block;
+        vector<size_t> slot_done;
+        vector<size_t> free_slots;
+        for (size_t i = 0; i != depth; ++i)
+        {
+            slot_block.push_back(0);
+            slot_done.push_back(0);
+            free_slots.push_back(depth - 1 - i);
+        }
+
+        auto target = [&](size_t slot) {
+            return direct ? bounce.get(slot) : blocks[slot_block[slot]].dst;
+        };
+
+        auto issue = [&](size_t slot) {
+            block const& b = blocks[slot_block[slot]];
+            size_t done = slot_done[slot];
+            ring.prepare_read(fd, target(slot) + done, static_cast<unsigned>(b.length - done),
+                              b.file_offset + done, slot);
+            ++requests;
+        };
+
+        size_t next = 0;
+        size_t in_flight = 0;
+        try
+        {
+            while (next != blocks.size() || in_flight != 0)
+            {
+                for (; next != blocks.size() && !free_slots.empty(); ++next)
+                {
+                    size_t slot = free_slots.back();
+                    free_slots.pop_back();
+                    slot_block[slot] = next;
+                    slot_done[slot] = 0;
+                    issue(slot);
+                    ++in_flight;
+                }
+
+                ring.submit_and_wait();
+
+                uint64_t slot;
+                int result;
+                while (ring.pop_completion(slot, result))
+                {
+                    block const& b = blocks[slot_block[slot]];
+                    if (result == -EINTR || result == -EAGAIN)
+                    {
+                        issue(slot);
+                        continue;
+                    }
+
+                    if (!account(b, slot_done[slot], result))
+                    {
+                        issue(slot);
+                        continue;
+                    }
+
+                    finish_block(b, target(slot));
+                    free_slots.push_back(slot);
+                    --in_flight;
+                }
+            }
+        }
+        catch (...)
+        {
+            // Ядро еще может писать в буферы запросов в полете, поэтому
+            // дожидаемся их, прежде чем отдавать память.
+            while (in_flight != 0)
+            {
+                try
+                {
+                    ring.submit_and_wait();
+                }
+                catch (...)
+                {
+                    break;
+                }
+
+                uint64_t slot;
+                int result;
+                while (ring.pop_completion(slot, result))
+                    --in_flight;
+            }
+            throw;
+        }
+
+        return true;
+    }
+#endif
+
+    template <typename T, typename Alloc, typename SizeT>
+    load_stats load_range(std::string const& path, vector<T, Alloc, SizeT>& v,
+                          size_t offset, size_t expected_bytes, load_options const& options)
+    {
+        load_stats stats = {0, 0, false, false};
+
+        int fd = -1;
+        if (options.direct)
+        {
+            fd = open(path.c_str(), O_RDONLY | O_DIRECT);
+            stats.used_direct = (fd != -1);
+        }
+        if (fd == -1)
+            fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+            vector_io_detail::throw_io_error("open", path);
+        fd_guard guard(fd);
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+            vector_io_detail::throw_io_error("fstat", path);
+
+        size_t file_bytes = static_cast<size_t>(st.st_size);
+        if (file_bytes < offset)
+            throw std::runtime_error("async_loader: " + path + " is truncated");
+
+        size_t bytes = expected_bytes != static_cast<size_t>(-1) ? expected_bytes : file_bytes - offset;
+        if (bytes % sizeof(T) != 0)
+            throw std::runtime_error("async_loader: " + path + " size is not a multiple of the element size");
+        if (bytes > file_bytes - offset)
+            throw std::runtime_error("async_loader: " + path + " is truncated");
+
+        if (stats.used_direct)
+            posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
+        else
+            posix_fadvise(fd, offset, bytes, POSIX_FADV_SEQUENTIAL);
+
+        v.append_construct(bytes / sizeof(T), [&](T* dst, size_t) {
+            vector<block> blocks = split(reinterpret_cast<char*>(dst), offset, bytes,
+                                         options.block_bytes, stats.used_direct);
+#ifdef VECTOR_HAVE_IO_URING
+            if (options.use_io_uring)
+                stats.used_io_uring = load_with_io_uring(fd, blocks, stats.used_direct,
+                                                         options, stats.requests);
+#endif
+            if (!stats.used_io_uring)
+            {
+                load_with_threads(fd, blocks, stats.used_direct, options);
+                stats.requests = blocks.size();
+            }
+        });
+
+        stats.bytes = bytes;
+        return stats;
+    }
+}
+
+template <typename T, typename Alloc, typename SizeT>
+load_stats load_file(std::string const& path, vector<T, Alloc, SizeT>& v,
+                     load_options const& options = load_options())
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "load_file reads elements as raw bytes");
+
+    return async_loader_detail::load_range(path, v, 0, static_cast<size_t>(-1), options);
+}
+
+template <typename T, typename Alloc, typename SizeT>
+load_stats load_binary(std::string const& path, vector<T, Alloc, SizeT>& v,
+                       load_options const& options = load_options())
+{
+    size_t count;
+    {
+        binary_reader<T> reader(path);
+        count = reader.size();
+    }
+
+    // count прочитан из файла, и произведение не должно переполниться.
+    if (count > (SIZE_MAX - sizeof(binary_header)) / sizeof(T))
+        throw std::runtime_error("async_loader: " + path + " has an invalid element count");
+
+    return async_loader_detail::load_range(path, v, sizeof(binary_header), count * sizeof(T), options);
+}
+
+#endif // ASYNC_LOADER_H
@@ -0,0 +1,209 @@
+#include "vector.h"
+#include "numa.h"
+#include "pool_allocator.h"
+#include "padded_vector.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+    typedef std::chrono::steady_clock clock_type;
+
+    double seconds_since(clock_type::time_point start)
+    {
+        return std::chrono::duration<double>(clock_type::now() - start).count();
+    }
+
+    size_t env_size(char const* name, size_t default_value)
+    {
+        char const* value = getenv(name);
+        return value != nullptr ? strtoull(value, nullptr, 10) : default_value;
+    }
+
+    size_t bench_threads()
+    {
+        return default_thread_count(env_size("BENCH_THREADS", 0));
+    }
+
+    volatile double sink;
+
+    // Каждый поток читает свой кусок, разбиение такое же, как в
+    // parallel_resize, и run_pinned закрепляет его за тем же процессором,
+    // что заполнял этот кусок.
+    template <typename Alloc>
+    double scan_bandwidth(vector<double, Alloc> const& v, size_t threads)
+    {
+        size_t const reps = 5;
+        double const* data = v.data();
+        size_t n = v.size();
+
+        clock_type::time_point start = clock_type::now();
+        for (size_t rep = 0; rep != reps; ++rep)
+        {
+            run_pinned(threads, [=](size_t i) {
+                chunk_range r = parallel_chunk(n, threads, i);
+                double sum = 0;
+                for (size_t j = r.first; j != r.last; ++j)
+                    sum += data[j];
+                sink = sum;
+            });
+        }
+        double elapsed = seconds_since(start);
+
+        return reps * n * sizeof(double) / elapsed / 1e9;
+    }
+
+    template <typename Alloc>
+    void report(char const* name, vector<double, Alloc> const& v, size_t threads, double fill_time)
+    {
+        printf("  %-28s fill %8.3f s   scan %7.2f GB/s\n",
+               name, fill_time, scan_bandwidth(v, threads));
+    }
+
+    void numa_bandwidth()
+    {
+        size_t n = env_size("BENCH_NUMA_ELEMENTS", 32 * 1024 * 1024);
+        size_t threads = bench_threads();
+        printf("numa_bandwidth: %zu doubles, %zu threads\n", n, threads);
+
+        {
+            clock_type::time_point start = clock_type::now();
+            vector<double> v;
+            v.reserve(n);
+            for (size_t i = 0; i != n; ++i)
+                v.push_back(1.0);
+            report("heap, serial fill", v, threads, seconds_since(start));
+        }
+
+        {
+            clock_type::time_point start = clock_type::now();
+            vector<double, numa_allocator<double, numa_mode::local> > v;
+            parallel_resize(v, n, 1.0, threads);
+            report("local, first touch", v, threads, seconds_since(start));
+        }
+
+        {
+            clock_type::time_point start = clock_type::now();
+            vector<double, numa_allocator<double, numa_mode::interleave> > v;
+            parallel_resize(v, n, 1.0, threads);
+            report("interleave, first touch", v, threads, seconds_since(start));
+        }
+
+        {
+            clock_type::time_point start = clock_type::now();
+            vector<double, numa_allocator<double, numa_mode::bind, 0> > v;
+            parallel_resize(v, n, 1.0, threads);
+            report("bind node 0, first touch", v, threads, seconds_since(start));
+        }
+    }
+
+    // Каждый поток многократно строит и разрушает вектора разных размеров,
+    // так что буферы всех классов постоянно выделяются и освобождаются.
+    template <typename Alloc>
+    double append_free_time(size_t threads, size_t rounds)
+    {
+        clock_type::time_point start = clock_type::now();
+        run_parallel(threads, [=](size_t i) {
+            size_t sum = 0;
+            for (size_t round = 0; round != rounds; ++round)
+            {
+                vector<size_t, Alloc> a;
+                size_t n = 16 + (round * 7 + i) % 2000;
+                for (size_t j = 0; j != n; ++j)
+                    a.push_back(j);
+                sum += a.back();
+            }
+            sink = sum;
+        });
+        return seconds_since(start);
+    }
+
+    void pool_contention()
+    {
+        size_t rounds = env_size("BENCH_POOL_ROUNDS", 100000);
+        size_t max_threads = bench_threads();
+        printf("pool_contention: %zu vectors per thread\n", rounds);
+
+        for (size_t threads = 1; threads <= max_threads; threads *= 2)
+        {
+            double heap = append_free_time<heap_allocator<size_t> >(threads, rounds);
+            double pool = append_free_time<pool_allocator<size_t> >(threads, rounds);
+            printf("  %3zu threads   malloc %8.3f s   pool %8.3f s   x%.2f\n",
+                   threads, heap, pool, heap / pool);
+        }
+
+        pool_stats s = buffer_pool::stats();
+        printf("  pool: %zu allocations, %zu cache hits, %zu central fetches, "
+               "%zu central returns, %zu system allocations\n",
+               s.allocations, s.cache_hits, s.central_fetches,
+               s.central_returns, s.system_allocations);
+    }
+
+    // Каждый поток увеличивает свой счетчик. volatile не дает компилятору
+    // держать счетчик в регистре, так что каждая итерация пишет в память.
+    template <typename Counters>
+    double counters_time(Counters& counters, size_t threads, size_t increments)
+    {
+        clock_type::time_point start = clock_type::now();
+        run_parallel(threads, [&](size_t i) {
+            size_t volatile& counter = counters[i];
+            for (size_t j = 0; j != increments; ++j)
+                counter = counter + 1;
+        });
+        return seconds_since(start);
+    }
+
+    void padded_counters()
+    {
+        size_t increments = env_size("BENCH_COUNTER_INCREMENTS", 100000000);
+        size_t max_threads = bench_threads();
+        printf("padded_counters: %zu increments per thread\n", increments);
+
+        for (size_t threads = 1; threads <= max_threads; threads *= 2)
+        {
+            vector<size_t> packed;
+            for (size_t i = 0; i != threads; ++i)
+                packed.push_back(0);
+            padded_vector<size_t> padded(threads, 0);
+
+            double packed_time = counters_time(packed, threads, increments);
+            double padded_time = counters_time(padded, threads, increments);
+            printf("  %3zu threads   packed %7.1f Mops/s   padded %7.1f Mops/s\n",
+                   threads,
+                   threads * increments / packed_time / 1e6,
+                   threads * increments / padded_time / 1e6);
+        }
+    }
+
+    struct benchmark
+    {
+        char const* name;
+        void (*run)();
+    };
+
+    benchmark const benchmarks[] =
+    {
+        {"numa_bandwidth", numa_bandwidth},
+        {"pool_contention", pool_contention},
+        {"padded_counters", padded_counters},
+    };
+}
+
+// Без аргументов запускает все бенчмарки, иначе только перечисленные.
+// Размеры задаются переменными окружения BENCH_*.
+int main(int argc, char** argv)
+{
+    for (benchmark const& b : benchmarks)
+    {
+        bool selected = (argc == 1);
+        for (int i = 1; i < argc; ++i)
+            if (strcmp(argv[i], b.name) == 0)
+                selected = true;
+
+        if (selected)
+            b.run();
+    }
+}
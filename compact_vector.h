@@ -0,0 +1,25 @@
+#ifndef COMPACT_VECTOR_H
+#define COMPACT_VECTOR_H
+
+#include "vector.h"
+
+#include <cstdint>
+
+/*
+Вектор с 16-байтным заголовком.
+
+Заголовок vector -- указатель и два size_t, то есть 24 байта. Во
+vector<vector<uint32_t>> с сотнями миллионов коротких строк заголовки
+занимают больше, чем сами элементы. compact_vector -- это vector, который
+хранит размер и емкость в uint32_t, и его заголовок -- 16 байт. Больше
+2^32 - 1 элементов в нем быть не может: рост сверх этого бросает
+std::length_error.
+
+Реализация общая с vector, поэтому интерфейс, гарантии исключений и
+стратегия роста у них совпадают.
+*/
+
+template <typename T, typename Alloc = heap_allocator<T> >
+using compact_vector = vector<T, Alloc, uint32_t>;
+
+#endif // COMPACT_VECTOR_H
@@ -0,0 +1,207 @@
+#ifndef DEFERRED_RECLAIMER_H
+#define DEFERRED_RECLAIMER_H
+
+#include "vector.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/*
+Фоновое разрушение больших векторов.
+
+Деструктор vector<std::string> на миллион элементов вызывает миллион
+деструкторов и освобождает огромный блок, и все это в потоке, который
+обрабатывает запрос. deferred_reclaimer забирает содержимое вектора через
+swap и отдает его фоновому потоку, который разрушит элементы и освободит
+буфер.
+
+Очередь ограничена max_queued элементами и выделяется один раз в
+конструкторе. Если она заполнена, retire не ждет, а разрушает вектор сам:
+задержка вызывающего потока при этом не хуже, чем без reclaimer'а, а
+память, ожидающая освобождения, остается ограниченной. Буферы меньше
+threshold_bytes тоже разрушаются на месте -- передавать их дороже, чем
+освободить.
+
+flush дожидается, пока фоновый поток разберет очередь. Деструктор flush не
+вызывает: он выставляет stopping_, а фоновый поток перед выходом дочищает
+очередь до конца, так что при завершении программы ничего не теряется.
+*/
+
+struct deferred_reclaimer
+{
+    explicit deferred_reclaimer(size_t threshold_bytes = 1 << 20,
+                                size_t max_queued = 64);
+    ~deferred_reclaimer();
+
+    // Забирает содержимое v, после вызова v пуст и не имеет буфера.
+    template <typename T, typename Alloc, typename SizeT>
+    void retire(vector<T, Alloc, SizeT>& v);
+
+    void flush();
+
+    size_t pending() const;
+    size_t reclaimed_inline() const;
+    size_t reclaimed_deferred() const;
+
+private:
+    deferred_reclaimer(deferred_reclaimer const&);
+    deferred_reclaimer& operator=(deferred_reclaimer const&);
+
+    struct garbage
+    {
+        void (*destroy)(void*);
+        void* object;
+    };
+
+    template <typename V>
+    static void destroy_object(void* object);
+
+    bool try_enqueue(garbage g);
+    void run();
+
+private:
+    size_t threshold_bytes_;
+    size_t max_queued_;
+
+    std::unique_ptr<garbage[]> queue_;
+    size_t head_;
+    size_t count_;
+    bool busy_;
+    bool stopping_;
+
+    size_t reclaimed_inline_;
+    size_t reclaimed_deferred_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable idle_;
+    std::thread worker_;
+};
+
+inline deferred_reclaimer::deferred_reclaimer(size_t threshold_bytes, size_t max_queued)
+    : threshold_bytes_(threshold_bytes)
+    , max_queued_(max_queued)
+    , queue_(new garbage[max_queued])
+    , head_(0)
+    , count_(0)
+    , busy_(false)
+    , stopping_(false)
+    , reclaimed_inline_(0)
+    , reclaimed_deferred_(0)
+    , worker_(&deferred_reclaimer::run, this)
+{}
+
+inline deferred_reclaimer::~deferred_reclaimer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_available_.notify_one();
+    worker_.join();
+}
+
+template <typename T, typename Alloc, typename SizeT>
+void deferred_reclaimer::retire(vector<T, Alloc, SizeT>& v)
+{
+    typedef vector<T, Alloc, SizeT> vector_type;
+
+    vector_type local;
+    local.swap(v);
+
+    if (local.capacity() * sizeof(T) >= threshold_bytes_)
+    {
+        std::unique_ptr<vector_type> heap(new vector_type());
+        heap->swap(local);
+
+        garbage g = {&destroy_object<vector_type>, heap.get()};
+        if (try_enqueue(g))
+        {
+            heap.release();
+            return;
+        }
+
+        heap->swap(local);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++reclaimed_inline_;
+    // local разрушается здесь, в вызывающем потоке.
+}
+
+inline void deferred_reclaimer::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (count_ != 0 || busy_)
+        idle_.wait(lock);
+}
+
+inline size_t deferred_reclaimer::pending() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return count_ + (busy_ ? 1 : 0);
+}
+
+inline size_t deferred_reclaimer::reclaimed_inline() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return reclaimed_inline_;
+}
+
+inline size_t deferred_reclaimer::reclaimed_deferred() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return reclaimed_deferred_;
+}
+
+template <typename V>
+void deferred_reclaimer::destroy_object(void* object)
+{
+    delete static_cast<V*>(object);
+}
+
+inline bool deferred_reclaimer::try_enqueue(garbage g)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (count_ == max_queued_)
+            return false;
+
+        queue_[(head_ + count_) % max_queued_] = g;
+        ++count_;
+    }
+    work_available_.notify_one();
+    return true;
+}
+
+inline void deferred_reclaimer::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;)
+    {
+        while (count_ == 0 && !stopping_)
+            work_available_.wait(lock);
+
+        // Перед остановкой очередь дочищается до конца.
+        if (count_ == 0)
+            return;
+
+        garbage g = queue_[head_];
+        head_ = (head_ + 1) % max_queued_;
+        --count_;
+        busy_ = true;
+
+        lock.unlock();
+        g.destroy(g.object);
+        lock.lock();
+
+        busy_ = false;
+        ++reclaimed_deferred_;
+        if (count_ == 0)
+            idle_.notify_all();
+    }
+}
+
+#endif // DEFERRED_RECLAIMER_H
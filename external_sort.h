@@ -0,0 +1,536 @@
+#ifndef EXTERNAL_SORT_H
+#define EXTERNAL_SORT_H
+
+#include "vector.h"
+#include "vector_io.h"
+
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+Внешняя сортировка файлов в двоичном формате vector_io.h.
+
+Первый проход читает вход кусками по memory_budget байт, сортирует каждый
+кусок в памяти и пишет его во временный файл (отсортированный отрезок).
+Затем отрезки сливаются k-путевым слиянием на дереве проигравших: на
+каждый выходной элемент приходится log2(k) сравнений, причем только вдоль
+одного пути от листа к корню.
+
+Каждый отрезок читается блоками в два буфера: пока слияние берет
+элементы из одного, следующий блок читается в другой в фоне. Читает один
+поток на все слияние: отрезки оставляют ему заявки, и он выполняет их по
+очереди, так что поток не создается заново на каждый блок. Бюджет
+памяти при слиянии делится между 2 * k буферами, и если отрезков так много,
+что блок получился бы меньше min_block_bytes, слияние делается в
+несколько проходов по fan_in отрезков.
+
+Сортировка не стабильна: отрезки сортируются std::sort.
+
+Временные файлы по умолчанию создаются в /var/tmp: /tmp часто смонтирован
+как tmpfs, и отрезки, которые не поместились в бюджет памяти, все равно
+оказались бы в памяти.
+*/
+
+struct external_sort_stats
+{
+    size_t runs;
+    size_t merge_passes;
+};
+
+namespace external_sort_detail
+{
+    size_t const min_block_bytes = 64 * 1024;
+    size_t const max_fan_in = 512;
+
+    // Временные файлы удаляются, даже если сортировка прервалась исключением.
+    struct temp_files
+    {
+        explicit temp_files(std::string const& dir)
+            : dir_(dir)
+        {}
+
+        ~temp_files()
+        {
+            for (size_t i = 0; i != paths_.size(); ++i)
+                remove_file(paths_[i]);
+        }
+
+        std::string create()
+        {
+            std::string path = dir_ + "/external_sort.XXXXXX";
+            int fd = mkstemp(&path[0]);
+            if (fd == -1)
+                vector_io_detail::throw_io_error("mkstemp", path);
+            close(fd);
+
+            paths_.push_back(path);
+            return path;
+        }
+
+        void remove_file(std::string const& path)
+        {
+            unlink(path.c_str());
+        }
+
+    private:
+        std::string dir_;
+        vector<std::string> paths_;
+    };
+
+    /*
+    Фоновый поток, выполняющий заявки на чтение по очереди. У каждой
+    заявки не больше одного выполнения в очереди, поэтому очередь на
+    max_requests заявок выделяется один раз и не переполняется.
+    */
+    struct prefetcher
+    {
+        struct request
+        {
+            explicit request(std::function<void()> const& task)
+                : task(task)
+                , pending(false)
+            {}
+
+            std::function<void()> task;
+            bool pending;
+            std::exception_ptr error;
+        };
+
+        explicit prefetcher(size_t max_requests)
+            : max_requests_(max_requests)
+            , queue_(new request*[max_requests])
+            , head_(0)
+            , count_(0)
+            , stopping_(false)
+            , worker_(&prefetcher::run, this)
+        {}
+
+        ~prefetcher()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            work_available_.notify_one();
+            worker_.join();
+        }
+
+        void submit(request& r)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                assert(!r.pending && count_ != max_requests_);
+                r.pending = true;
+                r.error = std::exception_ptr();
+                queue_[(head_ + count_) % max_requests_] = &r;
+                ++count_;
+            }
+            work_available_.notify_one();
+        }
+
+        // Дожидается выполнения r и возвращает исключение, если оно было.
+        std::exception_ptr wait(request& r)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (r.pending)
+                done_.wait(lock);
+            return r.error;
+        }
+
+    private:
+        prefetcher(prefetcher const&);
+        prefetcher& operator=(prefetcher const&);
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (;;)
+            {
+                while (count_ == 0 && !stopping_)
+                    work_available_.wait(lock);
+                if (count_ == 0)
+                    return;
+
+                request* r = queue_[head_];
+                head_ = (head_ + 1) % max_requests_;
+                --count_;
+
+                lock.unlock();
+                std::exception_ptr error;
+                try
+                {
+                    r->task();
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+                lock.lock();
+
+                r->error = error;
+                r->pending = false;
+                done_.notify_one();
+            }
+        }
+
+    private:
+        size_t max_requests_;
+        std::unique_ptr<request*[]> queue_;
+        size_t head_;
+        size_t count_;
+        bool stopping_;
+
+        std::mutex mutex_;
+        std::condition_variable work_available_;
+        std::condition_variable done_;
+        std::thread worker_;
+    };
+
+    template <typename T>
+    struct run_reader
+    {
+        run_reader(std::string const& path, size_t block_elements, prefetcher& background)
+            : reader_(path)
+            , block_elements_(block_elements)
+            , active_(0)
+            , position_(0)
+            , prefetched_(false)
+            , background_(background)
+            , request_([this]() { fill(buffers_[active_ ^ 1]); })
+        {
+            fill(buffers_[0]);
+            prefetch();
+        }
+
+        ~run_reader()
+        {
+            // Фоновое чтение пишет в buffers_, дожидаемся его.
+            background_.wait(request_);
+        }
+
+        bool done() const
+        {
+            return position_ == buffers_[active_].size();
+        }
+
+        T const& current() const
+        {
+            return buffers_[active_][position_];
+        }
+
+        void advance()
+        {
+            ++position_;
+            if (position_ != buffers_[active_].size() || !prefetched_)
+                return;
+
+            prefetched_ = false;
+            std::exception_ptr error = background_.wait(request_);
+            if (error)
+                std::rethrow_exception(error);
+
+            active_ ^= 1;
+            position_ = 0;
+            prefetch();
+        }
+
+    private:
+        void fill(vector<T>& buffer)
+        {
+            buffer.clear();
+            size_t count = std::min(block_elements_, reader_.remaining());
+            buffer.append_construct(count, [&](T* dst, size_t n) {
+                reader_.read(dst, n);
+            });
+        }
+
+        void prefetch()
+        {
+            prefetched_ = reader_.remaining() != 0;
+            if (prefetched_)
+                background_.submit(request_);
+        }
+
+    private:
+        binary_reader<T> reader_;
+        size_t block_elements_;
+        vector<T> buffers_[2];
+        size_t active_;
+        size_t position_;
+        bool prefetched_;
+        prefetcher& background_;
+        prefetcher::request request_;
+    };
+
+    /*
+    Дерево проигравших на k листьях. tree_[0] -- победитель (индекс
+    источника с наименьшим текущим элементом), во внутренних узлах 1..k-1
+    хранятся проигравшие соответствующих матчей. Лист i условно находится
+    в позиции k + i, поэтому его родитель -- (k + i) / 2. Исчерпанный
+    источник проигрывает всем, а равные элементы упорядочиваются по номеру
+    источника.
+    */
+    template <typename T, typename Less>
+    struct loser_tree
+    {
+        loser_tree(vector<run_reader<T>*> const& sources, Less less)
+            : sources_(sources)
+            , less_(less)
+        {
+            size_t k = sources_.size();
+            size_t const empty = k;
+            for (size_t i = 0; i != k; ++i)
+                tree_.push_back(empty);
+
+            for (size_t i = 0; i != k; ++i)
+            {
+                size_t winner = i;
+                size_t node = (k + i) / 2;
+                for (; node != 0; node /= 2)
+                {
+                    if (tree_[node] == empty)
+                    {
+                        tree_[node] = winner;
+                        break;
+                    }
+                    if (beats(tree_[node], winner))
+                        std::swap(tree_[node], winner);
+                }
+                if (node == 0)
+                    tree_[0] = winner;
+            }
+        }
+
+        bool done() const
+        {
+            return sources_[tree_[0]]->done();
+        }
+
+        T const& top() const
+        {
+            return sources_[tree_[0]]->current();
+        }
+
+        void pop()
+        {
+            size_t winner = tree_[0];
+            sources_[winner]->advance();
+
+            for (size_t node = (sources_.size() + winner) / 2; node != 0; node /= 2)
+                if (beats(tree_[node], winner))
+                    std::swap(tree_[node], winner);
+
+            tree_[0] = winner;
+        }
+
+    private:
+        bool beats(size_t a, size_t b) const
+        {
+            if (sources_[a]->done())
+                return false;
+            if (sources_[b]->done())
+                return true;
+
+            T const& x = sources_[a]->current();
+            T const& y = sources_[b]->current();
+            if (less_(x, y))
+                return true;
+            if (less_(y, x))
+                return false;
+            return a < b;
+        }
+
+    private:
+        vector<run_reader<T>*> const& sources_;
+        Less less_;
+        vector<size_t> tree_;
+    };
+
+    template <typename T, typename Less, typename Sink>
+    void merge(vector<std::string> const& runs, size_t first, size_t last,
+               size_t memory_budget, Less less, Sink& sink)
+    {
+        size_t k = last - first;
+        size_t block_elements = memory_budget / (2 * k * sizeof(T));
+        if (block_elements == 0)
+            block_elements = 1;
+
+        // Отрезки удаляются раньше потока, который в них читает.
+        prefetcher background(k);
+        vector<run_reader<T>*> sources;
+        try
+        {
+            for (size_t i = first; i != last; ++i)
+            {
+                std::unique_ptr<run_reader<T> > reader(new run_reader<T>(runs[i], block_elements, background));
+                sources.push_back(reader.get());
+                reader.release();
+            }
+
+            loser_tree<T, Less> tree(sources, less);
+            for (; !tree.done(); tree.pop())
+                sink(tree.top());
+        }
+        catch (...)
+        {
+            for (size_t i = 0; i != sources.size(); ++i)
+                delete sources[i];
+            throw;
+        }
+
+        for (size_t i = 0; i != sources.size(); ++i)
+            delete sources[i];
+    }
+
+    template <typename T>
+    struct file_sink
+    {
+        explicit file_sink(std::string const& path)
+            : writer(path)
+        {}
+
+        void operator()(T const& val)
+        {
+            writer.write(val);
+        }
+
+        binary_writer<T> writer;
+    };
+
+    template <typename T, typename Alloc, typename SizeT>
+    struct vector_sink
+    {
+        explicit vector_sink(vector<T, Alloc, SizeT>& out)
+            : out(out)
+        {}
+
+        void operator()(T const& val)
+        {
+            out.push_back(val);
+        }
+
+        vector<T, Alloc, SizeT>& out;
+    };
+
+    template <typename T, typename Less>
+    vector<std::string> make_runs(std::string const& input, size_t memory_budget,
+                                  Less less, temp_files& temps)
+    {
+        binary_reader<T> reader(input);
+
+        size_t chunk_elements = memory_budget / sizeof(T);
+        if (chunk_elements == 0)
+            chunk_elements = 1;
+
+        vector<T> chunk;
+        chunk.reserve(std::min(chunk_elements, reader.remaining()));
+
+        vector<std::string> runs;
+        while (reader.remaining() != 0)
+        {
+            chunk.clear();
+            chunk.append_construct(std::min(chunk_elements, reader.remaining()),
+                                   [&](T* dst, size_t n) {
+                reader.read(dst, n);
+            });
+            std::sort(chunk.begin(), chunk.end(), less);
+
+            std::string path = temps.create();
+            write_binary(path, chunk);
+            runs.push_back(path);
+        }
+
+        return runs;
+    }
+
+    // Сливает отрезки группами, пока их не останется не больше fan_in.
+    template <typename T, typename Less>
+    vector<std::string> reduce_runs(vector<std::string> runs, size_t memory_budget,
+                                    Less less, temp_files& temps, size_t& passes)
+    {
+        size_t fan_in = memory_budget / (2 * min_block_bytes);
+        fan_in = std::max<size_t>(2, std::min(fan_in, max_fan_in));
+
+        while (runs.size() > fan_in)
+        {
+            vector<std::string> next;
+            for (size_t first = 0; first < runs.size(); first += fan_in)
+            {
+                size_t last = std::min(first + fan_in, runs.size());
+                if (last - first == 1)
+                {
+                    next.push_back(runs[first]);
+                    continue;
+                }
+
+                std::string path = temps.create();
+                file_sink<T> sink(path);
+                merge<T>(runs, first, last, memory_budget, less, sink);
+                sink.writer.finish();
+                next.push_back(path);
+
+                for (size_t i = first; i != last; ++i)
+                    temps.remove_file(runs[i]);
+            }
+            runs.swap(next);
+            ++passes;
+        }
+
+        return runs;
+    }
+
+    template <typename T, typename Less, typename Sink>
+    external_sort_stats sort(std::string const& input, size_t memory_budget,
+                             std::string const& temp_dir, Less less, Sink& sink)
+    {
+        temp_files temps(temp_dir);
+        external_sort_stats stats = {0, 0};
+
+        vector<std::string> runs = make_runs<T>(input, memory_budget, less, temps);
+        stats.runs = runs.size();
+
+        runs = reduce_runs<T>(runs, memory_budget, less, temps, stats.merge_passes);
+
+        if (!runs.empty())
+        {
+            merge<T>(runs, 0, runs.size(), memory_budget, less, sink);
+            ++stats.merge_passes;
+        }
+
+        return stats;
+    }
+}
+
+template <typename T, typename Less = std::less<T> >
+external_sort_stats external_sort(std::string const& input, std::string const& output,
+                                  size_t memory_budget, std::string const& temp_dir = "/var/tmp",
+                                  Less less = Less())
+{
+    external_sort_detail::file_sink<T> sink(output);
+    external_sort_stats stats = external_sort_detail::sort<T>(input, memory_budget, temp_dir, less, sink);
+    sink.writer.finish();
+    return stats;
+}
+
+// Дописывает отсортированное содержимое файла в конец out.
+template <typename T, typename Alloc, typename SizeT, typename Less = std::less<T> >
+external_sort_stats external_sort(std::string const& input, vector<T, Alloc, SizeT>& out,
+                                  size_t memory_budget, std::string const& temp_dir = "/var/tmp",
+                                  Less less = Less())
+{
+    external_sort_detail::vector_sink<T, Alloc, SizeT> sink(out);
+    return external_sort_detail::sort<T>(input, memory_budget, temp_dir, less, sink);
+}
+
+#endif // EXTERNAL_SORT_H
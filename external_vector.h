@@ -0,0 +1,444 @@
+#ifndef EXTERNAL_VECTOR_H
+#define EXTERNAL_VECTOR_H
+
+#include "vector.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+Вектор, который не обязан помещаться в память.
+
+Элементы разбиты на страницы фиксированного размера. В памяти держится не
+больше memory_budget байт страниц (но не меньше двух страниц), остальные
+лежат в файле подкачки. Вытесняется страница, к которой дольше всего не
+обращались (LRU); на диск она пишется, только если была изменена. Файл
+подкачки создается в spill_dir и сразу удаляется из каталога, поэтому
+после завершения процесса от него ничего не остается. По умолчанию это
+/var/tmp: /tmp часто смонтирован как tmpfs, и вытесненные страницы
+оставались бы в памяти.
+
+Последовательный проход распознается по промахам подряд идущих страниц:
+в этом случае ядру заранее сообщается о следующих readahead_pages
+страницах (posix_fadvise), и к моменту обращения они уже читаются.
+
+operator[] возвращает ссылку, которая действительна только до следующего
+обращения к вектору: следующий промах может вытеснить ее страницу.
+Поскольку через ссылку можно писать, operator[] помечает страницу
+измененной; для чтения без лишней записи на диск есть get.
+*/
+
+template <typename T>
+struct external_vector
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "external_vector stores elements as raw bytes");
+
+    static size_t const readahead_pages = 4;
+
+    explicit external_vector(size_t memory_budget,
+                             char const* spill_dir = "/var/tmp",
+                             size_t page_bytes = 1 << 20);
+    ~external_vector();
+
+    T& operator[](size_t i);
+    T get(size_t i);
+    void set(size_t i, T const& val);
+
+    size_t size() const;
+    bool empty() const;
+
+    void push_back(T const&);
+    void pop_back();
+
+    // Записывает все измененные страницы в файл подкачки.
+    void flush();
+
+    size_t elements_per_page() const;
+    size_t resident_pages() const;
+    size_t page_faults() const;
+    size_t page_writes() const;
+
+private:
+    external_vector(external_vector const&);
+    external_vector& operator=(external_vector const&);
+
+    static size_t const npos = static_cast<size_t>(-1);
+
+    struct frame
+    {
+        size_t page;
+        size_t prev;
+        size_t next;
+        bool dirty;
+    };
+
+    T* frame_data(size_t f);
+    size_t frame_for(size_t page);
+    size_t fault(size_t page);
+
+    void unlink_frame(size_t f);
+    void link_front(size_t f);
+    void write_back(size_t f);
+
+private:
+    int fd_;
+    size_t per_page_;
+    size_t frame_count_;
+    T* buffer_;
+
+    size_t size_;
+
+    vector<frame> frames_;
+    vector<size_t> page_frame_;
+    vector<char> on_disk_;
+    size_t used_frames_;
+    size_t lru_head_;
+    size_t lru_tail_;
+
+    size_t last_page_;
+    size_t last_frame_;
+    size_t last_fault_;
+
+    size_t page_faults_;
+    size_t page_writes_;
+};
+
+template <typename T>
+size_t const external_vector<T>::npos;
+
+template <typename T>
+external_vector<T>::external_vector(size_t memory_budget, char const* spill_dir, size_t page_bytes)
+    : fd_(-1)
+    , per_page_(page_bytes / sizeof(T) != 0 ? page_bytes / sizeof(T) : 1)
+    , frame_count_(0)
+    , buffer_(nullptr)
+    , size_(0)
+    , used_frames_(0)
+    , lru_head_(npos)
+    , lru_tail_(npos)
+    , last_page_(npos)
+    , last_frame_(npos)
+    , last_fault_(npos)
+    , page_faults_(0)
+    , page_writes_(0)
+{
+    frame_count_ = memory_budget / (per_page_ * sizeof(T));
+    if (frame_count_ < 2)
+        frame_count_ = 2;
+
+    std::string path = std::string(spill_dir) + "/external_vector.XXXXXX";
+    fd_ = mkstemp(&path[0]);
+    if (fd_ == -1)
+        throw std::system_error(errno, std::generic_category(), "mkstemp");
+    unlink(path.c_str());
+
+    try
+    {
+        buffer_ = heap_allocator<T>::allocate(frame_count_ * per_page_);
+
+        frames_.reserve(frame_count_);
+        for (size_t i = 0; i != frame_count_; ++i)
+        {
+            frame f = {npos, npos, npos, false};
+            frames_.push_back(f);
+        }
+    }
+    catch (...)
+    {
+        if (buffer_ != nullptr)
+            heap_allocator<T>::deallocate(buffer_, frame_count_ * per_page_);
+        close(fd_);
+        throw;
+    }
+}
+
+template <typename T>
+external_vector<T>::~external_vector()
+{
+    heap_allocator<T>::deallocate(buffer_, frame_count_ * per_page_);
+    close(fd_);
+}
+
+template <typename T>
+T& external_vector<T>::operator[](size_t i)
+{
+    size_t f = frame_for(i / per_page_);
+    frames_[f].dirty = true;
+    return frame_data(f)[i % per_page_];
+}
+
+template <typename T>
+T external_vector<T>::get(size_t i)
+{
+    return frame_data(frame_for(i / per_page_))[i % per_page_];
+}
+
+template <typename T>
+void external_vector<T>::set(size_t i, T const& val)
+{
+    (*this)[i] = val;
+}
+
+template <typename T>
+size_t external_vector<T>::size() const
+{
+    return size_;
+}
+
+template <typename T>
+bool external_vector<T>::empty() const
+{
+    return size_ == 0;
+}
+
+template <typename T>
+void external_vector<T>::push_back(T const& val)
+{
+    if (size_ % per_page_ == 0)
+    {
+        page_frame_.push_back(npos);
+        on_disk_.push_back(0);
+    }
+
+    // val может быть ссылкой, полученной из operator[], а вытеснение ее
+    // страницы эту ссылку инвалидирует, поэтому сначала копируем. Если
+    // запись вытесняемой страницы бросит исключение, откатываем размер и
+    // таблицу страниц.
+    T copy = val;
+    ++size_;
+    try
+    {
+        (*this)[size_ - 1] = copy;
+    }
+    catch (...)
+    {
+        --size_;
+        if (size_ % per_page_ == 0)
+        {
+            page_frame_.pop_back();
+            on_disk_.pop_back();
+        }
+        throw;
+    }
+}
+
+template <typename T>
+void external_vector<T>::pop_back()
+{
+    assert(size_ != 0);
+
+    --size_;
+    if (size_ % per_page_ != 0)
+        return;
+
+    // Последняя страница опустела: освобождаем ее фрейм, если он есть.
+    size_t page = page_frame_.size() - 1;
+    size_t f = page_frame_[page];
+    if (f != npos)
+    {
+        unlink_frame(f);
+        frames_[f].page = npos;
+        frames_[f].dirty = false;
+        // Фрейм возвращается в конец списка, чтобы его взяли первым.
+        frames_[f].prev = lru_tail_;
+        frames_[f].next = npos;
+        if (lru_tail_ != npos)
+            frames_[lru_tail_].next = f;
+        else
+            lru_head_ = f;
+        lru_tail_ = f;
+    }
+    if (last_page_ == page)
+        last_page_ = npos;
+
+    page_frame_.pop_back();
+    on_disk_.pop_back();
+}
+
+template <typename T>
+void external_vector<T>::flush()
+{
+    for (size_t f = 0; f != frame_count_; ++f)
+        if (frames_[f].page != npos && frames_[f].dirty)
+            write_back(f);
+}
+
+template <typename T>
+size_t external_vector<T>::elements_per_page() const
+{
+    return per_page_;
+}
+
+template <typename T>
+size_t external_vector<T>::resident_pages() const
+{
+    size_t result = 0;
+    for (size_t f = 0; f != frames_.size(); ++f)
+        if (frames_[f].page != npos)
+            ++result;
+    return result;
+}
+
+template <typename T>
+size_t external_vector<T>::page_faults() const
+{
+    return page_faults_;
+}
+
+template <typename T>
+size_t external_vector<T>::page_writes() const
+{
+    return page_writes_;
+}
+
+template <typename T>
+T* external_vector<T>::frame_data(size_t f)
+{
+    return buffer_ + f * per_page_;
+}
+
+template <typename T>
+size_t external_vector<T>::frame_for(size_t page)
+{
+    // Подряд идущие обращения к одной странице не трогают LRU-список.
+    if (page == last_page_)
+        return last_frame_;
+
+    size_t f = page_frame_[page];
+    if (f == npos)
+    {
+        f = fault(page);
+    }
+    else
+    {
+        unlink_frame(f);
+        link_front(f);
+    }
+
+    last_page_ = page;
+    last_frame_ = f;
+    return f;
+}
+
+template <typename T>
+size_t external_vector<T>::fault(size_t page)
+{
+    size_t f;
+    if (used_frames_ != frame_count_)
+    {
+        f = used_frames_++;
+    }
+    else
+    {
+        f = lru_tail_;
+        if (frames_[f].page != npos)
+        {
+            if (frames_[f].dirty)
+                write_back(f);
+            page_frame_[frames_[f].page] = npos;
+            if (last_page_ == frames_[f].page)
+                last_page_ = npos;
+        }
+        unlink_frame(f);
+    }
+
+    size_t page_bytes = per_page_ * sizeof(T);
+    if (on_disk_[page])
+    {
+        char* dst = reinterpret_cast<char*>(frame_data(f));
+        off_t offset = static_cast<off_t>(page) * page_bytes;
+        for (size_t done = 0; done != page_bytes; )
+        {
+            ssize_t r = pread(fd_, dst + done, page_bytes - done, offset + done);
+            if (r <= 0)
+            {
+                if (r < 0 && errno == EINTR)
+                    continue;
+                frames_[f].page = npos;
+                link_front(f);
+                throw std::system_error(r < 0 ? errno : EIO, std::generic_category(), "pread");
+            }
+            done += r;
+        }
+    }
+
+    if (last_fault_ != npos && page == last_fault_ + 1)
+    {
+        posix_fadvise(fd_, static_cast<off_t>(page + 1) * page_bytes,
+                      readahead_pages * page_bytes, POSIX_FADV_WILLNEED);
+    }
+    last_fault_ = page;
+
+    frames_[f].page = page;
+    frames_[f].dirty = false;
+    page_frame_[page] = f;
+    link_front(f);
+
+    ++page_faults_;
+    return f;
+}
+
+template <typename T>
+void external_vector<T>::unlink_frame(size_t f)
+{
+    frame& fr = frames_[f];
+    if (fr.prev != npos)
+        frames_[fr.prev].next = fr.next;
+    else if (lru_head_ == f)
+        lru_head_ = fr.next;
+
+    if (fr.next != npos)
+        frames_[fr.next].prev = fr.prev;
+    else if (lru_tail_ == f)
+        lru_tail_ = fr.prev;
+
+    fr.prev = npos;
+    fr.next = npos;
+}
+
+template <typename T>
+void external_vector<T>::link_front(size_t f)
+{
+    frames_[f].prev = npos;
+    frames_[f].next = lru_head_;
+    if (lru_head_ != npos)
+        frames_[lru_head_].prev = f;
+    lru_head_ = f;
+    if (lru_tail_ == npos)
+        lru_tail_ = f;
+}
+
+template <typename T>
+void external_vector<T>::write_back(size_t f)
+{
+    size_t page = frames_[f].page;
+    size_t page_bytes = per_page_ * sizeof(T);
+    char const* src = reinterpret_cast<char const*>(frame_data(f));
+    off_t offset = static_cast<off_t>(page) * page_bytes;
+
+    for (size_t done = 0; done != page_bytes; )
+    {
+        ssize_t r = pwrite(fd_, src + done, page_bytes - done, offset + done);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), "pwrite");
+        }
+        done += r;
+    }
+
+    frames_[f].dirty = false;
+    on_disk_[page] = 1;
+    ++page_writes_;
+}
+
+#endif // EXTERNAL_VECTOR_H
@@ -0,0 +1,359 @@
+#ifndef FORK_SNAPSHOT_H
+#define FORK_SNAPSHOT_H
+
+#include "vector.h"
+#include "vector_io.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+Согласованные снимки векторов через fork, как BGSAVE в Redis.
+
+Векторы регистрируются вместе с путями файлов. start() запоминает их
+данные и размеры и делает fork: дочерний процесс видит память такой,
+какой она была в момент fork, и пишет ее в файлы в формате vector_io.h,
+а родитель продолжает менять векторы. Ядро копирует только те страницы,
+которые родитель успел изменить (copy-on-write), так что писатели не
+останавливаются на время записи.
+
+После fork в многопоточной программе в дочернем процессе можно вызывать
+только async-signal-safe функции: другой поток мог держать блокировку
+malloc или stdio. Поэтому все строки и заголовки готовятся до fork, а
+дочерний процесс пользуется только open, write, fsync, rename, close и
+_exit.
+Чтобы снимок был согласованным, start() нужно вызывать там, где
+зарегистрированные векторы никто не меняет, например из потока-писателя.
+
+Дочерний процесс сообщает о ходе записи через неблокирующий канал
+(сообщение, не поместившееся в канал, пропускается), а результат -- кодом
+завершения: 0 или errno. Родитель забирает сообщения в poll() и вызывает
+обработчики прогресса и завершения в своем потоке; wait() ждет конца.
+Файлы пишутся во временные, сбрасываются на диск и переименовываются,
+а после rename сбрасывается каталог, поэтому по путям всегда лежат
+целые снимки, в том числе после сбоя питания.
+*/
+
+struct snapshot_progress
+{
+    uint64_t bytes_written;
+    uint64_t bytes_total;
+};
+
+struct fork_snapshotter
+{
+    typedef std::function<void(snapshot_progress const&)> progress_handler;
+    typedef std::function<void(std::error_code const&)> completion_handler;
+
+    // Сообщение о прогрессе отправляется после каждых chunk_bytes байт.
+    explicit fork_snapshotter(size_t chunk_bytes = 1 << 20);
+    ~fork_snapshotter();
+
+    // Вектор должен жить, пока он зарегистрирован.
+    template <typename T, typename Alloc, typename SizeT>
+    void add(std::string const& path, vector<T, Alloc, SizeT> const& v);
+    void clear();
+
+    // Бросает std::logic_error, если предыдущий снимок еще пишется.
+    void start(progress_handler on_progress = progress_handler(),
+               completion_handler on_complete = completion_handler());
+
+    bool running() const;
+
+    // Ждет сообщений не дольше timeout_ms и вызывает обработчики.
+    // Возвращает true, если снимок завершился.
+    bool poll(int timeout_ms = 0);
+    void wait();
+
+private:
+    fork_snapshotter(fork_snapshotter const&);
+    fork_snapshotter& operator=(fork_snapshotter const&);
+
+    struct entry
+    {
+        std::string path;
+        std::string temp_path;
+        std::string dir;
+        void const* source;
+        void (*capture)(void const* source, entry& e);
+
+        binary_header header;
+        char const* data;
+        size_t bytes;
+    };
+
+    template <typename T, typename Alloc, typename SizeT>
+    static void capture_vector(void const* source, entry& e);
+
+    static void report(int pipe_fd, snapshot_progress const& progress);
+    void write_all(int pipe_fd) const;
+    int write_entry(int pipe_fd, entry const& e, snapshot_progress& progress) const;
+    void finish(int status);
+
+private:
+    size_t chunk_bytes_;
+    vector<entry> entries_;
+
+    pid_t child_;
+    int pipe_fd_;
+    progress_handler on_progress_;
+    completion_handler on_complete_;
+};
+
+namespace fork_snapshot_detail
+{
+    inline bool write_fully(int fd, char const* data, size_t bytes)
+    {
+        while (bytes != 0)
+        {
+            ssize_t r = ::write(fd, data, bytes);
+            if (r < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            data += r;
+            bytes -= r;
+        }
+        return true;
+    }
+}
+
+inline fork_snapshotter::fork_snapshotter(size_t chunk_bytes)
+    : chunk_bytes_(chunk_bytes != 0 ? chunk_bytes : 1)
+    , child_(-1)
+    , pipe_fd_(-1)
+{}
+
+inline fork_snapshotter::~fork_snapshotter()
+{
+    if (child_ != -1)
+    {
+        int status;
+        while (waitpid(child_, &status, 0) == -1 && errno == EINTR)
+            ;
+        close(pipe_fd_);
+    }
+}
+
+template <typename T, typename Alloc, typename SizeT>
+void fork_snapshotter::add(std::string const& path, vector<T, Alloc, SizeT> const& v)
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "snapshots store elements as raw bytes");
+
+    entry e;
+    e.path = path;
+    e.temp_path = path + ".tmp";
+    size_t slash = path.rfind('/');
+    e.dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    e.source = &v;
+    e.capture = &capture_vector<T, Alloc, SizeT>;
+    e.data = nullptr;
+    e.bytes = 0;
+    entries_.push_back(e);
+}
+
+inline void fork_snapshotter::clear()
+{
+    entries_.clear();
+}
+
+template <typename T, typename Alloc, typename SizeT>
+void fork_snapshotter::capture_vector(void const* source, entry& e)
+{
+    vector<T, Alloc, SizeT> const& v = *static_cast<vector<T, Alloc, SizeT> const*>(source);
+
+    memcpy(e.header.magic, vector_io_detail::magic, sizeof e.header.magic);
+    e.header.version = vector_io_detail::version;
+    e.header.element_size = sizeof(T);
+    e.header.count = v.size();
+    e.data = reinterpret_cast<char const*>(v.data());
+    e.bytes = v.size() * sizeof(T);
+}
+
+inline void fork_snapshotter::start(progress_handler on_progress, completion_handler on_complete)
+{
+    if (child_ != -1)
+        throw std::logic_error("fork_snapshotter: snapshot is already running");
+
+    for (size_t i = 0; i != entries_.size(); ++i)
+        entries_[i].capture(entries_[i].source, entries_[i]);
+
+    // O_CLOEXEC ставится атомарно с созданием, иначе pipe мог бы утечь в
+    // процесс, запущенный другим потоком между pipe и fcntl. Неблокирующим
+    // делается только конец, в который пишет ребенок.
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0)
+        throw std::system_error(errno, std::generic_category(), "pipe2");
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        int error = errno;
+        close(fds[0]);
+        close(fds[1]);
+        throw std::system_error(error, std::generic_category(), "fork");
+    }
+
+    if (pid == 0)
+    {
+        close(fds[0]);
+        write_all(fds[1]);
+    }
+
+    close(fds[1]);
+    child_ = pid;
+    pipe_fd_ = fds[0];
+    on_progress_.swap(on_progress);
+    on_complete_.swap(on_complete);
+}
+
+inline bool fork_snapshotter::running() const
+{
+    return child_ != -1;
+}
+
+inline bool fork_snapshotter::poll(int timeout_ms)
+{
+    if (child_ == -1)
+        return true;
+
+    pollfd p = {pipe_fd_, POLLIN, 0};
+    int r = ::poll(&p, 1, timeout_ms);
+    if (r < 0 && errno != EINTR)
+        throw std::system_error(errno, std::generic_category(), "poll");
+    if (r <= 0)
+        return false;
+
+    // Сообщения меньше PIPE_BUF, поэтому пишутся и читаются целиком.
+    snapshot_progress messages[64];
+    ssize_t n;
+    while ((n = read(pipe_fd_, messages, sizeof messages)) < 0 && errno == EINTR)
+        ;
+    if (n < 0)
+        throw std::system_error(errno, std::generic_category(), "read");
+
+    if (n == 0)
+    {
+        // Дочерний процесс закрыл канал, то есть завершился.
+        int status;
+        while (waitpid(child_, &status, 0) == -1 && errno == EINTR)
+            ;
+        finish(status);
+        return true;
+    }
+
+    if (on_progress_)
+        for (size_t i = 0; i != n / sizeof(snapshot_progress); ++i)
+            on_progress_(messages[i]);
+    return false;
+}
+
+inline void fork_snapshotter::wait()
+{
+    while (!poll(-1))
+        ;
+}
+
+// Выполняется в дочернем процессе и не возвращается.
+// Канал неблокирующий: если родитель не успевает читать, сообщение
+// теряется, но запись не останавливается.
+inline void fork_snapshotter::report(int pipe_fd, snapshot_progress const& progress)
+{
+    ssize_t r = ::write(pipe_fd, &progress, sizeof progress);
+    (void)r;
+}
+
+inline void fork_snapshotter::write_all(int pipe_fd) const
+{
+    snapshot_progress progress = {0, 0};
+    for (size_t i = 0; i != entries_.size(); ++i)
+        progress.bytes_total += sizeof(binary_header) + entries_[i].bytes;
+
+    for (size_t i = 0; i != entries_.size(); ++i)
+    {
+        int error = write_entry(pipe_fd, entries_[i], progress);
+        if (error != 0)
+            _exit(error);
+    }
+    _exit(0);
+}
+
+inline int fork_snapshotter::write_entry(int pipe_fd, entry const& e, snapshot_progress& progress) const
+{
+    int fd = open(e.temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return errno;
+
+    bool ok = fork_snapshot_detail::write_fully(fd, reinterpret_cast<char const*>(&e.header), sizeof e.header);
+    progress.bytes_written += sizeof e.header;
+    report(pipe_fd, progress);
+
+    for (size_t done = 0; ok && done != e.bytes; )
+    {
+        size_t chunk = e.bytes - done < chunk_bytes_ ? e.bytes - done : chunk_bytes_;
+        ok = fork_snapshot_detail::write_fully(fd, e.data + done, chunk);
+        done += chunk;
+        progress.bytes_written += chunk;
+        report(pipe_fd, progress);
+    }
+
+    // Данные должны попасть на диск раньше, чем rename.
+    if (ok)
+        ok = fsync(fd) == 0;
+
+    int error = ok ? 0 : errno;
+    if (close(fd) != 0 && error == 0)
+        error = errno;
+    if (error == 0 && rename(e.temp_path.c_str(), e.path.c_str()) != 0)
+        error = errno;
+    if (error != 0)
+    {
+        unlink(e.temp_path.c_str());
+        return error;
+    }
+
+    int dir_fd = open(e.dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd == -1)
+        return errno;
+    if (fsync(dir_fd) != 0)
+        error = errno;
+    close(dir_fd);
+    return error;
+}
+
+inline void fork_snapshotter::finish(int status)
+{
+    close(pipe_fd_);
+    pipe_fd_ = -1;
+    child_ = -1;
+
+    std::error_code result;
+    if (!WIFEXITED(status))
+        result = std::error_code(ECHILD, std::generic_category());
+    else if (WEXITSTATUS(status) != 0)
+        result = std::error_code(WEXITSTATUS(status), std::generic_category());
+
+    completion_handler on_complete;
+    on_complete.swap(on_complete_);
+    on_progress_ = progress_handler();
+    if (on_complete)
+        on_complete(result);
+}
+
+#endif // FORK_SNAPSHOT_H
@@ -0,0 +1,346 @@
+#ifndef INCREMENTAL_VECTOR_H
+#define INCREMENTAL_VECTOR_H
+
+#include "vector.h"
+
+/*
+Вектор с постепенной реаллокацией.
+
+Обычный vector при заполнении копирует все элементы в новый буфер за один
+push_back, и на векторе из 10M элементов этот push_back длится десятки
+миллисекунд. incremental_vector при росте выделяет новый буфер, но старые
+элементы не копирует: каждая следующая модифицирующая операция переносит
+не более migration_step элементов, как при постепенном рехешировании.
+
+Пока идет перенос, элементы [migrated_, old_size_) лежат в старом буфере,
+а все остальные -- в новом, и operator[] выбирает нужный буфер. Переносит
+только push_back, pop_back -- нет. После роста с емкости C до C * 3 / 2
+(с округлением вниз) остается C / 2 - 1 вызовов push_back до следующего
+роста, и перенос успевает закончиться, если migration_step * (C / 2 - 1)
+>= C. При migration_step = 4 это верно для всех C >= 6, а для меньших
+емкостей остаток (не больше 5 элементов) переносится при следующем росте.
+В итоге push_back работает за O(1) в худшем случае, а не амортизированно.
+
+Поскольку во время переноса элементы не лежат подряд, итераторов нет.
+data() сначала завершает перенос, то есть может работать за O(n).
+*/
+
+template <typename T, typename Alloc = heap_allocator<T> >
+struct incremental_vector
+{
+    static size_t const migration_step = 4;
+
+    incremental_vector();
+    incremental_vector(incremental_vector const&);
+    incremental_vector& operator=(incremental_vector const& other);
+
+    ~incremental_vector();
+
+    T& operator[](size_t i);
+    T const& operator[](size_t i) const;
+
+    T* data();
+
+    size_t size() const;
+
+    T& front();
+    T const& front() const;
+
+    T& back();
+    T const& back() const;
+
+    bool empty() const;
+
+    size_t capacity() const;
+
+    void clear();
+
+    void push_back(T const&);
+    void pop_back();
+
+    void swap(incremental_vector&);
+
+    bool migrating() const;
+    void finish_migration();
+
+private:
+    size_t increase_capacity() const;
+    void migrate(size_t count);
+    void release_old();
+
+private:
+    T* data_;
+    size_t size_;
+    size_t capacity_;
+
+    T* old_;
+    size_t old_capacity_;
+    size_t old_size_;
+    size_t migrated_;
+};
+
+template <typename T, typename Alloc>
+incremental_vector<T, Alloc>::incremental_vector()
+    : data_(nullptr)
+    , size_(0)
+    , capacity_(0)
+    , old_(nullptr)
+    , old_capacity_(0)
+    , old_size_(0)
+    , migrated_(0)
+{}
+
+template <typename T, typename Alloc>
+incremental_vector<T, Alloc>::incremental_vector(incremental_vector const& other)
+    : incremental_vector()
+{
+    if (other.size_ == 0)
+        return;
+
+    data_ = Alloc::allocate(other.size_);
+    capacity_ = other.size_;
+
+    try
+    {
+        for (; size_ != other.size_; ++size_)
+            new (data_ + size_) T(other[size_]);
+    }
+    catch (...)
+    {
+        destroy_all(data_, size_);
+        Alloc::deallocate(data_, capacity_);
+        throw;
+    }
+}
+
+template <typename T, typename Alloc>
+incremental_vector<T, Alloc>& incremental_vector<T, Alloc>::operator=(incremental_vector const& other)
+{
+    incremental_vector copy(other);
+    swap(copy);
+    return *this;
+}
+
+template <typename T, typename Alloc>
+incremental_vector<T, Alloc>::~incremental_vector()
+{
+    clear();
+    if (data_ != nullptr)
+        Alloc::deallocate(data_, capacity_);
+}
+
+template <typename T, typename Alloc>
+T& incremental_vector<T, Alloc>::operator[](size_t i)
+{
+    if (i >= migrated_ && i < old_size_)
+        return old_[i];
+    return data_[i];
+}
+
+template <typename T, typename Alloc>
+T const& incremental_vector<T, Alloc>::operator[](size_t i) const
+{
+    if (i >= migrated_ && i < old_size_)
+        return old_[i];
+    return data_[i];
+}
+
+template <typename T, typename Alloc>
+T* incremental_vector<T, Alloc>::data()
+{
+    finish_migration();
+    return data_;
+}
+
+template <typename T, typename Alloc>
+size_t incremental_vector<T, Alloc>::size() const
+{
+    return size_;
+}
+
+template <typename T, typename Alloc>
+T& incremental_vector<T, Alloc>::front()
+{
+    return (*this)[0];
+}
+
+template <typename T, typename Alloc>
+T const& incremental_vector<T, Alloc>::front() const
+{
+    return (*this)[0];
+}
+
+template <typename T, typename Alloc>
+T& incremental_vector<T, Alloc>::back()
+{
+    return (*this)[size_ - 1];
+}
+
+template <typename T, typename Alloc>
+T const& incremental_vector<T, Alloc>::back() const
+{
+    return (*this)[size_ - 1];
+}
+
+template <typename T, typename Alloc>
+bool incremental_vector<T, Alloc>::empty() const
+{
+    return size_ == 0;
+}
+
+template <typename T, typename Alloc>
+size_t incremental_vector<T, Alloc>::capacity() const
+{
+    return capacity_;
+}
+
+template <typename T, typename Alloc>
+void incremental_vector<T, Alloc>::clear()
+{
+    while (size_ != 0)
+        pop_back();
+}
+
+template <typename T, typename Alloc>
+void incremental_vector<T, Alloc>::push_back(T const& val)
+{
+    if (size_ != capacity_)
+    {
+        // Новый элемент конструируется до переноса: val может ссылаться на
+        // элемент старого буфера, который перенос разрушит. Если перенос
+        // бросит исключение, добавленный элемент убираем обратно, а
+        // перенесенные до этого элементы остаются на новом месте -- снаружи
+        // это не видно.
+        new (data_ + size_) T(val);
+        ++size_;
+        try
+        {
+            migrate(migration_step);
+        }
+        catch (...)
+        {
+            --size_;
+            data_[size_].~T();
+            throw;
+        }
+        return;
+    }
+
+    // Сюда попадаем только если перенос уже закончен либо migration_step
+    // выставлен слишком маленьким.
+    finish_migration();
+
+    size_t new_capacity = increase_capacity();
+    T* new_data = Alloc::allocate(new_capacity);
+
+    // val может ссылаться на элемент этого же вектора, поэтому старый
+    // буфер остается нетронутым до тех пор, пока новый элемент не создан.
+    try
+    {
+        new (new_data + size_) T(val);
+    }
+    catch (...)
+    {
+        Alloc::deallocate(new_data, new_capacity);
+        throw;
+    }
+
+    old_ = data_;
+    old_capacity_ = capacity_;
+    old_size_ = size_;
+    migrated_ = 0;
+
+    data_ = new_data;
+    capacity_ = new_capacity;
+    ++size_;
+
+    if (old_size_ == 0)
+        release_old();
+}
+
+template <typename T, typename Alloc>
+void incremental_vector<T, Alloc>::pop_back()
+{
+    assert(size_ != 0);
+
+    size_t i = size_ - 1;
+    if (i >= migrated_ && i < old_size_)
+    {
+        old_[i].~T();
+        old_size_ = i;
+        if (old_size_ == migrated_)
+            release_old();
+    }
+    else
+    {
+        data_[i].~T();
+    }
+    --size_;
+}
+
+template <typename T, typename Alloc>
+void incremental_vector<T, Alloc>::swap(incremental_vector& other)
+{
+    using std::swap;
+
+    swap(data_,         other.data_);
+    swap(size_,         other.size_);
+    swap(capacity_,     other.capacity_);
+    swap(old_,          other.old_);
+    swap(old_capacity_, other.old_capacity_);
+    swap(old_size_,     other.old_size_);
+    swap(migrated_,     other.migrated_);
+}
+
+template <typename T, typename Alloc>
+bool incremental_vector<T, Alloc>::migrating() const
+{
+    return old_ != nullptr;
+}
+
+template <typename T, typename Alloc>
+void incremental_vector<T, Alloc>::finish_migration()
+{
+    migrate(old_size_ - migrated_);
+}
+
+template <typename T, typename Alloc>
+size_t incremental_vector<T, Alloc>::increase_capacity() const
+{
+    // При capacity_ == 1 рост в 3/2 раза ничего бы не дал, а такая емкость
+    // получается, например, после копирования вектора из одного элемента.
+    if (capacity_ < 2)
+        return 4;
+    else
+        return capacity_ * 3 / 2;
+}
+
+template <typename T, typename Alloc>
+void incremental_vector<T, Alloc>::migrate(size_t count)
+{
+    if (old_ == nullptr)
+        return;
+
+    for (; count != 0 && migrated_ != old_size_; --count)
+    {
+        new (data_ + migrated_) T(old_[migrated_]);
+        old_[migrated_].~T();
+        ++migrated_;
+    }
+
+    if (migrated_ == old_size_)
+        release_old();
+}
+
+template <typename T, typename Alloc>
+void incremental_vector<T, Alloc>::release_old()
+{
+    if (old_ != nullptr)
+        Alloc::deallocate(old_, old_capacity_);
+    old_ = nullptr;
+    old_capacity_ = 0;
+    old_size_ = 0;
+    migrated_ = 0;
+}
+
+#endif // INCREMENTAL_VECTOR_H
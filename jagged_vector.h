@@ -0,0 +1,432 @@
+#ifndef JAGGED_VECTOR_H
+#define JAGGED_VECTOR_H
+
+#include "vector.h"
+#include "numa.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+/*
+Массив строк разной длины в формате CSR вместо vector<vector<T>>.
+
+Все значения лежат подряд в одном векторе values_, а offsets_ хранит
+rows() + 1 смещений: строка r -- это values_[offsets_[r], offsets_[r + 1]).
+На строку не приходится ни своего выделения памяти, ни своего заголовка,
+а проход по строкам подряд -- последовательное чтение памяти.
+
+Строки добавляются только в конец (append_row, или new_row и push_back в
+последнюю строку). Если значения приходят вперемешку, их собирает
+jagged_builder: add(row, value) в любом порядке, затем build.
+build_from_edges строит массив из списка пар (строка, значение) в
+threads потоков. Оба построения устойчивы: значения строки идут в том
+порядке, в каком были добавлены.
+
+Построение -- сортировка подсчетом с одним счетчиком на строку. Потоки
+считают длины строк по своим частям входа атомарными инкрементами общих
+счетчиков, префиксные суммы считаются параллельно по диапазонам строк, и
+потоки раскладывают элементы, атомарно сдвигая курсор строки. Памяти
+нужно O(rows), а не O(threads * rows), зато порядок элементов внутри
+строки после раскладки зависит от потоков, и каждая строка затем
+сортируется по номеру элемента. В один поток раскладка идет по порядку
+входа, и сортировка не нужна.
+*/
+
+template <typename U>
+struct row_span
+{
+    typedef U* iterator;
+
+    row_span(U* first, U* last)
+        : first_(first)
+        , last_(last)
+    {}
+
+    U& operator[](size_t i) const
+    {
+        return first_[i];
+    }
+
+    size_t size() const
+    {
+        return last_ - first_;
+    }
+
+    bool empty() const
+    {
+        return first_ == last_;
+    }
+
+    iterator begin() const
+    {
+        return first_;
+    }
+
+    iterator end() const
+    {
+        return last_;
+    }
+
+private:
+    U* first_;
+    U* last_;
+};
+
+template <typename T, typename Alloc = heap_allocator<T> >
+struct jagged_vector
+{
+    jagged_vector();
+
+    row_span<T> operator[](size_t row);
+    row_span<T const> operator[](size_t row) const;
+
+    size_t rows() const;
+    // Общее число значений во всех строках.
+    size_t size() const;
+    bool empty() const;
+
+    void append_row(T const* data, size_t count);
+    template <typename It>
+    void append_row(It first, It last);
+
+    // Начинает пустую строку; push_back дописывает в последнюю строку.
+    void new_row();
+    void push_back(T const&);
+
+    void reserve(size_t rows, size_t values);
+    void clear();
+    void swap(jagged_vector&);
+
+    vector<size_t> const& offsets() const;
+    vector<T, Alloc> const& values() const;
+
+private:
+    template <typename TT, typename AA, typename RowOf, typename ValueOf>
+    friend void jagged_build(jagged_vector<TT, AA>& out, size_t rows, size_t n,
+                             RowOf row_of, ValueOf value_of, size_t threads);
+
+private:
+    vector<size_t> offsets_;
+    vector<T, Alloc> values_;
+};
+
+template <typename T, typename Alloc>
+jagged_vector<T, Alloc>::jagged_vector()
+{
+    offsets_.push_back(0);
+}
+
+template <typename T, typename Alloc>
+row_span<T> jagged_vector<T, Alloc>::operator[](size_t row)
+{
+    return row_span<T>(values_.data() + offsets_[row], values_.data() + offsets_[row + 1]);
+}
+
+template <typename T, typename Alloc>
+row_span<T const> jagged_vector<T, Alloc>::operator[](size_t row) const
+{
+    return row_span<T const>(values_.data() + offsets_[row], values_.data() + offsets_[row + 1]);
+}
+
+template <typename T, typename Alloc>
+size_t jagged_vector<T, Alloc>::rows() const
+{
+    return offsets_.size() - 1;
+}
+
+template <typename T, typename Alloc>
+size_t jagged_vector<T, Alloc>::size() const
+{
+    return values_.size();
+}
+
+template <typename T, typename Alloc>
+bool jagged_vector<T, Alloc>::empty() const
+{
+    return rows() == 0;
+}
+
+template <typename T, typename Alloc>
+void jagged_vector<T, Alloc>::append_row(T const* data, size_t count)
+{
+    append_row(data, data + count);
+}
+
+// Если добавление бросит исключение, массив не меняется.
+template <typename T, typename Alloc>
+template <typename It>
+void jagged_vector<T, Alloc>::append_row(It first, It last)
+{
+    size_t old_size = values_.size();
+    try
+    {
+        for (; first != last; ++first)
+            values_.push_back(*first);
+        offsets_.push_back(values_.size());
+    }
+    catch (...)
+    {
+        while (values_.size() != old_size)
+            values_.pop_back();
+        throw;
+    }
+}
+
+template <typename T, typename Alloc>
+void jagged_vector<T, Alloc>::new_row()
+{
+    offsets_.push_back(values_.size());
+}
+
+template <typename T, typename Alloc>
+void jagged_vector<T, Alloc>::push_back(T const& val)
+{
+    assert(rows() != 0);
+
+    values_.push_back(val);
+    ++offsets_.back();
+}
+
+template <typename T, typename Alloc>
+void jagged_vector<T, Alloc>::reserve(size_t rows, size_t values)
+{
+    offsets_.reserve(rows + 1);
+    values_.reserve(values);
+}
+
+template <typename T, typename Alloc>
+void jagged_vector<T, Alloc>::clear()
+{
+    values_.clear();
+    offsets_.clear();
+    offsets_.push_back(0);
+}
+
+template <typename T, typename Alloc>
+void jagged_vector<T, Alloc>::swap(jagged_vector& other)
+{
+    offsets_.swap(other.offsets_);
+    values_.swap(other.values_);
+}
+
+template <typename T, typename Alloc>
+vector<size_t> const& jagged_vector<T, Alloc>::offsets() const
+{
+    return offsets_;
+}
+
+template <typename T, typename Alloc>
+vector<T, Alloc> const& jagged_vector<T, Alloc>::values() const
+{
+    return values_;
+}
+
+/*
+Строит out из n элементов: row_of(i) -- строка i-го элемента, value_of(i)
+-- его значение. Сначала вычисляется перестановка order (какой элемент
+встает на какое место), затем значения копируются в порядке order: для
+trivially copyable T параллельно, иначе по одному, чтобы при исключении
+разрушить уже созданный префикс. При исключении out не меняется.
+*/
+template <typename T, typename Alloc, typename RowOf, typename ValueOf>
+void jagged_build(jagged_vector<T, Alloc>& out, size_t rows, size_t n,
+                  RowOf row_of, ValueOf value_of, size_t threads)
+{
+    threads = default_thread_count(threads);
+    if (threads > n)
+        threads = n != 0 ? n : 1;
+
+    // counts[r] -- сколько элементов в строке r, после префиксных сумм --
+    // куда положить следующий элемент строки r.
+    vector<size_t> counts;
+    counts.append_construct(rows, [&](size_t* dst, size_t) {
+        run_parallel(threads, [&](size_t t) {
+            chunk_range r = parallel_chunk(rows, threads, t);
+            if (r.first != r.last)
+                memset(dst + r.first, 0, (r.last - r.first) * sizeof(size_t));
+        });
+    });
+
+    vector<char> bad_row;
+    for (size_t t = 0; t != threads; ++t)
+        bad_row.push_back(0);
+
+    run_parallel(threads, [&](size_t t) {
+        chunk_range r = parallel_chunk(n, threads, t);
+        size_t* counters = counts.data();
+        for (size_t i = r.first; i != r.last; ++i)
+        {
+            size_t row = row_of(i);
+            if (row >= rows)
+            {
+                bad_row[t] = 1;
+                return;
+            }
+            __atomic_fetch_add(counters + row, 1, __ATOMIC_RELAXED);
+        }
+    });
+
+    for (size_t t = 0; t != threads; ++t)
+        if (bad_row[t])
+            throw std::out_of_range("jagged_build: row index is out of range");
+
+    // Каждый поток суммирует свой диапазон строк, по этим суммам
+    // вычисляется, с какой позиции диапазон начинается, и потоки
+    // дописывают префиксные суммы внутри своих диапазонов.
+    vector<size_t> starts;
+    for (size_t t = 0; t != threads; ++t)
+        starts.push_back(0);
+
+    run_parallel(threads, [&](size_t t) {
+        chunk_range r = parallel_chunk(rows, threads, t);
+        size_t sum = 0;
+        for (size_t row = r.first; row != r.last; ++row)
+            sum += counts[row];
+        starts[t] = sum;
+    });
+
+    size_t position = 0;
+    for (size_t t = 0; t != threads; ++t)
+    {
+        size_t sum = starts[t];
+        starts[t] = position;
+        position += sum;
+    }
+
+    jagged_vector<T, Alloc> result;
+    result.offsets_.append_construct(rows, [&](size_t* dst, size_t) {
+        run_parallel(threads, [&](size_t t) {
+            chunk_range r = parallel_chunk(rows, threads, t);
+            size_t position = starts[t];
+            for (size_t row = r.first; row != r.last; ++row)
+            {
+                size_t count = counts[row];
+                counts[row] = position;
+                position += count;
+                dst[row] = position;
+            }
+        });
+    });
+
+    vector<size_t> order;
+    order.append_construct(n, [&](size_t* dst, size_t) {
+        run_parallel(threads, [&](size_t t) {
+            chunk_range r = parallel_chunk(n, threads, t);
+            size_t* cursors = counts.data();
+            for (size_t i = r.first; i != r.last; ++i)
+                dst[__atomic_fetch_add(cursors + row_of(i), 1, __ATOMIC_RELAXED)] = i;
+        });
+
+        if (threads == 1)
+            return;
+
+        size_t const* offsets = result.offsets_.data();
+        run_parallel(threads, [&](size_t t) {
+            chunk_range r = parallel_chunk(rows, threads, t);
+            for (size_t row = r.first; row != r.last; ++row)
+                std::sort(dst + offsets[row], dst + offsets[row + 1]);
+        });
+    });
+
+    result.values_.append_construct(n, [&](T* dst, size_t) {
+        if (std::is_trivially_copyable<T>::value)
+        {
+            run_parallel(threads, [&](size_t t) {
+                chunk_range r = parallel_chunk(n, threads, t);
+                for (size_t k = r.first; k != r.last; ++k)
+                    new (dst + k) T(value_of(order[k]));
+            });
+            return;
+        }
+
+        size_t k = 0;
+        try
+        {
+            for (; k != n; ++k)
+                new (dst + k) T(value_of(order[k]));
+        }
+        catch (...)
+        {
+            destroy_all(dst, k);
+            throw;
+        }
+    });
+
+    out.swap(result);
+}
+
+template <typename T, typename Alloc = heap_allocator<T> >
+struct jagged_builder
+{
+    void add(size_t row, T const& val);
+
+    size_t size() const;
+    void clear();
+
+    // Строк будет не меньше rows и не меньше, чем нужно добавленным
+    // значениям. Добавленное остается в builder.
+    void build(jagged_vector<T, Alloc>& out, size_t rows = 0) const;
+
+private:
+    vector<size_t> rows_;
+    vector<T> values_;
+};
+
+template <typename T, typename Alloc>
+void jagged_builder<T, Alloc>::add(size_t row, T const& val)
+{
+    values_.push_back(val);
+    try
+    {
+        rows_.push_back(row);
+    }
+    catch (...)
+    {
+        values_.pop_back();
+        throw;
+    }
+}
+
+template <typename T, typename Alloc>
+size_t jagged_builder<T, Alloc>::size() const
+{
+    return values_.size();
+}
+
+template <typename T, typename Alloc>
+void jagged_builder<T, Alloc>::clear()
+{
+    rows_.clear();
+    values_.clear();
+}
+
+template <typename T, typename Alloc>
+void jagged_builder<T, Alloc>::build(jagged_vector<T, Alloc>& out, size_t rows) const
+{
+    for (size_t i = 0; i != rows_.size(); ++i)
+        if (rows_[i] >= rows)
+            rows = rows_[i] + 1;
+
+    jagged_build(out, rows, values_.size(),
+                 [this](size_t i) { return rows_[i]; },
+                 [this](size_t i) -> T const& { return values_[i]; },
+                 1);
+}
+
+// Строит массив смежности: строка edges[i].first получает edges[i].second.
+template <typename T, typename Alloc, typename Index, typename EdgeAlloc>
+void build_from_edges(jagged_vector<T, Alloc>& out, size_t rows,
+                      vector<std::pair<Index, T>, EdgeAlloc> const& edges,
+                      size_t threads = 0)
+{
+    jagged_build(out, rows, edges.size(),
+                 [&edges](size_t i) { return static_cast<size_t>(edges[i].first); },
+                 [&edges](size_t i) -> T const& { return edges[i].second; },
+                 threads);
+}
+
+#endif // JAGGED_VECTOR_H
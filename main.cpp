@@ -1,7 +1,37 @@
 #include "vector.h"
+#include "numa.h"
+#include "prefault.h"
+#include "incremental_vector.h"
+#include "deferred_reclaimer.h"
+#include "pool_allocator.h"
+#include "padded_vector.h"
+#include "rcu_vector.h"
+#include "shm_vector.h"
+#include "external_vector.h"
+#include "vector_io.h"
+#include "external_sort.h"
+#include "async_loader.h"
+#include "npy.h"
+#include "arrow.h"
+#include "tracked_vector.h"
+#include "fork_snapshot.h"
+#include "transactional_vector.h"
+#include "compact_vector.h"
+#include "jagged_vector.h"
+#include "string_table.h"
+#include "slot_map.h"
+#include "sparse_set.h"
+#include "tiered_vector.h"
+#include "rope.h"
 #include "gtest/gtest.h"
 
+#include <cmath>
+#include <string>
+
+#include <sys/wait.h>
+
 template struct vector<int>;
+template struct vector<int, heap_allocator<int>, uint32_t>;
 
 template <typename T>
 T const& as_const(T& obj)
@@ -283,6 +313,80 @@ TEST(correctness, assignment_operator)
     counted<size_t>::expect_no_instances();
 }
 
+TEST(correctness, assignment_reuses_buffer)
+{
+    {
+        vector<counted<size_t> > a;
+        for (size_t i = 0; i != 5; ++i)
+            a.push_back(i);
+
+        vector<counted<size_t> > b;
+        b.reserve(10);
+        b.push_back(42);
+        counted<size_t>* old_data = b.data();
+
+        b = a;
+        EXPECT_EQ(old_data, b.data());
+        EXPECT_EQ(5, b.size());
+        for (size_t i = 0; i != 5; ++i)
+            EXPECT_EQ(i, b[i]);
+
+        a.pop_back();
+        a.pop_back();
+        b = a;
+        EXPECT_EQ(old_data, b.data());
+        EXPECT_EQ(3, b.size());
+        for (size_t i = 0; i != 3; ++i)
+            EXPECT_EQ(i, b[i]);
+    }
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(correctness, assignment_throw)
+{
+    {
+        vector<counted<size_t> > a;
+        for (size_t i = 0; i != 5; ++i)
+            a.push_back(i);
+
+        vector<counted<size_t> > b;
+        b.reserve(10);
+        b.push_back(42);
+        b.push_back(43);
+
+        counted<size_t>::set_throw_countdown(4);
+        EXPECT_THROW(b = a, std::runtime_error);
+        EXPECT_EQ(2, b.size());
+    }
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(correctness, assign_strong)
+{
+    {
+        vector<counted<size_t> > a;
+        for (size_t i = 0; i != 5; ++i)
+            a.push_back(i);
+
+        vector<counted<size_t> > b;
+        b.reserve(10);
+        b.push_back(42);
+        b.push_back(43);
+
+        counted<size_t>::set_throw_countdown(4);
+        EXPECT_THROW(b.assign_strong(a), std::runtime_error);
+        EXPECT_EQ(2, b.size());
+        EXPECT_EQ(42, b[0]);
+        EXPECT_EQ(43, b[1]);
+
+        b.assign_strong(a);
+        EXPECT_EQ(5, b.size());
+        for (size_t i = 0; i != 5; ++i)
+            EXPECT_EQ(i, b[i]);
+    }
+    counted<size_t>::expect_no_instances();
+}
+
 TEST(correctness, self_assignment)
 {
     {
@@ -372,6 +476,43 @@ TEST(correctness, insert_end)
     counted<size_t>::expect_no_instances();
 }
 
+TEST(correctness, max_size)
+{
+    vector<int> a;
+    a.push_back(1);
+    EXPECT_LE(vector<int>::max_size(), size_t(PTRDIFF_MAX) / sizeof(int));
+    EXPECT_THROW(a.reserve(vector<int>::max_size() + 1), std::length_error);
+    EXPECT_THROW(a.reserve(size_t(1) << 62 | 1), std::length_error);
+    EXPECT_THROW(a.append_construct(vector<int>::max_size(), [](int*, size_t) {}), std::length_error);
+    EXPECT_THROW(a.append_construct(size_t(-1), [](int*, size_t) {}), std::length_error);
+    ASSERT_EQ(1, a.size());
+    EXPECT_EQ(1, a[0]);
+
+    // Аллокатор сам проверяет, что размер в байтах не переполняется.
+    EXPECT_THROW((heap_allocator<int>::allocate(size_t(-1) / 2)), std::bad_array_new_length);
+    EXPECT_THROW((aligned_allocator<int, 64>::allocate(size_t(-1) / 4)), std::bad_array_new_length);
+}
+
+TEST(correctness, insert_end_of_empty_with_capacity)
+{
+    {
+        vector<counted<size_t> > a;
+        a.reserve(4);
+
+        vector<counted<size_t> >::iterator i = a.insert(a.end(), 8);
+        ASSERT_EQ(1, a.size());
+        EXPECT_EQ(a.begin(), i);
+        EXPECT_EQ(8, a[0]);
+        EXPECT_EQ(1, counted<size_t>::instances());
+
+        i = a.insert(a.end(), 9);
+        EXPECT_EQ(a.begin() + 1, i);
+        EXPECT_EQ(9, a.back());
+    }
+
+    counted<size_t>::expect_no_instances();
+}
+
 TEST(correctness, erase)
 {
     {
@@ -393,6 +534,21 @@ TEST(correctness, erase)
     counted<size_t>::expect_no_instances();
 }
 
+TEST(correctness, push_back_after_single_element_copy)
+{
+    {
+        vector<counted<size_t> > a;
+        a.push_back(1);
+
+        vector<counted<size_t> > b = a;
+        EXPECT_EQ(1, b.capacity());
+        b.push_back(2);
+        EXPECT_EQ(2, b.size());
+        EXPECT_EQ(2, b[1]);
+    }
+    counted<size_t>::expect_no_instances();
+}
+
 TEST(correctness, reallocation_throw)
 {
     {
@@ -427,3 +583,2620 @@ TEST(correctness, empty_storage_shrink_to_fit)
     a.shrink_to_fit();
     EXPECT_EQ(nullptr, a.data());
 }
+
+TEST(correctness, append_construct)
+{
+    {
+        vector<counted<size_t> > a;
+        a.push_back(1);
+        a.append_construct(3, [](counted<size_t>* dst, size_t count) {
+            for (size_t i = 0; i != count; ++i)
+                new (dst + i) counted<size_t>(i + 2);
+        });
+
+        EXPECT_EQ(4, a.size());
+        for (size_t i = 0; i != 4; ++i)
+            EXPECT_EQ(i + 1, a[i]);
+    }
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(correctness, append_construct_grows_geometrically)
+{
+    vector<int> a;
+    size_t reallocations = 0;
+    for (int i = 0; i != 10000; ++i)
+    {
+        size_t capacity = a.capacity();
+        a.append_construct(1, [i](int* dst, size_t) {
+            *dst = i;
+        });
+        if (a.capacity() != capacity)
+            ++reallocations;
+    }
+
+    EXPECT_LE(reallocations, 25);
+    EXPECT_EQ(9999, a.back());
+
+    // Большое добавление выделяет ровно столько, сколько нужно.
+    vector<int> b;
+    b.append_construct(1000, [](int* dst, size_t count) {
+        memset(dst, 0, count * sizeof(int));
+    });
+    EXPECT_EQ(1000, b.capacity());
+}
+
+TEST(numa, allocator)
+{
+    {
+        vector<counted<size_t>, numa_allocator<counted<size_t>, numa_mode::interleave> > a;
+        for (size_t i = 0; i != 1000; ++i)
+            a.push_back(i);
+
+        vector<counted<size_t>, numa_allocator<counted<size_t>, numa_mode::interleave> > b = a;
+        for (size_t i = 0; i != 1000; ++i)
+            EXPECT_EQ(i, b[i]);
+    }
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(numa, parallel_chunk)
+{
+    size_t next = 0;
+    for (size_t i = 0; i != 7; ++i)
+    {
+        chunk_range r = parallel_chunk(100, 7, i);
+        EXPECT_EQ(next, r.first);
+        EXPECT_GE(r.last - r.first, 14);
+        EXPECT_LE(r.last - r.first, 15);
+        next = r.last;
+    }
+    EXPECT_EQ(100, next);
+}
+
+TEST(numa, parallel_resize)
+{
+    vector<int, numa_allocator<int, numa_mode::local> > a;
+    a.push_back(7);
+    parallel_resize(a, 100000, 42, 4);
+
+    EXPECT_EQ(100000, a.size());
+    EXPECT_EQ(7, a[0]);
+    for (size_t i = 1; i != a.size(); ++i)
+        ASSERT_EQ(42, a[i]);
+
+    parallel_resize(a, 10, 0, 4);
+    EXPECT_EQ(10, a.size());
+}
+
+TEST(numa, parallel_resize_throw)
+{
+    {
+        vector<counted<size_t> > a;
+        a.push_back(1);
+        counted<size_t> val(5);
+
+        counted<size_t>::set_throw_countdown(3);
+        EXPECT_THROW(parallel_resize(a, 10, val, 1), std::runtime_error);
+        EXPECT_EQ(1, a.size());
+    }
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(numa, run_pinned_pins_threads)
+{
+    cpu_set_t before;
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof before, &before));
+
+    size_t const threads = 4;
+    vector<int> cpus = worker_cpus(threads);
+    ASSERT_EQ(threads, cpus.size());
+    for (size_t i = 0; i != threads; ++i)
+        EXPECT_TRUE(CPU_ISSET(cpus[i], &before));
+
+    int seen[threads];
+    run_pinned(threads, [&](size_t i) {
+        seen[i] = sched_getcpu();
+    });
+    for (size_t i = 0; i != threads; ++i)
+        EXPECT_EQ(cpus[i], seen[i]);
+
+    // Маска вызывающего потока восстановлена.
+    cpu_set_t after;
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof after, &after));
+    EXPECT_TRUE(CPU_EQUAL(&before, &after));
+}
+
+TEST(numa, run_parallel_does_not_pin)
+{
+    cpu_set_t before;
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof before, &before));
+
+    bool same[4];
+    run_parallel(4, [&](size_t i) {
+        cpu_set_t mask;
+        same[i] = sched_getaffinity(0, sizeof mask, &mask) == 0 && CPU_EQUAL(&before, &mask);
+    });
+    for (size_t i = 0; i != 4; ++i)
+        EXPECT_TRUE(same[i]);
+
+    // Один поток не закрепляется и в run_pinned.
+    run_pinned(1, [&](size_t i) {
+        cpu_set_t mask;
+        same[i] = sched_getaffinity(0, sizeof mask, &mask) == 0 && CPU_EQUAL(&before, &mask);
+    });
+    EXPECT_TRUE(same[0]);
+}
+
+TEST(numa, thread_policy)
+{
+    // Политика принадлежит потоку, поэтому меняем ее не в потоке тестов.
+    std::thread worker([] {
+        if (!numa_set_thread_policy(numa_policy::local()))
+            return; // ядро без NUMA
+
+        EXPECT_TRUE(numa_set_thread_policy(numa_policy::interleave()));
+        EXPECT_TRUE(numa_set_thread_policy(numa_policy::bind(0)));
+        EXPECT_FALSE(numa_set_thread_policy(numa_policy::bind(1000)));
+
+        // Если ядро сообщает политику, она должна совпадать с заданной.
+        int mode = -1;
+        syscall(SYS_get_mempolicy, &mode, nullptr, 0ul, nullptr, 0ul);
+        if (mode != -1)
+        {
+            EXPECT_EQ(numa_detail::mpol_bind, mode);
+        }
+
+        vector<int> a;
+        for (int i = 0; i != 100000; ++i)
+            a.push_back(i);
+        EXPECT_EQ(99999, a.back());
+
+        EXPECT_TRUE(numa_set_thread_policy(numa_policy::local()));
+    });
+    worker.join();
+}
+
+TEST(numa, first_touch_reserve)
+{
+    vector<int> a;
+    a.push_back(1);
+    a.push_back(2);
+    first_touch_reserve(a, 100000, 4);
+
+    EXPECT_GE(a.capacity(), 100000);
+    EXPECT_EQ(2, a.size());
+    EXPECT_EQ(1, a[0]);
+    EXPECT_EQ(2, a[1]);
+}
+
+namespace
+{
+    size_t resident_pages(void* addr, size_t bytes)
+    {
+        size_t page = page_size();
+        char* first = reinterpret_cast<char*>(
+            (reinterpret_cast<uintptr_t>(addr) + page - 1) / page * page);
+        char* last = reinterpret_cast<char*>(
+            (reinterpret_cast<uintptr_t>(addr) + bytes) / page * page);
+        if (first >= last)
+            return 0;
+
+        size_t pages = (last - first) / page;
+        std::unique_ptr<unsigned char[]> status(new unsigned char[pages]);
+        if (mincore(first, last - first, status.get()) != 0)
+            return 0;
+
+        size_t result = 0;
+        for (size_t i = 0; i != pages; ++i)
+            result += status[i] & 1;
+        return result;
+    }
+}
+
+TEST(prefault, reserve_populated)
+{
+    vector<int, numa_allocator<int> > a;
+    a.push_back(1);
+    a.push_back(2);
+
+    size_t const n = 1 << 20;
+    EXPECT_TRUE(reserve_populated(a, n));
+
+    EXPECT_GE(a.capacity(), n);
+    EXPECT_EQ(2, a.size());
+    EXPECT_EQ(1, a[0]);
+    EXPECT_EQ(2, a[1]);
+
+    size_t bytes = a.capacity() * sizeof(int);
+    EXPECT_EQ(bytes / page_size(), resident_pages(a.data(), bytes));
+}
+
+TEST(prefault, populate_unaligned)
+{
+    vector<char> a;
+    a.reserve(3 * page_size() + 17);
+    EXPECT_TRUE(populate_memory(a.data() + 5, 3 * page_size() + 1));
+}
+
+TEST(prefault, populated_allocator)
+{
+    vector<int, populated_allocator<int> > a;
+    a.reserve(1 << 20);
+
+    size_t bytes = a.capacity() * sizeof(int);
+    EXPECT_EQ(bytes / page_size(), resident_pages(a.data(), bytes));
+
+    for (int i = 0; i != 1000; ++i)
+        a.push_back(i);
+    for (int i = 0; i != 1000; ++i)
+        EXPECT_EQ(i, a[i]);
+}
+
+namespace
+{
+    // VmLck из /proc/self/status в килобайтах, -1 если его нет.
+    long locked_kb()
+    {
+        FILE* f = fopen("/proc/self/status", "r");
+        if (f == nullptr)
+            return -1;
+
+        long result = -1;
+        char line[256];
+        while (fgets(line, sizeof line, f) != nullptr)
+            if (sscanf(line, "VmLck: %ld", &result) == 1)
+                break;
+        fclose(f);
+        return result;
+    }
+}
+
+TEST(prefault, lock_is_released)
+{
+    long before = locked_kb();
+    if (before < 0)
+        return;
+
+    // Под AddressSanitizer mlock ничего не делает, и VmLck не меняется.
+    size_t probe_bytes = 16 * page_size();
+    void* probe = map_pages(probe_bytes);
+    bool counted_locks = mlock(probe, probe_bytes) == 0 && locked_kb() > before;
+    munlock(probe, probe_bytes);
+    unmap_pages(probe, probe_bytes);
+    if (!counted_locks)
+        return;
+
+    {
+        vector<int> a;
+        if (!reserve_populated(a, 64 * 1024, prefault_lock))
+            return; // mlock запрещен
+        EXPECT_GE(locked_kb(), before + 200);
+
+        // Реаллокация открепляет старый буфер.
+        ASSERT_TRUE(reserve_populated(a, 128 * 1024, prefault_lock));
+        EXPECT_LE(locked_kb(), before + 520);
+
+        unlock_populated(a);
+        EXPECT_EQ(before, locked_kb());
+    }
+
+    {
+        // У полного вектора reserve(capacity()) тоже перевыделяет буфер.
+        // Буфер небольшой, чтобы malloc держал его в куче и free не
+        // снимал закрепление через munmap.
+        vector<int> a;
+        ASSERT_TRUE(reserve_populated(a, 8 * 1024, prefault_lock));
+        while (a.size() != a.capacity())
+            a.push_back(0);
+        ASSERT_TRUE(reserve_populated(a, a.capacity(), prefault_lock));
+
+        unlock_populated(a);
+        EXPECT_EQ(before, locked_kb());
+    }
+
+    {
+        vector<int, populated_allocator<int, prefault_lock> > a;
+        a.reserve(64 * 1024);
+        EXPECT_GE(locked_kb(), before + 256);
+        a.reserve(128 * 1024);
+        EXPECT_EQ(before + 512, locked_kb());
+    }
+    EXPECT_EQ(before, locked_kb());
+}
+
+TEST(incremental_vector, push_back)
+{
+    {
+        incremental_vector<counted<size_t> > a;
+        bool seen_migration = false;
+        for (size_t i = 0; i != 1000; ++i)
+        {
+            a.push_back(i);
+            seen_migration |= a.migrating();
+            for (size_t j = 0; j <= i; j += 37)
+                ASSERT_EQ(j, a[j]);
+        }
+
+        EXPECT_TRUE(seen_migration);
+        EXPECT_EQ(1000, a.size());
+        EXPECT_EQ(0, a.front());
+        EXPECT_EQ(999, a.back());
+        for (size_t i = 0; i != 1000; ++i)
+            EXPECT_EQ(i, a[i]);
+    }
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(incremental_vector, bounded_migration)
+{
+    incremental_vector<size_t> a;
+    for (size_t i = 0; i != 100000; ++i)
+    {
+        if (a.size() == a.capacity())
+        {
+            EXPECT_FALSE(a.migrating());
+        }
+        a.push_back(i);
+    }
+    a.finish_migration();
+    EXPECT_FALSE(a.migrating());
+
+    size_t const* data = a.data();
+    for (size_t i = 0; i != a.size(); ++i)
+        ASSERT_EQ(i, data[i]);
+}
+
+TEST(incremental_vector, push_back_from_self)
+{
+    {
+        incremental_vector<counted<size_t> > a;
+        a.push_back(42);
+        for (size_t i = 0; i != 100; ++i)
+            a.push_back(a[i / 2]);
+
+        for (size_t i = 0; i != a.size(); ++i)
+            EXPECT_EQ(42, a[i]);
+    }
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(incremental_vector, pop_back_during_migration)
+{
+    {
+        incremental_vector<counted<size_t> > a;
+        for (size_t i = 0; i != 7; ++i)
+            a.push_back(i);
+        EXPECT_TRUE(a.migrating());
+
+        incremental_vector<counted<size_t> > b = a;
+        for (size_t i = 0; i != 7; ++i)
+            EXPECT_EQ(i, b[i]);
+
+        while (!a.empty())
+        {
+            EXPECT_EQ(a.size() - 1, a.back());
+            a.pop_back();
+        }
+        EXPECT_FALSE(a.migrating());
+    }
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(incremental_vector, push_back_after_single_element_copy)
+{
+    {
+        incremental_vector<counted<size_t> > a;
+        a.push_back(1);
+
+        incremental_vector<counted<size_t> > b = a;
+        EXPECT_EQ(1, b.capacity());
+        for (size_t i = 2; i != 10; ++i)
+            b.push_back(i);
+        ASSERT_EQ(9, b.size());
+        for (size_t i = 0; i != 9; ++i)
+            EXPECT_EQ(i + 1, b[i]);
+    }
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(incremental_vector, migration_throw)
+{
+    {
+        incremental_vector<counted<size_t> > a;
+        for (size_t i = 0; i != 7; ++i)
+            a.push_back(i);
+        EXPECT_TRUE(a.migrating());
+
+        counted<size_t>::set_throw_countdown(3);
+        EXPECT_THROW(a.push_back(7), std::runtime_error);
+        EXPECT_EQ(7, a.size());
+        for (size_t i = 0; i != 7; ++i)
+            EXPECT_EQ(i, a[i]);
+    }
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(deferred_reclaimer, retire)
+{
+    {
+        deferred_reclaimer reclaimer(1024);
+
+        vector<counted<size_t> > a;
+        for (size_t i = 0; i != 1000; ++i)
+            a.push_back(i);
+
+        reclaimer.retire(a);
+        EXPECT_TRUE(a.empty());
+        EXPECT_EQ(nullptr, a.data());
+
+        reclaimer.flush();
+        EXPECT_EQ(0, reclaimer.pending());
+        EXPECT_EQ(1, reclaimer.reclaimed_deferred());
+        counted<size_t>::expect_no_instances();
+
+        a.push_back(5);
+        EXPECT_EQ(5, a[0]);
+    }
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(deferred_reclaimer, small_vectors_inline)
+{
+    deferred_reclaimer reclaimer(1024);
+
+    vector<counted<size_t> > a;
+    a.push_back(1);
+    reclaimer.retire(a);
+
+    counted<size_t>::expect_no_instances();
+    EXPECT_EQ(1, reclaimer.reclaimed_inline());
+    EXPECT_EQ(0, reclaimer.reclaimed_deferred());
+}
+
+TEST(deferred_reclaimer, bounded_queue)
+{
+    deferred_reclaimer reclaimer(0, 0);
+
+    vector<int> a;
+    a.push_back(1);
+    reclaimer.retire(a);
+    EXPECT_EQ(1, reclaimer.reclaimed_inline());
+}
+
+// Деструктор ждет, пока тест не откроет gate, и так держит фоновый поток
+// занятым.
+struct gated_destructor
+{
+    ~gated_destructor()
+    {
+        entered = true;
+        while (!gate)
+            std::this_thread::yield();
+    }
+
+    static std::atomic<bool> entered;
+    static std::atomic<bool> gate;
+};
+
+std::atomic<bool> gated_destructor::entered(false);
+std::atomic<bool> gated_destructor::gate(false);
+
+TEST(deferred_reclaimer, full_queue_reclaims_inline)
+{
+    deferred_reclaimer reclaimer(0, 2);
+
+    vector<gated_destructor> blocker;
+    gated_destructor::gate = true;
+    blocker.push_back(gated_destructor());
+    gated_destructor::gate = false;
+    gated_destructor::entered = false;
+    reclaimer.retire(blocker);
+    while (!gated_destructor::entered)
+        std::this_thread::yield();
+
+    // Фоновый поток занят, очередь пуста: два вектора в нее помещаются,
+    // третий разрушается на месте.
+    for (size_t i = 0; i != 3; ++i)
+    {
+        vector<int> a;
+        a.push_back(1);
+        reclaimer.retire(a);
+    }
+    EXPECT_EQ(1, reclaimer.reclaimed_inline());
+    EXPECT_EQ(3, reclaimer.pending());
+
+    gated_destructor::gate = true;
+    reclaimer.flush();
+    EXPECT_EQ(0, reclaimer.pending());
+    EXPECT_EQ(3, reclaimer.reclaimed_deferred());
+}
+
+TEST(deferred_reclaimer, destructor_drains_queue)
+{
+    // Утечки, если деструктор не дочистит очередь, найдет ASan.
+    deferred_reclaimer reclaimer(0, 4);
+    for (size_t round = 0; round != 10; ++round)
+    {
+        vector<int> a;
+        for (int i = 0; i != 1000; ++i)
+            a.push_back(i);
+        reclaimer.retire(a);
+    }
+}
+
+TEST(pool_allocator, vector)
+{
+    {
+        vector<counted<size_t>, pool_allocator<counted<size_t> > > a;
+        for (size_t i = 0; i != 1000; ++i)
+            a.push_back(i);
+
+        vector<counted<size_t>, pool_allocator<counted<size_t> > > b = a;
+        for (size_t i = 0; i != 1000; ++i)
+            EXPECT_EQ(i, b[i]);
+    }
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(pool_allocator, reuse)
+{
+    void* p = buffer_pool::allocate(100);
+    buffer_pool::deallocate(p, 100);
+
+    pool_stats before = buffer_pool::stats();
+    void* q = buffer_pool::allocate(120);
+    pool_stats after = buffer_pool::stats();
+
+    EXPECT_EQ(p, q);
+    EXPECT_EQ(before.cache_hits + 1, after.cache_hits);
+    EXPECT_EQ(before.system_allocations, after.system_allocations);
+    buffer_pool::deallocate(q, 120);
+}
+
+TEST(pool_allocator, large_blocks)
+{
+    vector<char, pool_allocator<char> > a;
+    a.reserve(buffer_pool::max_class_bytes * 2);
+    a.push_back(1);
+    EXPECT_EQ(1, a[0]);
+}
+
+TEST(pool_allocator, threads)
+{
+    buffer_pool::release_thread_cache();
+    pool_stats before = buffer_pool::stats();
+
+    size_t const threads = 4;
+    run_parallel(threads, [](size_t i) {
+        for (size_t round = 0; round != 100; ++round)
+        {
+            vector<size_t, pool_allocator<size_t> > a;
+            for (size_t j = 0; j != 100 + i; ++j)
+                a.push_back(j);
+        }
+        if (i != 0)
+            return;
+        buffer_pool::release_thread_cache();
+    });
+
+    pool_stats after = buffer_pool::stats();
+    EXPECT_EQ(after.allocations - before.allocations,
+              after.deallocations - before.deallocations);
+    EXPECT_GT(after.cache_hits, before.cache_hits);
+}
+
+namespace
+{
+    struct alignas(64) cache_line
+    {
+        size_t value;
+    };
+
+    bool is_aligned(void const* p, size_t alignment)
+    {
+        return reinterpret_cast<uintptr_t>(p) % alignment == 0;
+    }
+}
+
+TEST(aligned_vector, over_aligned_type)
+{
+    vector<cache_line> a;
+    for (size_t i = 0; i != 100; ++i)
+    {
+        cache_line c = {i};
+        a.push_back(c);
+        ASSERT_TRUE(is_aligned(a.data(), 64));
+    }
+
+    vector<cache_line> b = a;
+    EXPECT_TRUE(is_aligned(b.data(), 64));
+    for (size_t i = 0; i != 100; ++i)
+        EXPECT_EQ(i, b[i].value);
+
+    b.shrink_to_fit();
+    EXPECT_TRUE(is_aligned(b.data(), 64));
+}
+
+TEST(aligned_vector, cache_line)
+{
+    aligned_vector<float> a;
+    for (size_t i = 0; i != 1000; ++i)
+    {
+        a.push_back(i);
+        ASSERT_TRUE(is_aligned(a.data(), 64));
+    }
+}
+
+TEST(aligned_vector, page)
+{
+    {
+        aligned_vector<counted<size_t>, 4096> a;
+        for (size_t i = 0; i != 1000; ++i)
+        {
+            a.push_back(i);
+            ASSERT_TRUE(is_aligned(a.data(), 4096));
+        }
+    }
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(padded_vector, stride)
+{
+    padded_vector<int> a(10, 5);
+    EXPECT_EQ(10, a.size());
+    for (size_t i = 0; i != a.size(); ++i)
+    {
+        EXPECT_EQ(5, a[i]);
+        EXPECT_TRUE(is_aligned(&a[i], cache_line_size));
+    }
+
+    char const* first = reinterpret_cast<char const*>(&a[0]);
+    char const* second = reinterpret_cast<char const*>(&a[1]);
+    EXPECT_EQ(cache_line_size, second - first);
+
+    padded_vector<int, 128> b(2);
+    EXPECT_EQ(128, reinterpret_cast<char*>(&b[1]) - reinterpret_cast<char*>(&b[0]));
+}
+
+TEST(padded_vector, push_back_iterate)
+{
+    {
+        padded_vector<counted<size_t> > a;
+        for (size_t i = 0; i != 100; ++i)
+            a.push_back(i);
+
+        size_t expected = 0;
+        for (padded_vector<counted<size_t> >::iterator i = a.begin(); i != a.end(); ++i)
+            EXPECT_EQ(expected++, *i);
+        EXPECT_EQ(100, expected);
+
+        a[3] = 42;
+        EXPECT_EQ(42, as_const(a)[3]);
+
+        a.pop_back();
+        EXPECT_EQ(99, a.size());
+    }
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(padded_vector, snapshot)
+{
+    padded_vector<size_t> a(4);
+    for (size_t i = 0; i != a.size(); ++i)
+        a[i] = i * 10;
+
+    vector<size_t> packed;
+    packed.push_back(7);
+    a.snapshot(packed);
+
+    EXPECT_EQ(4, packed.size());
+    for (size_t i = 0; i != packed.size(); ++i)
+        EXPECT_EQ(i * 10, packed[i]);
+}
+
+TEST(rcu_vector, read_update)
+{
+    {
+        vector<counted<size_t> > initial;
+        initial.push_back(1);
+        rcu_vector<counted<size_t> > a(initial);
+
+        {
+            rcu_vector<counted<size_t> >::reader r(a);
+            EXPECT_EQ(1, r->size());
+            EXPECT_EQ(1, (*r)[0]);
+        }
+
+        a.update([](vector<counted<size_t> >& v) {
+            v.push_back(2);
+        });
+
+        {
+            rcu_vector<counted<size_t> >::reader r(a);
+            EXPECT_EQ(2, r->size());
+            EXPECT_EQ(2, (*r)[1]);
+        }
+
+        vector<counted<size_t> > next;
+        next.push_back(3);
+        a.publish(next);
+        EXPECT_TRUE(next.empty());
+
+        rcu_vector<counted<size_t> >::reader r(a);
+        EXPECT_EQ(1, r->size());
+        EXPECT_EQ(3, (*r)[0]);
+    }
+    epoch_domain::instance().synchronize();
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(rcu_vector, pinned_reader_delays_reclaim)
+{
+    epoch_domain& domain = epoch_domain::instance();
+    domain.synchronize();
+
+    rcu_vector<int> a;
+    {
+        rcu_vector<int>::reader r(a);
+        vector<int> const* seen = &*r;
+
+        a.update([](vector<int>& v) {
+            v.push_back(1);
+        });
+
+        EXPECT_EQ(0, domain.reclaim());
+        EXPECT_EQ(1, domain.retired_count());
+        EXPECT_TRUE(seen->empty());
+    }
+
+    EXPECT_EQ(1, domain.reclaim());
+    EXPECT_EQ(0, domain.retired_count());
+}
+
+TEST(rcu_vector, concurrent_readers)
+{
+    size_t const n = 64;
+    vector<size_t> initial;
+    for (size_t i = 0; i != n; ++i)
+        initial.push_back(0);
+
+    rcu_vector<size_t> a(initial);
+    std::atomic<bool> done(false);
+    std::atomic<size_t> torn(0);
+
+    run_parallel(4, [&](size_t i) {
+        if (i == 0)
+        {
+            for (size_t version = 1; version != 2000; ++version)
+            {
+                a.update([=](vector<size_t>& v) {
+                    for (size_t j = 0; j != v.size(); ++j)
+                        v[j] = version;
+                });
+            }
+            done = true;
+            return;
+        }
+
+        while (!done)
+        {
+            rcu_vector<size_t>::reader r(a);
+            for (size_t j = 1; j != r->size(); ++j)
+                if ((*r)[j] != (*r)[0])
+                    ++torn;
+        }
+    });
+
+    EXPECT_EQ(0, torn);
+    epoch_domain::instance().synchronize();
+    EXPECT_EQ(0, epoch_domain::instance().retired_count());
+}
+
+namespace
+{
+    std::string unique_name(char const* prefix)
+    {
+        return std::string(prefix) + std::to_string(getpid());
+    }
+}
+
+TEST(shm_vector, create_attach)
+{
+    std::string name = unique_name("/vector_testing_shm_");
+    shm_vector<size_t>::remove(name.c_str());
+
+    {
+        shm_vector<size_t> writer(name.c_str(), 100000);
+        EXPECT_TRUE(writer.writable());
+        EXPECT_EQ(100000, writer.capacity());
+        for (size_t i = 0; i != 1000; ++i)
+            writer.push_back(i * i);
+
+        shm_vector<size_t> reader(name.c_str());
+        EXPECT_FALSE(reader.writable());
+        EXPECT_NE(writer.data(), reader.data());
+        EXPECT_EQ(1000, reader.size());
+        for (size_t i = 0; i != 1000; ++i)
+            EXPECT_EQ(i * i, reader[i]);
+
+        writer.push_back(42);
+        EXPECT_EQ(1001, reader.size());
+        EXPECT_EQ(42, *(reader.end() - 1));
+
+        writer.set(0, 7);
+        EXPECT_EQ(7, reader[0]);
+    }
+
+    shm_vector<size_t>::remove(name.c_str());
+}
+
+TEST(shm_vector, other_process)
+{
+    std::string name = unique_name("/vector_testing_shm_fork_");
+    shm_vector<size_t>::remove(name.c_str());
+
+    shm_vector<size_t> writer(name.c_str(), 1000);
+    for (size_t i = 0; i != 1000; ++i)
+        writer.push_back(i + 1);
+
+    pid_t child = fork();
+    ASSERT_NE(-1, child);
+    if (child == 0)
+    {
+        int status = 0;
+        try
+        {
+            shm_vector<size_t> reader(name.c_str());
+            size_t sum = 0;
+            for (shm_vector<size_t>::const_iterator i = reader.begin(); i != reader.end(); ++i)
+                sum += *i;
+            status = (sum == 1000 * 1001 / 2) ? 0 : 1;
+        }
+        catch (...)
+        {
+            status = 2;
+        }
+        _exit(status);
+    }
+
+    int status = 0;
+    waitpid(child, &status, 0);
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+
+    shm_vector<size_t>::remove(name.c_str());
+}
+
+TEST(shm_vector, errors)
+{
+    std::string name = unique_name("/vector_testing_shm_errors_");
+    shm_vector<size_t>::remove(name.c_str());
+
+    EXPECT_THROW(shm_vector<size_t> missing(name.c_str()), std::system_error);
+
+    shm_vector<size_t> writer(name.c_str(), 2);
+    EXPECT_THROW(shm_vector<size_t> duplicate(name.c_str(), 2), std::system_error);
+    EXPECT_THROW(shm_vector<char> wrong_type(name.c_str()), std::runtime_error);
+
+    writer.push_back(1);
+    writer.push_back(2);
+    EXPECT_THROW(writer.push_back(3), std::length_error);
+
+    shm_vector<size_t>::remove(name.c_str());
+}
+
+TEST(shm_vector, corrupt_header)
+{
+    std::string name = unique_name("/vector_testing_shm_corrupt_");
+    shm_vector<size_t>::remove(name.c_str());
+
+    shm_vector<size_t> writer(name.c_str(), 16);
+    writer.push_back(1);
+
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    ASSERT_NE(-1, fd);
+    void* p = mmap(nullptr, page_size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    ASSERT_NE(MAP_FAILED, p);
+
+    // Заголовок: magic, version и element_size, capacity, size, offset_ptr.
+    intptr_t* fields = static_cast<intptr_t*>(p);
+    intptr_t offset = fields[4];
+
+    fields[4] = intptr_t(1) << 40;
+    EXPECT_THROW(shm_vector<size_t> reader(name.c_str()), std::runtime_error);
+    fields[4] = -offset;
+    EXPECT_THROW(shm_vector<size_t> reader(name.c_str()), std::runtime_error);
+    fields[4] = offset + 1;
+    EXPECT_THROW(shm_vector<size_t> reader(name.c_str()), std::runtime_error);
+
+    fields[4] = offset;
+    {
+        shm_vector<size_t> reader(name.c_str());
+        EXPECT_EQ(1, reader[0]);
+
+        // Размер, испорченный после подключения, ограничен емкостью.
+        fields[3] = intptr_t(1) << 40;
+        EXPECT_EQ(16, reader.size());
+        EXPECT_EQ(16, reader.end() - reader.begin());
+        fields[3] = 1;
+    }
+
+    fields[3] = 17;
+    EXPECT_THROW(shm_vector<size_t> reader(name.c_str()), std::runtime_error);
+    fields[3] = 1;
+
+    // Нулевой magic -- сегмент, который создатель еще не успел заполнить.
+    fields[0] = 0;
+    EXPECT_THROW(shm_vector<size_t> reader(name.c_str()), std::runtime_error);
+
+    munmap(p, page_size());
+    shm_vector<size_t>::remove(name.c_str());
+}
+
+TEST(external_vector, spill)
+{
+    external_vector<size_t> a(3 * 4096, "/var/tmp", 4096);
+    size_t const n = 100000;
+    for (size_t i = 0; i != n; ++i)
+        a.push_back(i * 3);
+
+    EXPECT_EQ(n, a.size());
+    EXPECT_LE(a.resident_pages(), 3);
+    EXPECT_GT(a.page_writes(), 0);
+
+    for (size_t i = 0; i != n; ++i)
+        ASSERT_EQ(i * 3, a.get(i));
+
+    for (size_t i = 0; i < n; i += 997)
+        a[i] = 1;
+    for (size_t i = n; i-- > 0; )
+        ASSERT_EQ(i % 997 == 0 ? 1 : i * 3, a.get(i));
+}
+
+TEST(external_vector, pop_back)
+{
+    external_vector<int> a(2 * 1024, "/tmp", 1024);
+    for (int i = 0; i != 5000; ++i)
+        a.push_back(i);
+
+    while (a.size() != 700)
+        a.pop_back();
+    for (int i = 700; i != 3000; ++i)
+        a.push_back(-i);
+
+    for (int i = 0; i != 3000; ++i)
+        ASSERT_EQ(i < 700 ? i : -i, a.get(i));
+}
+
+TEST(external_vector, fits_in_memory)
+{
+    external_vector<int> a(1 << 20, "/tmp", 4096);
+    for (int i = 0; i != 10000; ++i)
+        a.push_back(i);
+    for (int i = 0; i != 10000; ++i)
+        a.set(i, a.get(i) + 1);
+    for (int i = 0; i != 10000; ++i)
+        ASSERT_EQ(i + 1, a[i]);
+
+    EXPECT_EQ(0, a.page_writes());
+    a.flush();
+    EXPECT_EQ(a.resident_pages(), a.page_writes());
+}
+
+TEST(external_vector, bad_spill_dir)
+{
+    EXPECT_THROW(external_vector<int> a(4096, "/nonexistent/directory"), std::system_error);
+}
+
+namespace
+{
+    std::string temp_path(char const* name)
+    {
+        return "/tmp/" + unique_name(name);
+    }
+
+    vector<uint64_t> random_keys(size_t n, uint64_t seed)
+    {
+        vector<uint64_t> result;
+        result.reserve(n);
+        for (size_t i = 0; i != n; ++i)
+        {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            result.push_back(seed >> 40);
+        }
+        return result;
+    }
+}
+
+TEST(vector_io, round_trip)
+{
+    std::string path = temp_path("vector_testing_io_");
+
+    vector<uint64_t> a = random_keys(1000, 1);
+    write_binary(path, a);
+
+    vector<uint64_t> b;
+    b.push_back(42);
+    read_binary(path, b);
+
+    EXPECT_EQ(1001, b.size());
+    EXPECT_EQ(42, b[0]);
+    for (size_t i = 0; i != a.size(); ++i)
+        ASSERT_EQ(a[i], b[i + 1]);
+
+    vector<uint32_t> wrong_type;
+    EXPECT_THROW(read_binary(path, wrong_type), std::runtime_error);
+    EXPECT_THROW(read_binary(path + ".missing", b), std::system_error);
+
+    unlink(path.c_str());
+}
+
+TEST(vector_io, truncated)
+{
+    std::string path = temp_path("vector_testing_io_truncated_");
+    write_binary(path, random_keys(1000, 1));
+    ASSERT_EQ(0, truncate(path.c_str(), sizeof(binary_header) + 500 * sizeof(uint64_t) + 3));
+
+    vector<uint64_t> b;
+    try
+    {
+        read_binary(path, b);
+        ADD_FAILURE() << "truncated file was read";
+    }
+    catch (std::system_error const& e)
+    {
+        ADD_FAILURE() << "EOF reported as " << e.what();
+    }
+    catch (std::runtime_error const& e)
+    {
+        EXPECT_NE(std::string::npos, std::string(e.what()).find("truncated"));
+    }
+
+    unlink(path.c_str());
+}
+
+TEST(external_sort, multi_pass)
+{
+    std::string input = temp_path("vector_testing_sort_in_");
+    std::string output = temp_path("vector_testing_sort_out_");
+
+    vector<uint64_t> keys = random_keys(100000, 2);
+    write_binary(input, keys);
+
+    external_sort_stats stats = external_sort<uint64_t>(input, output, 64 * 1024);
+    EXPECT_EQ(13, stats.runs);
+    EXPECT_GT(stats.merge_passes, 1);
+
+    vector<uint64_t> sorted;
+    read_binary(output, sorted);
+    std::sort(keys.begin(), keys.end());
+
+    ASSERT_EQ(keys.size(), sorted.size());
+    for (size_t i = 0; i != keys.size(); ++i)
+        ASSERT_EQ(keys[i], sorted[i]);
+
+    unlink(input.c_str());
+    unlink(output.c_str());
+}
+
+TEST(external_sort, to_vector)
+{
+    std::string input = temp_path("vector_testing_sort_vec_");
+
+    vector<uint64_t> keys = random_keys(20000, 3);
+    write_binary(input, keys);
+
+    vector<uint64_t> sorted;
+    external_sort_stats stats = external_sort<uint64_t>(
+        input, sorted, 1 << 20, "/tmp", std::greater<uint64_t>());
+    EXPECT_EQ(1, stats.runs);
+
+    std::sort(keys.begin(), keys.end(), std::greater<uint64_t>());
+    ASSERT_EQ(keys.size(), sorted.size());
+    for (size_t i = 0; i != keys.size(); ++i)
+        ASSERT_EQ(keys[i], sorted[i]);
+
+    unlink(input.c_str());
+}
+
+TEST(external_sort, empty)
+{
+    std::string input = temp_path("vector_testing_sort_empty_");
+    std::string output = temp_path("vector_testing_sort_empty_out_");
+
+    write_binary(input, vector<uint64_t>());
+    external_sort_stats stats = external_sort<uint64_t>(input, output, 4096);
+    EXPECT_EQ(0, stats.runs);
+
+    vector<uint64_t> sorted;
+    read_binary(output, sorted);
+    EXPECT_TRUE(sorted.empty());
+
+    unlink(input.c_str());
+    unlink(output.c_str());
+}
+
+TEST(async_loader, binary)
+{
+    std::string path = temp_path("vector_testing_load_");
+
+    vector<uint64_t> keys = random_keys(300000, 4);
+    write_binary(path, keys);
+
+    load_options options;
+    options.block_bytes = 64 * 1024;
+    options.queue_depth = 8;
+
+    // Загруженные элементы дописываются после уже имеющихся.
+    vector<uint64_t> loaded;
+    loaded.push_back(42);
+    load_stats stats = load_binary(path, loaded, options);
+    EXPECT_EQ(keys.size() * sizeof(uint64_t), stats.bytes);
+    EXPECT_GE(stats.requests, 37);
+
+    ASSERT_EQ(keys.size() + 1, loaded.size());
+    EXPECT_EQ(42, loaded[0]);
+    for (size_t i = 0; i != keys.size(); ++i)
+        ASSERT_EQ(keys[i], loaded[i + 1]);
+
+    unlink(path.c_str());
+}
+
+TEST(async_loader, thread_fallback)
+{
+    std::string path = temp_path("vector_testing_load_threads_");
+
+    vector<uint64_t> keys = random_keys(100000, 5);
+    write_binary(path, keys);
+
+    load_options options;
+    options.block_bytes = 40000;
+    options.threads = 3;
+    options.use_io_uring = false;
+
+    vector<uint64_t> loaded;
+    load_stats stats = load_binary(path, loaded, options);
+    EXPECT_FALSE(stats.used_io_uring);
+
+    ASSERT_EQ(keys.size(), loaded.size());
+    for (size_t i = 0; i != keys.size(); ++i)
+        ASSERT_EQ(keys[i], loaded[i]);
+
+    unlink(path.c_str());
+}
+
+namespace
+{
+    // Временный каталог в /var/tmp, который удаляется вместе с файлами,
+    // даже если ASSERT_* прервал тест.
+    struct scoped_temp_dir
+    {
+        scoped_temp_dir()
+            : path_("/var/tmp/vector_testing_XXXXXX")
+        {
+            if (mkdtemp(&path_[0]) == nullptr)
+                throw std::system_error(errno, std::generic_category(), "mkdtemp");
+        }
+
+        ~scoped_temp_dir()
+        {
+            for (size_t i = 0; i != files_.size(); ++i)
+                unlink(files_[i].c_str());
+            rmdir(path_.c_str());
+        }
+
+        std::string file(char const* name)
+        {
+            files_.push_back(path_ + "/" + name);
+            return files_.back();
+        }
+
+    private:
+        scoped_temp_dir(scoped_temp_dir const&);
+        scoped_temp_dir& operator=(scoped_temp_dir const&);
+
+    private:
+        std::string path_;
+        vector<std::string> files_;
+    };
+}
+
+TEST(async_loader, direct)
+{
+    // tmpfs не поддерживает O_DIRECT, поэтому файл создается в /var/tmp;
+    // если и там нельзя, загрузка идет обычным чтением.
+    scoped_temp_dir dir;
+    std::string path = dir.file("load_direct");
+
+    vector<uint64_t> keys = random_keys(50000, 6);
+    write_binary(path, keys);
+
+    for (int uring = 0; uring != 2; ++uring)
+    {
+        load_options options;
+        options.direct = true;
+        options.use_io_uring = uring != 0;
+        options.block_bytes = 10000;
+
+        vector<uint64_t> loaded;
+        load_binary(path, loaded, options);
+
+        ASSERT_EQ(keys.size(), loaded.size());
+        for (size_t i = 0; i != keys.size(); ++i)
+            ASSERT_EQ(keys[i], loaded[i]);
+    }
+}
+
+TEST(async_loader, errors)
+{
+    vector<uint64_t> v;
+    v.push_back(1);
+    EXPECT_THROW(load_file("/nonexistent/vector_testing", v), std::system_error);
+
+    // Файл, длина которого не кратна размеру элемента.
+    std::string path = temp_path("vector_testing_load_odd_");
+    vector<char> bytes;
+    for (int i = 0; i != 13; ++i)
+        bytes.push_back(static_cast<char>(i));
+    FILE* f = fopen(path.c_str(), "wb");
+    ASSERT_TRUE(f != nullptr);
+    fwrite(bytes.data(), 1, bytes.size(), f);
+    fclose(f);
+
+    EXPECT_THROW(load_file(path, v), std::runtime_error);
+    EXPECT_EQ(1, v.size());
+
+    vector<char> raw;
+    load_file(path, raw);
+    ASSERT_EQ(13, raw.size());
+    EXPECT_EQ(12, raw[12]);
+
+    // Число элементов в заголовке больше, чем есть в файле, или такое,
+    // что count * sizeof(T) переполняется до нуля.
+    vector<uint64_t> keys = random_keys(10, 5);
+    write_binary(path, keys);
+    int fd = open(path.c_str(), O_WRONLY);
+    ASSERT_NE(-1, fd);
+    uint64_t counts[] = {11, uint64_t(1) << 61, ~uint64_t(0)};
+    for (size_t i = 0; i != 3; ++i)
+    {
+        ASSERT_EQ(8, pwrite(fd, &counts[i], 8, offsetof(binary_header, count)));
+        EXPECT_THROW(load_binary(path, v), std::runtime_error);
+        EXPECT_EQ(1, v.size());
+    }
+    close(fd);
+
+    unlink(path.c_str());
+}
+
+namespace
+{
+    void write_file(std::string const& path, std::string const& contents)
+    {
+        FILE* f = fopen(path.c_str(), "wb");
+        ASSERT_TRUE(f != nullptr);
+        fwrite(contents.data(), 1, contents.size(), f);
+        fclose(f);
+    }
+
+    // Заголовок дополняется пробелами до 16 байт, как в старых версиях NumPy.
+    std::string npy_file(std::string dict, std::string const& data)
+    {
+        dict.insert(dict.size() - 1, (16 - (10 + dict.size()) % 16) % 16, ' ');
+        std::string result("\x93NUMPY\x01\x00", 8);
+        result += static_cast<char>(dict.size() & 0xff);
+        result += static_cast<char>(dict.size() >> 8);
+        return result + dict + data;
+    }
+}
+
+TEST(npy, round_trip)
+{
+    std::string path = temp_path("vector_testing_npy_");
+
+    vector<double> a;
+    for (int i = 0; i != 1000; ++i)
+        a.push_back(i * 0.5);
+    write_npy(path, a);
+
+    npy_view<double> view(path);
+    ASSERT_EQ(a.size(), view.size());
+    ASSERT_EQ(1, view.shape().size());
+    EXPECT_EQ(1000, view.shape()[0]);
+    EXPECT_FALSE(view.fortran_order());
+    EXPECT_TRUE(is_aligned(view.data(), 64));
+    EXPECT_TRUE(std::equal(view.begin(), view.end(), a.begin()));
+
+    // Заголовок вместе с префиксом дополнен до 64 байт и кончается '\n'.
+    raw_view<char> raw(path);
+    size_t header_bytes = raw.size() - 1000 * sizeof(double);
+    EXPECT_EQ(0, header_bytes % 64);
+    EXPECT_EQ('\n', raw[header_bytes - 1]);
+    EXPECT_EQ(0, memcmp(raw.data(), "\x93NUMPY\x01\x00", 8));
+
+    unlink(path.c_str());
+}
+
+TEST(npy, shape)
+{
+    std::string path = temp_path("vector_testing_npy_shape_");
+
+    vector<int32_t> a;
+    for (int i = 0; i != 6; ++i)
+        a.push_back(i);
+    vector<size_t> shape;
+    shape.push_back(2);
+    shape.push_back(3);
+    write_npy(path, a, shape);
+
+    npy_view<int32_t> view(path);
+    ASSERT_EQ(2, view.shape().size());
+    EXPECT_EQ(2, view.shape()[0]);
+    EXPECT_EQ(3, view.shape()[1]);
+    ASSERT_EQ(6, view.size());
+    EXPECT_EQ(5, view[5]);
+
+    shape.push_back(2);
+    EXPECT_THROW(write_npy(path, a, shape), std::invalid_argument);
+
+    unlink(path.c_str());
+}
+
+TEST(npy, validation)
+{
+    std::string path = temp_path("vector_testing_npy_bad_");
+    std::string two_floats("\0\0\x80\x3f\0\0\0\x40", 8);
+
+    // Порядок ключей и лишние пробелы не важны, '=' -- машинный порядок.
+    write_file(path, npy_file("{'shape': (2,),  'fortran_order': True, 'descr': '=f4'}   \n", two_floats));
+    {
+        npy_view<float> view(path);
+        ASSERT_EQ(2, view.size());
+        EXPECT_EQ(1.0f, view[0]);
+        EXPECT_EQ(2.0f, view[1]);
+    }
+    EXPECT_THROW(npy_view<double> view(path), std::runtime_error);
+    EXPECT_THROW(npy_view<int32_t> view(path), std::runtime_error);
+
+    write_file(path, npy_file("{'descr': '<f4', 'fortran_order': True, 'shape': (1, 2), }\n", two_floats));
+    EXPECT_THROW(npy_view<float> view(path), std::runtime_error);
+
+    write_file(path, npy_file("{'descr': '<f4', 'fortran_order': False, 'shape': (3,), }\n", two_floats));
+    EXPECT_THROW(npy_view<float> view(path), std::runtime_error);
+
+    write_file(path, npy_file("{'descr': [('a', '<f4')], 'fortran_order': False, 'shape': (2,), }\n", two_floats));
+    EXPECT_THROW(npy_view<float> view(path), std::runtime_error);
+
+    // Произведение размерностей 2^32 * 2^32 переполняет size_t и без
+    // проверки дало бы пустой массив.
+    write_file(path, npy_file("{'descr': '<f4', 'fortran_order': False, 'shape': (4294967296, 4294967296), }\n", two_floats));
+    EXPECT_THROW(npy_view<float> view(path), std::runtime_error);
+    write_file(path, npy_file("{'descr': '<f4', 'fortran_order': False, 'shape': (99999999999999999999999,), }\n", two_floats));
+    EXPECT_THROW(npy_view<float> view(path), std::runtime_error);
+    write_file(path, npy_file("{'descr': '<f4', 'fortran_order': False, 'shape': (4294967296, 4294967296, 0), }\n", ""));
+    EXPECT_EQ(0, npy_view<float>(path).size());
+
+    write_file(path, "not an npy file");
+    EXPECT_THROW(npy_view<float> view(path), std::runtime_error);
+    EXPECT_THROW(npy_view<float> view("/nonexistent/vector_testing.npy"), std::system_error);
+
+    unlink(path.c_str());
+}
+
+TEST(npy, raw_view)
+{
+    std::string path = temp_path("vector_testing_raw_");
+
+    vector<uint64_t> keys = random_keys(5000, 7);
+    write_binary(path, keys);
+
+    raw_view<uint64_t> view(path, sizeof(binary_header));
+    ASSERT_EQ(keys.size(), view.size());
+    EXPECT_TRUE(std::equal(view.begin(), view.end(), keys.begin()));
+
+    EXPECT_THROW(raw_view<uint64_t> bad(path, 4), std::runtime_error);
+
+    write_file(path, "");
+    raw_view<uint64_t> empty(path);
+    EXPECT_TRUE(empty.empty());
+    EXPECT_EQ(empty.begin(), empty.end());
+
+    unlink(path.c_str());
+}
+
+TEST(arrow, export_import)
+{
+    vector<int64_t> a;
+    vector<uint8_t> validity;
+    for (int i = 0; i != 100; ++i)
+    {
+        a.push_back(i * 3);
+        set_valid(validity, i, i % 10 != 0);
+    }
+    int64_t const* buffer = a.data();
+
+    ArrowArray array;
+    ArrowSchema schema;
+    export_arrow(a, &array, &schema, &validity);
+    EXPECT_TRUE(a.empty());
+    EXPECT_TRUE(validity.empty());
+
+    EXPECT_STREQ("l", schema.format);
+    EXPECT_EQ(ARROW_FLAG_NULLABLE, schema.flags);
+    EXPECT_EQ(100, array.length);
+    EXPECT_EQ(10, array.null_count);
+    EXPECT_EQ(buffer, array.buffers[1]);
+
+    {
+        arrow_view<int64_t> view(&array, &schema);
+        EXPECT_TRUE(array.release == nullptr);
+        EXPECT_EQ(buffer, view.data());
+        ASSERT_EQ(100, view.size());
+        EXPECT_EQ(10, view.null_count());
+        EXPECT_FALSE(view.is_valid(0));
+        EXPECT_TRUE(view.is_valid(1));
+        EXPECT_EQ(297, view[99]);
+    }
+
+    schema.release(&schema);
+    EXPECT_TRUE(schema.release == nullptr);
+}
+
+TEST(arrow, type_mismatch)
+{
+    vector<float> a;
+    a.push_back(1.5f);
+
+    ArrowArray array;
+    ArrowSchema schema;
+    export_arrow(a, &array, &schema);
+    EXPECT_STREQ("f", schema.format);
+    EXPECT_EQ(0, schema.flags);
+
+    // Массив остается у вызывающего, и освобождать его нужно самому.
+    EXPECT_THROW(arrow_view<double> view(&array, &schema), std::invalid_argument);
+    EXPECT_TRUE(array.release != nullptr);
+
+    array.release(&array);
+    schema.release(&schema);
+}
+
+namespace
+{
+    int foreign_releases = 0;
+
+    void release_foreign(ArrowArray* array)
+    {
+        ++foreign_releases;
+        array->release = nullptr;
+    }
+}
+
+TEST(arrow, foreign_array)
+{
+    uint32_t values[] = {10, 20, 30, 40, 50};
+    uint8_t bitmap[] = {0x1b};   // 11011: пропуск в позиции 2
+    void const* buffers[] = {bitmap, values};
+
+    ArrowArray array;
+    memset(&array, 0, sizeof array);
+    array.length = 3;
+    array.null_count = -1;
+    array.offset = 1;
+    array.n_buffers = 2;
+    array.buffers = buffers;
+    array.release = &release_foreign;
+
+    ArrowSchema schema;
+    export_arrow_schema<uint32_t>(&schema, true);
+
+    {
+        arrow_view<uint32_t> view(&array, &schema);
+        ASSERT_EQ(3, view.size());
+        EXPECT_EQ(values + 1, view.begin());
+        EXPECT_EQ(20, view[0]);
+        EXPECT_EQ(40, view[2]);
+        EXPECT_TRUE(view.is_valid(0));
+        EXPECT_FALSE(view.is_valid(1));
+        EXPECT_EQ(1, view.null_count());
+        EXPECT_EQ(0, foreign_releases);
+    }
+    EXPECT_EQ(1, foreign_releases);
+
+    schema.release(&schema);
+}
+
+TEST(tracked_vector, dirty_blocks)
+{
+    tracked_vector<int> v(10);
+    for (int i = 0; i != 100; ++i)
+        v.push_back(i);
+    EXPECT_EQ(10, v.block_count());
+    EXPECT_EQ(10, v.dirty_block_count());
+
+    v.clear_dirty();
+    EXPECT_EQ(0, v.dirty_block_count());
+
+    v[15] = -1;
+    v.set(99, -2);
+    EXPECT_TRUE(v.is_dirty(1));
+    EXPECT_TRUE(v.is_dirty(9));
+    EXPECT_EQ(2, v.dirty_block_count());
+
+    v.data()[42] = -3;
+    EXPECT_FALSE(v.is_dirty(4));
+    v.mark_dirty(40, 51);
+    EXPECT_TRUE(v.is_dirty(4));
+    EXPECT_TRUE(v.is_dirty(5));
+    EXPECT_EQ(4, v.dirty_block_count());
+
+    v.clear_dirty();
+    v.erase(75);
+    EXPECT_FALSE(v.is_dirty(6));
+    EXPECT_TRUE(v.is_dirty(7));
+    EXPECT_TRUE(v.is_dirty(9));
+    EXPECT_EQ(3, v.dirty_block_count());
+}
+
+TEST(tracked_vector, incremental_snapshots)
+{
+    std::string base = temp_path("vector_testing_snapshot_base_");
+    std::string delta1 = temp_path("vector_testing_snapshot_d1_");
+    std::string delta2 = temp_path("vector_testing_snapshot_d2_");
+
+    tracked_vector<uint64_t> v(100);
+    vector<uint64_t> keys = random_keys(10000, 8);
+    for (size_t i = 0; i != keys.size(); ++i)
+        v.push_back(keys[i]);
+    write_full_snapshot(base, v);
+    EXPECT_EQ(0, v.dirty_block_count());
+
+    v[5] = 1;
+    v[5005] = 2;
+    for (int i = 0; i != 150; ++i)
+        v.push_back(i);
+    EXPECT_EQ(4, write_incremental_snapshot(delta1, v));
+
+    for (int i = 0; i != 300; ++i)
+        v.pop_back();
+    v.insert(9800, 3);
+    EXPECT_EQ(1, write_incremental_snapshot(delta2, v));
+    EXPECT_EQ(0, write_incremental_snapshot(delta2 + ".empty", v));
+
+    vector<uint64_t> restored;
+    read_binary(base, restored);
+    apply_incremental_snapshot(delta1, restored);
+    ASSERT_EQ(10150, restored.size());
+    EXPECT_EQ(2, restored[5005]);
+    EXPECT_EQ(149, restored[10149]);
+
+    apply_incremental_snapshot(delta2, restored);
+    apply_incremental_snapshot(delta2 + ".empty", restored);
+    ASSERT_EQ(v.size(), restored.size());
+    for (size_t i = 0; i != v.size(); ++i)
+        ASSERT_EQ(v.values()[i], restored[i]);
+
+    vector<uint32_t> wrong;
+    EXPECT_THROW(apply_incremental_snapshot(delta1, wrong), std::runtime_error);
+    EXPECT_THROW(apply_incremental_snapshot(base, restored), std::runtime_error);
+
+    // Обрезанный снимок отвергается целиком, вектор остается прежним.
+    vector<uint64_t> before;
+    read_binary(base, before);
+    vector<uint64_t> partial = before;
+    ASSERT_EQ(0, truncate(delta1.c_str(), sizeof(delta_header) + 4 * sizeof(uint64_t)
+                                          + 200 * sizeof(uint64_t)));
+    EXPECT_THROW(apply_incremental_snapshot(delta1, partial), std::runtime_error);
+    ASSERT_EQ(before.size(), partial.size());
+    EXPECT_TRUE(std::equal(before.begin(), before.end(), partial.begin()));
+
+    unlink(base.c_str());
+    unlink(delta1.c_str());
+    unlink(delta2.c_str());
+    unlink((delta2 + ".empty").c_str());
+}
+
+TEST(fork_snapshot, consistent_image)
+{
+    std::string path_a = temp_path("vector_testing_fork_a_");
+    std::string path_b = temp_path("vector_testing_fork_b_");
+
+    vector<uint64_t> a = random_keys(200000, 9);
+    vector<int> b;
+    for (int i = 0; i != 1000; ++i)
+        b.push_back(i);
+    vector<uint64_t> expected_a = a;
+
+    fork_snapshotter snapshotter(64 * 1024);
+    snapshotter.add(path_a, a);
+    snapshotter.add(path_b, b);
+
+    snapshot_progress last = {0, 0};
+    size_t reports = 0;
+    bool completed = false;
+    std::error_code result;
+    snapshotter.start(
+        [&](snapshot_progress const& p) { last = p; ++reports; },
+        [&](std::error_code const& e) { completed = true; result = e; });
+    EXPECT_TRUE(snapshotter.running());
+    EXPECT_THROW(snapshotter.start(), std::logic_error);
+
+    // Изменения после start() в снимок не попадают.
+    for (size_t i = 0; i != a.size(); ++i)
+        a[i] = 0;
+    b.clear();
+
+    snapshotter.wait();
+    EXPECT_FALSE(snapshotter.running());
+    EXPECT_TRUE(completed);
+    EXPECT_FALSE(result);
+    EXPECT_GT(reports, 0);
+    EXPECT_EQ(last.bytes_total, last.bytes_written);
+    EXPECT_EQ(2 * sizeof(binary_header) + 200000 * sizeof(uint64_t) + 1000 * sizeof(int),
+              last.bytes_total);
+
+    vector<uint64_t> saved_a;
+    read_binary(path_a, saved_a);
+    ASSERT_EQ(expected_a.size(), saved_a.size());
+    for (size_t i = 0; i != saved_a.size(); ++i)
+        ASSERT_EQ(expected_a[i], saved_a[i]);
+
+    vector<int> saved_b;
+    read_binary(path_b, saved_b);
+    ASSERT_EQ(1000, saved_b.size());
+    EXPECT_EQ(999, saved_b[999]);
+
+    unlink(path_a.c_str());
+    unlink(path_b.c_str());
+}
+
+TEST(fork_snapshot, error)
+{
+    vector<int> v;
+    v.push_back(1);
+
+    fork_snapshotter snapshotter;
+    snapshotter.add("/nonexistent/vector_testing_fork", v);
+
+    std::error_code result;
+    snapshotter.start(fork_snapshotter::progress_handler(),
+                      [&](std::error_code const& e) { result = e; });
+    while (!snapshotter.poll(100))
+        ;
+    EXPECT_EQ(ENOENT, result.value());
+}
+
+TEST(transactional_vector, commit_rollback)
+{
+    transactional_vector<std::string> v;
+    for (int i = 0; i != 10; ++i)
+        v.push_back(std::to_string(i));
+    EXPECT_EQ(0, v.undo_size());
+
+    v.begin_transaction();
+    v.set(3, "three");
+    v[4] = "four";
+    v.push_back("10");
+    v.insert(0, "front");
+    v.erase(5);
+    v.pop_back();
+    v.pop_back();
+    v.insert(v.size(), "back");
+    EXPECT_EQ(8, v.undo_size());
+    v.rollback();
+
+    EXPECT_FALSE(v.in_transaction());
+    ASSERT_EQ(10, v.size());
+    for (int i = 0; i != 10; ++i)
+        EXPECT_EQ(std::to_string(i), v[i]);
+
+    v.begin_transaction();
+    v.set(0, "zero");
+    v.erase(9);
+    v.commit();
+    EXPECT_EQ(0, v.undo_size());
+
+    ASSERT_EQ(9, v.size());
+    EXPECT_EQ("zero", v[0]);
+    EXPECT_EQ("8", v.values().data()[8]);
+}
+
+TEST(transactional_vector, rollback_to_empty)
+{
+    transactional_vector<int> v;
+    v.push_back(1);
+
+    v.begin_transaction();
+    v.erase(0);
+    v.push_back(2);
+    v.push_back(3);
+    v.erase(1);
+    v.erase(0);
+    EXPECT_TRUE(v.empty());
+    v.rollback();
+
+    ASSERT_EQ(1, v.size());
+    EXPECT_EQ(1, v[0]);
+}
+
+TEST(transactional_vector, throwing_copy)
+{
+    typedef counted<int> item;
+    {
+        transactional_vector<item> v;
+        for (int i = 0; i != 8; ++i)
+            v.push_back(i);
+
+        v.begin_transaction();
+        v.set(1, 100);
+        v.pop_back();
+
+        // Бросившие операции не оставляют следов ни в векторе, ни в журнале.
+        size_t undo_size = v.undo_size();
+        item::set_throw_countdown(1);
+        EXPECT_THROW(v.push_back(42), std::runtime_error);
+        EXPECT_EQ(undo_size, v.undo_size());
+        EXPECT_EQ(7, v.size());
+
+        // Присваивание бросает после записи в журнал: откат вернет то же
+        // значение, что и так осталось в векторе.
+        item::set_throw_countdown(2);
+        EXPECT_THROW(v.set(2, 42), std::runtime_error);
+        item::set_throw_countdown(0);
+        EXPECT_TRUE(v[2] == item(2));
+
+        v.rollback();
+        ASSERT_EQ(8, v.size());
+        EXPECT_TRUE(v[1] == item(1));
+        EXPECT_TRUE(v[7] == item(7));
+    }
+    item::expect_no_instances();
+}
+
+TEST(compact_vector, layout)
+{
+    EXPECT_EQ(16, sizeof(compact_vector<uint32_t>));
+    EXPECT_EQ(24, sizeof(vector<uint32_t>));
+
+    compact_vector<compact_vector<uint32_t> > rows;
+    rows.push_back(compact_vector<uint32_t>());
+    EXPECT_TRUE(rows[0].data() == nullptr);
+    EXPECT_EQ(0, rows[0].capacity());
+
+    compact_vector<compact_vector<uint32_t> > copy = rows;
+    EXPECT_TRUE(copy[0].data() == nullptr);
+
+    EXPECT_THROW(rows[0].reserve(compact_vector<uint32_t>::max_size() + 1), std::length_error);
+}
+
+TEST(compact_vector, operations)
+{
+    compact_vector<int> v;
+    for (int i = 0; i != 100; ++i)
+        v.push_back(i);
+    v.push_back(v[0]);
+    ASSERT_EQ(101, v.size());
+    EXPECT_EQ(0, v.back());
+
+    v.erase(v.begin() + 10, v.begin() + 20);
+    EXPECT_EQ(91, v.size());
+    EXPECT_EQ(20, v[10]);
+
+    v.insert(v.begin() + 5, -1);
+    EXPECT_EQ(-1, v[5]);
+    EXPECT_EQ(5, v[6]);
+
+    v.shrink_to_fit();
+    EXPECT_EQ(v.size(), v.capacity());
+    v.insert(v.end(), -2);
+    EXPECT_EQ(-2, v.back());
+
+    compact_vector<int> w;
+    w.reserve(8);
+    w.insert(w.begin(), 7);
+    ASSERT_EQ(1, w.size());
+    EXPECT_EQ(7, w[0]);
+
+    w = v;
+    EXPECT_TRUE(std::equal(v.begin(), v.end(), w.begin()));
+    w.clear();
+    EXPECT_TRUE(w.empty());
+}
+
+TEST(compact_vector, push_back_throw)
+{
+    typedef counted<int> item;
+    {
+        compact_vector<item> v;
+        for (int i = 0; i != 4; ++i)
+            v.push_back(i);
+        ASSERT_EQ(v.size(), v.capacity());
+
+        item::set_throw_countdown(3);
+        EXPECT_THROW(v.push_back(4), std::runtime_error);
+        item::set_throw_countdown(0);
+
+        ASSERT_EQ(4, v.size());
+        EXPECT_TRUE(v[3] == item(3));
+    }
+    item::expect_no_instances();
+}
+
+// С uint8_t предел размера достижим, и на нем видно, как рост упирается
+// в max_size().
+TEST(compact_vector, size_type_limit)
+{
+    typedef vector<int, heap_allocator<int>, uint8_t> tiny_vector;
+    EXPECT_EQ(255, tiny_vector::max_size());
+
+    tiny_vector v;
+    for (int i = 0; i != 255; ++i)
+        v.push_back(i);
+    EXPECT_EQ(255, v.capacity());
+    EXPECT_THROW(v.push_back(255), std::length_error);
+    EXPECT_THROW(v.insert(v.begin(), -1), std::length_error);
+    ASSERT_EQ(255, v.size());
+    EXPECT_EQ(254, v.back());
+
+    tiny_vector w;
+    w.append_construct(200, [](int* dst, size_t n) {
+        for (size_t i = 0; i != n; ++i)
+            dst[i] = 1;
+    });
+    EXPECT_THROW(w.append_construct(56, [](int*, size_t) {}), std::length_error);
+    EXPECT_THROW(w.reserve(256), std::length_error);
+    EXPECT_EQ(200, w.size());
+}
+
+TEST(compact_vector, helpers)
+{
+    std::string path = temp_path("vector_testing_compact_");
+
+    compact_vector<uint64_t> a;
+    for (uint64_t i = 0; i != 1000; ++i)
+        a.push_back(i * 7);
+    write_binary(path, a);
+
+    compact_vector<uint64_t> b;
+    read_binary(path, b);
+    ASSERT_EQ(a.size(), b.size());
+    for (size_t i = 0; i != a.size(); ++i)
+        ASSERT_EQ(a[i], b[i]);
+
+    compact_vector<uint64_t> c;
+    load_binary(path, c);
+    ASSERT_EQ(a.size(), c.size());
+    EXPECT_EQ(a.back(), c.back());
+    unlink(path.c_str());
+
+    deferred_reclaimer reclaimer(1024);
+    reclaimer.retire(b);
+    EXPECT_TRUE(b.empty());
+    reclaimer.flush();
+    EXPECT_EQ(1, reclaimer.reclaimed_deferred());
+}
+
+TEST(jagged_vector, append_rows)
+{
+    jagged_vector<int> j;
+    EXPECT_TRUE(j.empty());
+
+    int row0[] = {1, 2, 3};
+    j.append_row(row0, 3);
+    j.append_row(row0, row0);
+    j.new_row();
+    j.push_back(7);
+    j.push_back(8);
+
+    ASSERT_EQ(3, j.rows());
+    EXPECT_EQ(5, j.size());
+    EXPECT_EQ(3, j[0].size());
+    EXPECT_TRUE(j[1].empty());
+    EXPECT_EQ(8, j[2][1]);
+
+    for (int& x : j[0])
+        x *= 10;
+    EXPECT_EQ(30, as_const(j)[0][2]);
+
+    // Строки лежат подряд в одном буфере.
+    EXPECT_EQ(j[0].end(), j[2].begin());
+}
+
+TEST(jagged_vector, builder)
+{
+    jagged_builder<std::string> b;
+    b.add(3, "d0");
+    b.add(0, "a0");
+    b.add(3, "d1");
+    b.add(0, "a1");
+    b.add(1, "b0");
+
+    jagged_vector<std::string> j;
+    b.build(j);
+    ASSERT_EQ(4, j.rows());
+    ASSERT_EQ(2, j[0].size());
+    EXPECT_EQ("a0", j[0][0]);
+    EXPECT_EQ("a1", j[0][1]);
+    EXPECT_EQ("b0", j[1][0]);
+    EXPECT_TRUE(j[2].empty());
+    EXPECT_EQ("d1", j[3][1]);
+
+    b.build(j, 10);
+    EXPECT_EQ(10, j.rows());
+    EXPECT_EQ(5, j.size());
+}
+
+TEST(jagged_vector, edges)
+{
+    size_t const nodes = 1000;
+    vector<uint64_t> keys = random_keys(50000, 10);
+    vector<std::pair<uint32_t, uint32_t> > edges;
+    for (size_t i = 0; i != keys.size(); ++i)
+        edges.push_back(std::make_pair(uint32_t(keys[i] % nodes), uint32_t(i)));
+
+    jagged_vector<uint32_t> parallel;
+    build_from_edges(parallel, nodes, edges, 4);
+
+    jagged_vector<uint32_t> serial;
+    build_from_edges(serial, nodes, edges, 1);
+
+    ASSERT_EQ(nodes, parallel.rows());
+    ASSERT_EQ(edges.size(), parallel.size());
+    EXPECT_TRUE(std::equal(serial.offsets().begin(), serial.offsets().end(), parallel.offsets().begin()));
+    EXPECT_TRUE(std::equal(serial.values().begin(), serial.values().end(), parallel.values().begin()));
+
+    // В каждой строке значения идут в порядке добавления.
+    for (size_t r = 0; r != nodes; ++r)
+    {
+        row_span<uint32_t const> row = as_const(parallel)[r];
+        for (size_t i = 0; i != row.size(); ++i)
+        {
+            ASSERT_EQ(r, edges[row[i]].first);
+            if (i != 0)
+            {
+                ASSERT_LT(row[i - 1], row[i]);
+            }
+        }
+    }
+
+    edges.push_back(std::make_pair(uint32_t(nodes), uint32_t(0)));
+    EXPECT_THROW(build_from_edges(parallel, nodes, edges, 4), std::out_of_range);
+    EXPECT_EQ(50000, parallel.size());
+
+    // Потоков больше, чем строк: у части потоков пустые диапазоны строк.
+    vector<std::pair<uint32_t, uint32_t> > few;
+    for (uint32_t i = 0; i != 20; ++i)
+        few.push_back(std::make_pair(i % 2, i));
+    jagged_vector<uint32_t> two_rows;
+    build_from_edges(two_rows, 3, few, 8);
+    ASSERT_EQ(3, two_rows.rows());
+    ASSERT_EQ(10, two_rows[0].size());
+    ASSERT_EQ(10, two_rows[1].size());
+    EXPECT_TRUE(two_rows[2].empty());
+    for (uint32_t i = 0; i != 10; ++i)
+    {
+        EXPECT_EQ(2 * i, two_rows[0][i]);
+        EXPECT_EQ(2 * i + 1, two_rows[1][i]);
+    }
+}
+
+TEST(string_table, basic)
+{
+    string_table t;
+    EXPECT_EQ(0, t.push_back("alpha"));
+    EXPECT_EQ(1, t.push_back(std::string("beta")));
+    EXPECT_EQ(2, t.push_back(""));
+    EXPECT_EQ(3, t.push_back("alpha"));
+
+    ASSERT_EQ(4, t.size());
+    EXPECT_EQ(14, t.blob_size());
+    EXPECT_EQ("beta", t[1].str());
+    EXPECT_TRUE(t[2].empty());
+    EXPECT_TRUE(t[0] == t[3]);
+    EXPECT_TRUE(t[0] != t[1]);
+
+    EXPECT_EQ(1, t.find("beta"));
+    EXPECT_EQ(0, t.find("alpha"));
+    EXPECT_TRUE(t.find("gamma") == string_table::npos);
+
+    vector<std::string> more;
+    more.push_back("alphabet");
+    more.push_back("al");
+    t.append(more.begin(), more.end());
+    EXPECT_EQ(6, t.size());
+
+    vector<uint32_t> found;
+    t.find_prefix("alpha", found);
+    ASSERT_EQ(3, found.size());
+    EXPECT_EQ(0, found[0]);
+    EXPECT_EQ(3, found[1]);
+    EXPECT_EQ(4, found[2]);
+
+    found.clear();
+    t.find_prefix("", found);
+    EXPECT_EQ(6, found.size());
+
+    // Строка из самой таблицы переживает перенос blob.
+    string_table u;
+    u.push_back("a string that is longer than sixteen bytes");
+    for (int i = 0; i != 20; ++i)
+        u.push_back(u[i]);
+    EXPECT_EQ(u[0], u[20]);
+}
+
+TEST(string_table, dedup)
+{
+    string_table t(true);
+    vector<std::string> words;
+    for (int i = 0; i != 1000; ++i)
+        words.push_back("token_" + std::to_string(i % 100));
+    t.append(words.begin(), words.end());
+
+    EXPECT_EQ(100, t.size());
+    EXPECT_EQ(7, t.push_back("token_7"));
+    EXPECT_EQ(100, t.push_back("token_100"));
+    EXPECT_EQ(42, t.find("token_42"));
+    EXPECT_TRUE(t.find("token") == string_table::npos);
+
+    t.clear();
+    EXPECT_TRUE(t.empty());
+    EXPECT_TRUE(t.find("token_42") == string_table::npos);
+    EXPECT_EQ(0, t.push_back("token_42"));
+}
+
+TEST(string_table, equality_lengths)
+{
+    // Длины вокруг границ 16-байтных блоков, отличие в каждой позиции.
+    for (size_t n = 0; n != 50; ++n)
+    {
+        std::string a(n, 'x');
+        EXPECT_TRUE(string_ref(a) == string_ref(std::string(n, 'x')));
+        for (size_t i = 0; i != n; ++i)
+        {
+            std::string b = a;
+            b[i] = 'y';
+            ASSERT_FALSE(string_ref(a) == string_ref(b));
+            ASSERT_TRUE(starts_with(b, string_ref(a.data(), i)));
+            ASSERT_FALSE(starts_with(b, string_ref(a.data(), i + 1)));
+        }
+    }
+}
+
+TEST(slot_map, handles)
+{
+    slot_map<int> m;
+    vector<slot_handle> h;
+    for (int i = 0; i != 10; ++i)
+        h.push_back(m.insert(i * 10));
+
+    EXPECT_EQ(10, m.size());
+    EXPECT_EQ(30, m[h[3]]);
+
+    EXPECT_TRUE(m.erase(h[3]));
+    EXPECT_FALSE(m.erase(h[3]));
+    EXPECT_FALSE(m.contains(h[3]));
+    EXPECT_TRUE(m.get(h[3]) == nullptr);
+    EXPECT_EQ(9, m.size());
+
+    // Последнее значение переехало на место удаленного, ключ остался верным.
+    EXPECT_EQ(90, m[h[9]]);
+    EXPECT_EQ(90, m.data()[3]);
+    EXPECT_TRUE(m.handle_at(3) == h[9]);
+
+    // Слот переиспользуется с новым поколением.
+    slot_handle again = m.insert(777);
+    EXPECT_EQ(h[3].index, again.index);
+    EXPECT_TRUE(again != h[3]);
+    EXPECT_FALSE(m.contains(h[3]));
+    EXPECT_EQ(777, m[again]);
+
+    EXPECT_TRUE(slot_handle::from_value(again.value()) == again);
+    EXPECT_FALSE(m.contains(slot_handle::null()));
+
+    int sum = 0;
+    for (int x : as_const(m))
+        sum += x;
+    EXPECT_EQ(450 - 30 + 777, sum);
+
+    m.clear();
+    EXPECT_TRUE(m.empty());
+    EXPECT_FALSE(m.contains(again));
+    EXPECT_FALSE(m.contains(h[0]));
+}
+
+TEST(slot_map, random_ops)
+{
+    slot_map<counted<size_t> > m;
+    {
+        vector<std::pair<slot_handle, size_t> > live;
+        vector<slot_handle> dead;
+        vector<uint64_t> keys = random_keys(5000, 10);
+        for (size_t i = 0; i != keys.size(); ++i)
+        {
+            if (keys[i] % 3 == 0 && !live.empty())
+            {
+                size_t k = keys[i] % live.size();
+                ASSERT_TRUE(m.erase(live[k].first));
+                dead.push_back(live[k].first);
+                live[k] = live.back();
+                live.pop_back();
+            }
+            else
+            {
+                live.push_back(std::make_pair(m.insert(i), i));
+            }
+        }
+
+        ASSERT_EQ(live.size(), m.size());
+        for (size_t i = 0; i != live.size(); ++i)
+        {
+            ASSERT_TRUE(m.get(live[i].first) != nullptr);
+            ASSERT_EQ(live[i].second, *m.get(live[i].first));
+        }
+        for (size_t i = 0; i != dead.size(); ++i)
+            ASSERT_FALSE(m.contains(dead[i]));
+        for (size_t i = 0; i != m.size(); ++i)
+            ASSERT_TRUE(&m[m.handle_at(i)] == m.data() + i);
+
+        // Бросившая вставка не меняет содержимое.
+        size_t size = m.size();
+        counted<size_t>::set_throw_countdown(1);
+        EXPECT_THROW(m.insert(42), std::runtime_error);
+        EXPECT_EQ(size, m.size());
+        slot_handle h = m.insert(43);
+        EXPECT_EQ(43, m[h]);
+
+        m.clear();
+    }
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(sparse_set, basic)
+{
+    sparse_set s(100);
+    EXPECT_TRUE(s.empty());
+    EXPECT_TRUE(s.insert(5));
+    EXPECT_TRUE(s.insert(99));
+    EXPECT_TRUE(s.insert(0));
+    EXPECT_FALSE(s.insert(5));
+    EXPECT_EQ(3, s.size());
+
+    EXPECT_TRUE(s.contains(0));
+    EXPECT_FALSE(s.contains(1));
+    EXPECT_FALSE(s.contains(1000));
+    EXPECT_THROW(s.insert(100), std::out_of_range);
+
+    EXPECT_TRUE(s.erase(5));
+    EXPECT_FALSE(s.erase(5));
+    EXPECT_FALSE(s.contains(5));
+    ASSERT_EQ(2, s.size());
+    EXPECT_EQ(99, s[0] + s[1]);
+
+    // После clear устаревшие позиции в sparse_ не должны давать ложных
+    // совпадений.
+    s.clear();
+    EXPECT_TRUE(s.empty());
+    EXPECT_FALSE(s.contains(0));
+    EXPECT_FALSE(s.contains(99));
+    EXPECT_TRUE(s.insert(99));
+    EXPECT_FALSE(s.contains(0));
+    EXPECT_TRUE(s.contains(99));
+
+    s.grow_universe(200);
+    EXPECT_EQ(200, s.universe());
+    EXPECT_TRUE(s.contains(99));
+    EXPECT_TRUE(s.insert(150));
+}
+
+TEST(sparse_set, random_ops)
+{
+    size_t const universe = 1000;
+    sparse_set s(universe);
+    vector<char> expected;
+    for (size_t i = 0; i != universe; ++i)
+        expected.push_back(0);
+
+    vector<uint64_t> keys = random_keys(20000, 11);
+    for (size_t i = 0; i != keys.size(); ++i)
+    {
+        uint32_t id = static_cast<uint32_t>(keys[i] % universe);
+        if (keys[i] % 97 == 0)
+        {
+            s.clear();
+            for (size_t j = 0; j != universe; ++j)
+                expected[j] = 0;
+        }
+        else if (keys[i] / universe % 2 == 0)
+        {
+            ASSERT_EQ(!expected[id], s.insert(id));
+            expected[id] = 1;
+        }
+        else
+        {
+            ASSERT_EQ(!!expected[id], s.erase(id));
+            expected[id] = 0;
+        }
+    }
+
+    size_t count = 0;
+    for (uint32_t id = 0; id != universe; ++id)
+    {
+        ASSERT_EQ(!!expected[id], s.contains(id));
+        count += expected[id];
+    }
+    EXPECT_EQ(count, s.size());
+    for (uint32_t id : s)
+        ASSERT_TRUE(expected[id]);
+}
+
+TEST(tiered_vector, matches_vector)
+{
+    for (size_t capacity = 0; capacity != 9; capacity += 3)
+    {
+        tiered_vector<counted<size_t> > t(capacity);
+        vector<size_t> expected;
+
+        vector<uint64_t> keys = random_keys(4000, 12 + capacity);
+        for (size_t i = 0; i != keys.size(); ++i)
+        {
+            size_t pos = expected.empty() ? 0 : keys[i] / 7 % (expected.size() + 1);
+            if (keys[i] % 5 < 3)
+            {
+                t.insert(pos, i);
+                if (pos == expected.size())
+                    expected.push_back(i);
+                else
+                    expected.insert(expected.begin() + pos, i);
+            }
+            else if (!expected.empty())
+            {
+                pos %= expected.size();
+                t.erase(pos);
+                expected.erase(expected.begin() + pos);
+            }
+        }
+
+        ASSERT_EQ(expected.size(), t.size());
+        for (size_t i = 0; i != expected.size(); ++i)
+            ASSERT_EQ(expected[i], t[i]);
+
+        size_t k = 0;
+        as_const(t).for_each_chunk([&](counted<size_t> const* first, size_t count) {
+            for (size_t i = 0; i != count; ++i, ++k)
+                EXPECT_EQ(expected[k], first[i]);
+        });
+        EXPECT_EQ(expected.size(), k);
+
+        tiered_vector<counted<size_t> > copy(t);
+        t.clear();
+        EXPECT_TRUE(t.empty());
+        ASSERT_EQ(expected.size(), copy.size());
+        EXPECT_EQ(expected.back(), copy.back());
+    }
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(tiered_vector, adaptive_blocks)
+{
+    tiered_vector<uint32_t> t;
+    for (uint32_t i = 0; i != 100000; ++i)
+        t.push_back(i);
+
+    // Размер блока растет вместе с размером: блоков не больше 2 * B.
+    EXPECT_LE(t.block_count(), 2 * t.block_capacity());
+    EXPECT_GE(t.block_capacity(), 128);
+
+    t.insert(50000, 7);
+    t.insert(0, 8);
+    t.erase(100001);
+    EXPECT_EQ(8, t.front());
+    EXPECT_EQ(7, t[50001]);
+    EXPECT_EQ(49999, t[50000]);
+    EXPECT_EQ(50000, t[50002]);
+    EXPECT_EQ(99998, t.back());
+
+    tiered_vector<uint32_t> fixed(100);
+    EXPECT_EQ(128, fixed.block_capacity());
+    fixed.push_back(1);
+    fixed.push_back(fixed[0]);
+    fixed = t;
+    EXPECT_EQ(t.size(), fixed.size());
+    EXPECT_EQ(t.block_capacity(), fixed.block_capacity());
+}
+
+TEST(tiered_vector, push_back_throws)
+{
+    {
+        tiered_vector<counted<size_t> > t(4);
+        for (size_t i = 0; i != 8; ++i)
+            t.push_back(i);
+
+        counted<size_t>::set_throw_countdown(1);
+        EXPECT_THROW(t.push_back(8), std::runtime_error);
+        EXPECT_EQ(8, t.size());
+        EXPECT_EQ(2, t.block_count());
+        EXPECT_EQ(7, t.back());
+    }
+    counted<size_t>::expect_no_instances();
+}
+
+namespace
+{
+    template <typename T>
+    vector<T> rope_contents(rope<T> const& r)
+    {
+        vector<T> result;
+        r.for_each_chunk([&](T const* first, size_t count) {
+            EXPECT_NE(0, count);
+            EXPECT_LE(count, rope<T>::leaf_capacity());
+            for (size_t i = 0; i != count; ++i)
+                result.push_back(first[i]);
+        });
+        return result;
+    }
+
+    template <typename T>
+    bool rope_matches(rope<T> const& r, vector<size_t> const& expected)
+    {
+        vector<T> values = rope_contents(r);
+        return values.size() == expected.size() && std::equal(values.begin(), values.end(), expected.begin());
+    }
+
+    // Высота AVL-дерева из k листьев не больше 1.45 * log2(k + 2).
+    template <typename T>
+    void expect_balanced(rope<T> const& r)
+    {
+        size_t leaves = 0;
+        r.for_each_chunk([&](T const*, size_t) {
+            ++leaves;
+        });
+        EXPECT_LE(r.height(), 1.45 * std::log2(leaves + 2.0) + 1);
+        EXPECT_TRUE(r.balanced());
+    }
+}
+
+template <typename T>
+void rope_random_ops(uint64_t seed)
+{
+    rope<T> r;
+    vector<size_t> expected;
+    vector<rope<T> > versions;
+    vector<vector<size_t> > expected_versions;
+
+    vector<uint64_t> keys = random_keys(20000, seed);
+    for (size_t i = 0; i != keys.size(); ++i)
+    {
+        size_t pos = keys[i] / 11 % (expected.size() + 1);
+        switch (keys[i] % 11)
+        {
+        case 0:
+            if (pos != expected.size())
+            {
+                r.erase(pos);
+                expected.erase(expected.begin() + pos);
+            }
+            break;
+
+        case 1:
+            if (pos != expected.size())
+            {
+                r.set(pos, i);
+                expected[pos] = i;
+            }
+            break;
+
+        case 2:
+            if (i % 50 == 0)
+            {
+                versions.push_back(r);
+                expected_versions.push_back(expected);
+            }
+            break;
+
+        default:
+            r.insert(pos, i);
+            if (pos == expected.size())
+                expected.push_back(i);
+            else
+                expected.insert(expected.begin() + pos, i);
+        }
+        ASSERT_TRUE(r.balanced());
+    }
+
+    ASSERT_EQ(expected.size(), r.size());
+    for (size_t i = 0; i != expected.size(); ++i)
+        ASSERT_EQ(expected[i], r[i]);
+    EXPECT_TRUE(rope_matches(r, expected));
+    expect_balanced(r);
+
+    // Старые версии не изменились.
+    for (size_t v = 0; v != versions.size(); ++v)
+        ASSERT_TRUE(rope_matches(versions[v], expected_versions[v]));
+}
+
+TEST(rope, random_ops)
+{
+    rope_random_ops<uint32_t>(13);
+    rope_random_ops<counted<size_t> >(14);
+    counted<size_t>::expect_no_instances();
+}
+
+TEST(rope, concat_split)
+{
+    vector<size_t> values;
+    for (size_t i = 0; i != 100000; ++i)
+        values.push_back(i);
+
+    rope<size_t> r;
+    r.append(values.begin(), values.end());
+    EXPECT_EQ(values.size(), r.size());
+    expect_balanced(r);
+
+    for (size_t at = 0; at <= values.size(); at += 9973)
+    {
+        rope<size_t> head = r;
+        rope<size_t> tail;
+        head.split(at, tail);
+        ASSERT_EQ(at, head.size());
+        ASSERT_EQ(values.size() - at, tail.size());
+        if (at != 0)
+        {
+            ASSERT_EQ(at - 1, head[at - 1]);
+        }
+        if (at != values.size())
+        {
+            ASSERT_EQ(at, tail[0]);
+        }
+        expect_balanced(head);
+        expect_balanced(tail);
+
+        head.append(tail);
+        ASSERT_TRUE(rope_matches(head, values));
+        expect_balanced(head);
+    }
+    EXPECT_TRUE(rope_matches(r, values));
+
+    // Склейка деревьев сильно разной высоты и с самой собой.
+    rope<size_t> small;
+    small.push_back(7);
+    small.append(r);
+    small.append(small);
+    EXPECT_EQ(2 * (values.size() + 1), small.size());
+    EXPECT_EQ(7, small[values.size() + 1]);
+    EXPECT_EQ(values.size() - 1, small[small.size() - 1]);
+}
+
+template <typename T>
+void rope_erase_keeps_leaves_full(uint64_t seed)
+{
+    size_t const capacity = rope<T>::leaf_capacity();
+    vector<size_t> expected;
+    for (size_t i = 0; i != 16 * capacity; ++i)
+        expected.push_back(i);
+
+    rope<T> r;
+    r.append(expected.begin(), expected.end());
+    rope<T> saved = r;
+
+    vector<uint64_t> keys = random_keys(expected.size() - 100, seed);
+    for (size_t k = 0; k != keys.size(); ++k)
+    {
+        size_t pos = keys[k] % expected.size();
+        r.erase(pos);
+        expected.erase(expected.begin() + pos);
+        ASSERT_TRUE(r.balanced());
+
+        if (k % 1000 == 0)
+            saved = r;
+    }
+
+    ASSERT_TRUE(rope_matches(r, expected));
+    expect_balanced(r);
+
+    size_t leaves = 0;
+    size_t smallest = capacity;
+    r.for_each_chunk([&](T const*, size_t count) {
+        ++leaves;
+        smallest = std::min(smallest, count);
+    });
+    if (leaves > 1)
+    {
+        EXPECT_GE(smallest, capacity / 4);
+    }
+    EXPECT_LE(leaves, expected.size() / (capacity / 4) + 1);
+}
+
+// Без слияния каждый лист после случайных удалений остался бы почти пустым.
+TEST(rope, erase_merges_leaves)
+{
+    rope_erase_keeps_leaves_full<uint32_t>(15);
+    rope_erase_keeps_leaves_full<counted<size_t> >(16);
+    counted<size_t>::expect_no_instances();
+}
+
+namespace
+{
+    rope<size_t> rope_of_leaves(size_t leaves, size_t leaf_size)
+    {
+        rope<size_t> r;
+        for (size_t k = 0; k != leaves; ++k)
+        {
+            rope<size_t> leaf;
+            for (size_t i = 0; i != leaf_size; ++i)
+                leaf.push_back(i);
+            r.append(leaf);
+        }
+        return r;
+    }
+}
+
+// Слияние трех недозаполненных листьев в один делает поддерево высоты 3
+// листом, а его сосед имеет высоту 4.
+TEST(rope, erase_merge_keeps_avl)
+{
+    size_t const capacity = rope<size_t>::leaf_capacity();
+    size_t const small = capacity / 4;
+    size_t const large = capacity * 3 / 5;
+
+    rope<size_t> tall = rope_of_leaves(2, large);
+    rope<size_t> tall_right = rope_of_leaves(2, large);
+    tall.append(tall_right);
+    tall_right = tall;
+    tall.append(tall_right);
+    ASSERT_EQ(4, tall.height());
+
+    rope<size_t> front = rope_of_leaves(1, large);
+    front.append(rope_of_leaves(2, large));
+    ASSERT_EQ(3, front.height());
+    front.append(tall);
+    ASSERT_EQ(5, front.height());
+    for (size_t k = 0; k != 3; ++k)
+        for (size_t i = small; i != large; ++i)
+            front.erase(k * small);
+    ASSERT_TRUE(front.balanced());
+    front.erase(0);
+    EXPECT_TRUE(front.balanced());
+    EXPECT_EQ(tall.size() + 3 * small - 1, front.size());
+
+    rope<size_t> back = rope_of_leaves(2, large);
+    back.append(rope_of_leaves(1, large));
+    ASSERT_EQ(3, back.height());
+    tall.append(back);
+    ASSERT_EQ(5, tall.height());
+    size_t first = tall.size() - 3 * large;
+    for (size_t k = 0; k != 3; ++k)
+        for (size_t i = small; i != large; ++i)
+            tall.erase(first + k * small);
+    ASSERT_TRUE(tall.balanced());
+    tall.erase(tall.size() - 1);
+    EXPECT_TRUE(tall.balanced());
+    EXPECT_EQ(front.size(), tall.size());
+}
+
+TEST(rope, copy_throws)
+{
+    {
+        rope<counted<size_t> > r;
+        for (size_t i = 0; i != 1000; ++i)
+            r.push_back(i);
+        rope<counted<size_t> > copy = r;
+
+        for (size_t countdown = 1; countdown != 5; ++countdown)
+        {
+            counted<size_t>::set_throw_countdown(countdown);
+            EXPECT_THROW(r.insert(500, 1), std::runtime_error);
+            counted<size_t>::set_throw_countdown(countdown);
+            EXPECT_THROW(r.erase(10), std::runtime_error);
+            counted<size_t>::set_throw_countdown(countdown);
+            EXPECT_THROW(r.set(999, 1), std::runtime_error);
+        }
+        counted<size_t>::set_throw_countdown(0);
+
+        ASSERT_EQ(1000, r.size());
+        for (size_t i = 0; i != r.size(); ++i)
+            ASSERT_EQ(i, r[i]);
+    }
+    counted<size_t>::expect_no_instances();
+}
@@ -0,0 +1,533 @@
+#ifndef NPY_H
+#define NPY_H
+
+#include "vector.h"
+#include "vector_io.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+Файлы NumPy (.npy) и сырые дампы как векторы только для чтения.
+
+npy_view и raw_view отображают файл в память (mmap) и отдают его данные
+без копирования: data(), size(), begin() и end() работают как у vector<T>,
+а страницы читаются с диска при первом обращении.
+
+Заголовок .npy -- это словарь Python вида
+{'descr': '<f8', 'fortran_order': False, 'shape': (3, 4), }. npy_view
+проверяет, что тип элементов совпадает с T (вид, размер и порядок байт
+машины), что массив лежит по строкам (fortran_order допускается только
+для одномерных массивов, где он ничего не меняет) и что файл не короче,
+чем требует shape. Структурные типы и объекты Python не поддерживаются.
+
+raw_view считает элементами весь файл начиная со смещения offset; в нем
+нет заголовка, поэтому порядок байт должен совпадать с машинным.
+
+write_npy пишет вектор в формате .npy версии 1.0 (или 2.0, если
+заголовок не помещается в 64 КБ) с заголовком, выровненным на 64 байта,
+как это делает сам NumPy.
+*/
+
+namespace npy_detail
+{
+    char const magic[6] = {'\x93', 'N', 'U', 'M', 'P', 'Y'};
+    size_t const header_alignment = 64;
+
+    inline bool little_endian()
+    {
+        uint16_t x = 1;
+        unsigned char first;
+        memcpy(&first, &x, 1);
+        return first == 1;
+    }
+
+    template <typename T>
+    std::string descr()
+    {
+        static_assert(std::is_arithmetic<T>::value,
+                      "npy supports only arithmetic element types");
+
+        char kind = std::is_same<T, bool>::value ? 'b'
+                  : std::is_floating_point<T>::value ? 'f'
+                  : std::is_signed<T>::value ? 'i' : 'u';
+        char order = sizeof(T) == 1 ? '|' : little_endian() ? '<' : '>';
+        return std::string(1, order) + kind + std::to_string(sizeof(T));
+    }
+
+    // Отображение файла целиком; пустой файл не отображается.
+    struct mapping
+    {
+        explicit mapping(std::string const& path)
+            : data_(nullptr)
+            , size_(0)
+        {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd == -1)
+                vector_io_detail::throw_io_error("open", path);
+
+            struct stat st;
+            if (fstat(fd, &st) != 0)
+            {
+                int error = errno;
+                close(fd);
+                errno = error;
+                vector_io_detail::throw_io_error("fstat", path);
+            }
+
+            size_ = static_cast<size_t>(st.st_size);
+            if (size_ != 0)
+            {
+                void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                int error = errno;
+                close(fd);
+                if (p == MAP_FAILED)
+                {
+                    errno = error;
+                    vector_io_detail::throw_io_error("mmap", path);
+                }
+                data_ = static_cast<char const*>(p);
+            }
+            else
+            {
+                close(fd);
+            }
+        }
+
+        ~mapping()
+        {
+            if (data_ != nullptr)
+                munmap(const_cast<char*>(data_), size_);
+        }
+
+        char const* data() const
+        {
+            return data_;
+        }
+
+        size_t size() const
+        {
+            return size_;
+        }
+
+    private:
+        mapping(mapping const&);
+        mapping& operator=(mapping const&);
+
+    private:
+        char const* data_;
+        size_t size_;
+    };
+
+    inline void throw_format_error(std::string const& path, std::string const& what)
+    {
+        throw std::runtime_error("npy: " + path + ": " + what);
+    }
+
+    // Разбор словаря заголовка. Значения ищутся по ключам, поэтому порядок
+    // ключей и пробелы не важны.
+    struct header
+    {
+        std::string descr;
+        bool fortran_order;
+        vector<size_t> shape;
+    };
+
+    // Число элементов массива формы shape. Возвращает false, если оно не
+    // помещается в size_t; массив с нулевой размерностью пуст, какими бы
+    // большими ни были остальные.
+    inline bool element_count(vector<size_t> const& shape, size_t& count)
+    {
+        count = 1;
+        for (size_t i = 0; i != shape.size(); ++i)
+            if (shape[i] == 0)
+            {
+                count = 0;
+                return true;
+            }
+
+        for (size_t i = 0; i != shape.size(); ++i)
+        {
+            if (count > std::numeric_limits<size_t>::max() / shape[i])
+                return false;
+            count *= shape[i];
+        }
+        return true;
+    }
+
+    inline size_t find_value(std::string const& dict, char const* key)
+    {
+        std::string quoted = std::string("'") + key + "'";
+        size_t pos = dict.find(quoted);
+        if (pos == std::string::npos)
+            return std::string::npos;
+        pos = dict.find(':', pos + quoted.size());
+        if (pos == std::string::npos)
+            return std::string::npos;
+        return dict.find_first_not_of(" ", pos + 1);
+    }
+
+    inline header parse_header(std::string const& dict, std::string const& path)
+    {
+        header result;
+
+        size_t pos = find_value(dict, "descr");
+        if (pos == std::string::npos || (dict[pos] != '\'' && dict[pos] != '"'))
+            throw_format_error(path, "descr is missing or is not a simple type");
+        size_t end = dict.find(dict[pos], pos + 1);
+        if (end == std::string::npos)
+            throw_format_error(path, "malformed descr");
+        result.descr = dict.substr(pos + 1, end - pos - 1);
+
+        pos = find_value(dict, "fortran_order");
+        if (pos != std::string::npos && dict.compare(pos, 4, "True") == 0)
+            result.fortran_order = true;
+        else if (pos != std::string::npos && dict.compare(pos, 5, "False") == 0)
+            result.fortran_order = false;
+        else
+            throw_format_error(path, "malformed fortran_order");
+
+        pos = find_value(dict, "shape");
+        if (pos == std::string::npos || dict[pos] != '(')
+            throw_format_error(path, "malformed shape");
+        end = dict.find(')', pos);
+        if (end == std::string::npos)
+            throw_format_error(path, "malformed shape");
+
+        for (++pos; pos < end; )
+        {
+            pos = dict.find_first_not_of(" ,", pos);
+            if (pos >= end)
+                break;
+
+            size_t dim = 0;
+            size_t digits = 0;
+            for (; pos < end && dict[pos] >= '0' && dict[pos] <= '9'; ++pos, ++digits)
+            {
+                size_t digit = dict[pos] - '0';
+                if (dim > (std::numeric_limits<size_t>::max() - digit) / 10)
+                    throw_format_error(path, "shape is too large");
+                dim = dim * 10 + digit;
+            }
+            if (digits == 0)
+                throw_format_error(path, "malformed shape");
+            result.shape.push_back(dim);
+        }
+
+        return result;
+    }
+
+    // Проверяет, что тип из файла совпадает с T. Порядок байт может быть
+    // указан как '=' (машинный), а у однобайтных типов он не важен.
+    template <typename T>
+    bool descr_matches(std::string const& descr)
+    {
+        std::string expected = npy_detail::descr<T>();
+        if (descr == expected)
+            return true;
+        if (descr.size() != expected.size())
+            return false;
+        if (descr.compare(1, std::string::npos, expected, 1, std::string::npos) != 0)
+            return false;
+        return descr[0] == '=' || expected[0] == '|';
+    }
+}
+
+template <typename T>
+struct npy_view
+{
+    typedef T value_type;
+    typedef T const* const_iterator;
+
+    explicit npy_view(std::string const& path);
+
+    T const& operator[](size_t i) const;
+    T const* data() const;
+
+    size_t size() const;
+    bool empty() const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    vector<size_t> const& shape() const;
+    bool fortran_order() const;
+
+private:
+    npy_view(npy_view const&);
+    npy_view& operator=(npy_view const&);
+
+private:
+    npy_detail::mapping map_;
+    T const* data_;
+    size_t size_;
+    vector<size_t> shape_;
+    bool fortran_order_;
+};
+
+template <typename T>
+struct raw_view
+{
+    typedef T value_type;
+    typedef T const* const_iterator;
+
+    // Элементы начинаются со смещения offset и идут до конца файла.
+    explicit raw_view(std::string const& path, size_t offset = 0);
+
+    T const& operator[](size_t i) const;
+    T const* data() const;
+
+    size_t size() const;
+    bool empty() const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+private:
+    raw_view(raw_view const&);
+    raw_view& operator=(raw_view const&);
+
+private:
+    npy_detail::mapping map_;
+    T const* data_;
+    size_t size_;
+};
+
+template <typename T>
+npy_view<T>::npy_view(std::string const& path)
+    : map_(path)
+    , data_(nullptr)
+    , size_(0)
+    , fortran_order_(false)
+{
+    char const* p = map_.data();
+    size_t bytes = map_.size();
+
+    if (bytes < 10 || memcmp(p, npy_detail::magic, sizeof npy_detail::magic) != 0)
+        npy_detail::throw_format_error(path, "not an npy file");
+
+    unsigned char major = p[6];
+    size_t prefix;
+    size_t header_len;
+    if (major == 1)
+    {
+        prefix = 10;
+        header_len = static_cast<unsigned char>(p[8])
+                   | static_cast<size_t>(static_cast<unsigned char>(p[9])) << 8;
+    }
+    else if (major == 2 || major == 3)
+    {
+        prefix = 12;
+        if (bytes < prefix)
+            npy_detail::throw_format_error(path, "truncated header");
+        header_len = 0;
+        for (int i = 3; i >= 0; --i)
+            header_len = header_len << 8 | static_cast<unsigned char>(p[8 + i]);
+    }
+    else
+    {
+        npy_detail::throw_format_error(path, "unsupported format version");
+    }
+
+    size_t offset = prefix + header_len;
+    if (offset > bytes)
+        npy_detail::throw_format_error(path, "truncated header");
+
+    npy_detail::header h = npy_detail::parse_header(std::string(p + prefix, header_len), path);
+
+    if (!npy_detail::descr_matches<T>(h.descr))
+        npy_detail::throw_format_error(path, "dtype " + h.descr + " does not match "
+                                             + npy_detail::descr<T>());
+    if (h.fortran_order && h.shape.size() > 1)
+        npy_detail::throw_format_error(path, "fortran order arrays are not supported");
+    if (offset % alignof(T) != 0)
+        npy_detail::throw_format_error(path, "data is not aligned");
+
+    size_t count;
+    if (!npy_detail::element_count(h.shape, count))
+        npy_detail::throw_format_error(path, "shape is too large");
+    if (count > (bytes - offset) / sizeof(T))
+        npy_detail::throw_format_error(path, "file is shorter than its shape");
+
+    data_ = reinterpret_cast<T const*>(p + offset);
+    size_ = count;
+    shape_.swap(h.shape);
+    fortran_order_ = h.fortran_order;
+}
+
+template <typename T>
+T const& npy_view<T>::operator[](size_t i) const
+{
+    return data_[i];
+}
+
+template <typename T>
+T const* npy_view<T>::data() const
+{
+    return data_;
+}
+
+template <typename T>
+size_t npy_view<T>::size() const
+{
+    return size_;
+}
+
+template <typename T>
+bool npy_view<T>::empty() const
+{
+    return size_ == 0;
+}
+
+template <typename T>
+typename npy_view<T>::const_iterator npy_view<T>::begin() const
+{
+    return data_;
+}
+
+template <typename T>
+typename npy_view<T>::const_iterator npy_view<T>::end() const
+{
+    return data_ + size_;
+}
+
+template <typename T>
+vector<size_t> const& npy_view<T>::shape() const
+{
+    return shape_;
+}
+
+template <typename T>
+bool npy_view<T>::fortran_order() const
+{
+    return fortran_order_;
+}
+
+template <typename T>
+raw_view<T>::raw_view(std::string const& path, size_t offset)
+    : map_(path)
+    , data_(nullptr)
+    , size_(0)
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "raw_view reads elements as raw bytes");
+
+    if (offset > map_.size() || (map_.size() - offset) % sizeof(T) != 0)
+        npy_detail::throw_format_error(path, "size is not a multiple of the element size");
+    if (offset % alignof(T) != 0)
+        npy_detail::throw_format_error(path, "data is not aligned");
+
+    data_ = reinterpret_cast<T const*>(map_.data() + offset);
+    size_ = (map_.size() - offset) / sizeof(T);
+}
+
+template <typename T>
+T const& raw_view<T>::operator[](size_t i) const
+{
+    return data_[i];
+}
+
+template <typename T>
+T const* raw_view<T>::data() const
+{
+    return data_;
+}
+
+template <typename T>
+size_t raw_view<T>::size() const
+{
+    return size_;
+}
+
+template <typename T>
+bool raw_view<T>::empty() const
+{
+    return size_ == 0;
+}
+
+template <typename T>
+typename raw_view<T>::const_iterator raw_view<T>::begin() const
+{
+    return data_;
+}
+
+template <typename T>
+typename raw_view<T>::const_iterator raw_view<T>::end() const
+{
+    return data_ + size_;
+}
+
+// shape задает размерности массива по строкам; их произведение должно
+// равняться v.size().
+template <typename T, typename Alloc, typename SizeT>
+void write_npy(std::string const& path, vector<T, Alloc, SizeT> const& v, vector<size_t> const& shape)
+{
+    size_t count;
+    if (!npy_detail::element_count(shape, count) || count != v.size())
+        throw std::invalid_argument("write_npy: shape does not match the vector size");
+
+    std::string dims;
+    for (size_t i = 0; i != shape.size(); ++i)
+    {
+        if (i != 0)
+            dims += ", ";
+        dims += std::to_string(shape[i]);
+    }
+    if (shape.size() == 1)
+        dims += ",";   // кортеж из одного элемента в Python: (3,)
+
+    std::string dict = "{'descr': '" + npy_detail::descr<T>()
+                     + "', 'fortran_order': False, 'shape': (" + dims + "), }";
+
+    // Заголовок дополняется пробелами и '\n' до границы header_alignment.
+    bool large = dict.size() + 1 + 10 > 0xffff;
+    size_t prefix = large ? 12 : 10;
+    size_t total = (prefix + dict.size() + 1 + npy_detail::header_alignment - 1)
+                 / npy_detail::header_alignment * npy_detail::header_alignment;
+    dict.append(total - prefix - dict.size() - 1, ' ');
+    dict += '\n';
+
+    std::string head(npy_detail::magic, sizeof npy_detail::magic);
+    head += static_cast<char>(large ? 2 : 1);
+    head += '\0';
+    size_t header_len = dict.size();
+    for (size_t i = 0; i != prefix - 8; ++i)
+        head += static_cast<char>(header_len >> (8 * i) & 0xff);
+    head += dict;
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+        vector_io_detail::throw_io_error("fopen", path);
+
+    if (fwrite(head.data(), 1, head.size(), file) != head.size()
+        || (v.size() != 0 && fwrite(v.data(), sizeof(T), v.size(), file) != v.size()))
+    {
+        int error = errno;
+        fclose(file);
+        errno = error;
+        vector_io_detail::throw_io_error("fwrite", path);
+    }
+
+    if (fclose(file) != 0)
+        vector_io_detail::throw_io_error("fclose", path);
+}
+
+template <typename T, typename Alloc, typename SizeT>
+void write_npy(std::string const& path, vector<T, Alloc, SizeT> const& v)
+{
+    vector<size_t> shape;
+    shape.push_back(v.size());
+    write_npy(path, v, shape);
+}
+
+#endif // NPY_H
@@ -0,0 +1,463 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include "vector.h"
+#include "page.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <new>
+#include <thread>
+
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+Размещение памяти вектора по NUMA-узлам.
+
+Политика задается системными вызовами mbind (для диапазона адресов) и
+set_mempolicy (для текущего потока) напрямую, без зависимости от libnuma.
+Политика применяется в момент первого обращения к странице, поэтому
+буфер выделяется через mmap: страницы еще не тронуты и ни одна из них не
+делится с чужими аллокациями.
+
+Если ядро не поддерживает NUMA или вызов запрещен, функции возвращают
+false, а память остается обычной. Для аллокатора это только подсказка.
+
+numa_set_thread_policy задает политику для всех будущих выделений
+текущего потока, в том числе обычным heap_allocator: например, рабочий
+поток, заполняющий свой вектор, может привязать его к своему узлу.
+*/
+
+enum class numa_mode
+{
+    local,
+    interleave,
+    bind
+};
+
+struct numa_policy
+{
+    numa_mode mode;
+    int node;
+
+    static numa_policy local()
+    {
+        numa_policy result = {numa_mode::local, 0};
+        return result;
+    }
+
+    static numa_policy interleave()
+    {
+        numa_policy result = {numa_mode::interleave, 0};
+        return result;
+    }
+
+    static numa_policy bind(int node)
+    {
+        numa_policy result = {numa_mode::bind, node};
+        return result;
+    }
+};
+
+namespace numa_detail
+{
+    // Значения из <linux/mempolicy.h>.
+    int const mpol_preferred  = 1;
+    int const mpol_bind       = 2;
+    int const mpol_interleave = 3;
+    int const mpol_local      = 4;
+
+    size_t const max_nodes = 1024;
+    size_t const bits_per_word = sizeof(unsigned long) * 8;
+
+    struct nodemask
+    {
+        unsigned long bits[max_nodes / bits_per_word];
+
+        nodemask()
+        {
+            std::fill(bits, bits + max_nodes / bits_per_word, 0ul);
+        }
+
+        void set(size_t node)
+        {
+            if (node < max_nodes)
+                bits[node / bits_per_word] |= 1ul << (node % bits_per_word);
+        }
+    };
+
+    // Разбирает списки из sysfs вида "0" или "0-1,3" и вызывает f(i) для
+    // каждого числа. Возвращает false, если файла нет.
+    template <typename F>
+    bool parse_list(char const* path, F f)
+    {
+        FILE* file = fopen(path, "r");
+        if (file == nullptr)
+            return false;
+
+        unsigned first, last;
+        for (;;)
+        {
+            if (fscanf(file, "%u", &first) != 1)
+                break;
+
+            last = first;
+            int c = fgetc(file);
+            if (c == '-')
+            {
+                if (fscanf(file, "%u", &last) != 1)
+                    break;
+                c = fgetc(file);
+            }
+
+            for (unsigned i = first; i <= last; ++i)
+                f(i);
+
+            if (c != ',')
+                break;
+        }
+
+        fclose(file);
+        return true;
+    }
+
+    inline nodemask online_nodes()
+    {
+        nodemask result;
+        if (!parse_list("/sys/devices/system/node/online", [&](unsigned node) { result.set(node); }))
+            result.set(0);
+        return result;
+    }
+
+    // Процессоры по порядку узлов: сначала все процессоры узла 0, затем
+    // узла 1 и т.д. Без sysfs -- просто по номерам.
+    inline vector<int> load_cpus_by_node()
+    {
+        vector<int> result;
+        parse_list("/sys/devices/system/node/online", [&](unsigned node) {
+            char path[64];
+            snprintf(path, sizeof path, "/sys/devices/system/node/node%u/cpulist", node);
+            parse_list(path, [&](unsigned cpu) {
+                if (cpu < CPU_SETSIZE)
+                    result.push_back(static_cast<int>(cpu));
+            });
+        });
+
+        if (result.empty())
+            for (int cpu = 0; cpu != CPU_SETSIZE; ++cpu)
+                result.push_back(cpu);
+        return result;
+    }
+
+    inline vector<int> const& cpus_by_node()
+    {
+        static vector<int> const result = load_cpus_by_node();
+        return result;
+    }
+
+    inline bool pin_thread(int cpu)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return sched_setaffinity(0, sizeof set, &set) == 0;
+    }
+
+    inline int to_mode(numa_policy policy, nodemask& mask)
+    {
+        switch (policy.mode)
+        {
+        case numa_mode::interleave:
+            mask = online_nodes();
+            return mpol_interleave;
+        case numa_mode::bind:
+            mask.set(policy.node);
+            return mpol_bind;
+        default:
+            return mpol_local;
+        }
+    }
+
+    // Ядро отбрасывает последний бит maxnode, поэтому передаем на один больше.
+    inline long mbind(void* addr, size_t len, int mode, nodemask const* mask)
+    {
+        return syscall(SYS_mbind, addr, len, mode,
+                       mask ? mask->bits : nullptr,
+                       mask ? max_nodes + 1 : 0, 0u);
+    }
+
+    inline long set_mempolicy(int mode, nodemask const* mask)
+    {
+        return syscall(SYS_set_mempolicy, mode,
+                       mask ? mask->bits : nullptr,
+                       mask ? max_nodes + 1 : 0);
+    }
+}
+
+// addr должен быть выровнен на границу страницы.
+inline bool numa_apply(void* addr, size_t bytes, numa_policy policy)
+{
+    using namespace numa_detail;
+
+    nodemask mask;
+    int mode = to_mode(policy, mask);
+    bytes = round_to_pages(bytes);
+
+    if (mode == mpol_local)
+    {
+        // MPOL_LOCAL появился в Linux 3.8, до этого локальное размещение
+        // задавалось как MPOL_PREFERRED с пустой маской.
+        if (mbind(addr, bytes, mpol_local, nullptr) == 0)
+            return true;
+        return mbind(addr, bytes, mpol_preferred, nullptr) == 0;
+    }
+
+    return mbind(addr, bytes, mode, &mask) == 0;
+}
+
+inline bool numa_set_thread_policy(numa_policy policy)
+{
+    using namespace numa_detail;
+
+    nodemask mask;
+    int mode = to_mode(policy, mask);
+
+    if (mode == mpol_local)
+    {
+        if (set_mempolicy(mpol_local, nullptr) == 0)
+            return true;
+        return set_mempolicy(mpol_preferred, nullptr) == 0;
+    }
+
+    return set_mempolicy(mode, &mask) == 0;
+}
+
+template <typename T, numa_mode Mode = numa_mode::local, int Node = 0>
+struct numa_allocator
+{
+    static T* allocate(size_t n)
+    {
+        void* p = map_pages(n * sizeof(T));
+
+        numa_policy policy = {Mode, Node};
+        numa_apply(p, n * sizeof(T), policy);
+        return static_cast<T*>(p);
+    }
+
+    static void deallocate(T* p, size_t n)
+    {
+        unmap_pages(p, n * sizeof(T));
+    }
+};
+
+/*
+Параллельная инициализация "первым касанием".
+
+Страница попадает на узел того потока, который первым к ней обратился.
+Поэтому если потоки потом обрабатывают вектор статическими кусками,
+инициализировать его нужно теми же потоками и теми же кусками. Куски
+задает parallel_chunk, а процессоры потоков -- run_pinned, и читатели
+должны пользоваться ими же с тем же числом потоков.
+*/
+
+struct chunk_range
+{
+    size_t first;
+    size_t last;
+};
+
+inline chunk_range parallel_chunk(size_t n, size_t threads, size_t i)
+{
+    size_t base = n / threads;
+    size_t extra = n % threads;
+
+    chunk_range result;
+    result.first = base * i + std::min(i, extra);
+    result.last = result.first + base + (i < extra ? 1 : 0);
+    return result;
+}
+
+inline size_t default_thread_count(size_t threads)
+{
+    if (threads != 0)
+        return threads;
+
+    size_t hw = std::thread::hardware_concurrency();
+    return hw != 0 ? hw : 1;
+}
+
+/*
+Процессор для каждого из threads потоков: разрешенные текущему потоку
+процессоры в порядке узлов, поделенные между потоками поровну. Соседние
+куски parallel_chunk попадают на процессоры одного узла, а поток i при
+одном и том же threads всегда попадает на один и тот же процессор.
+Пустой результат -- узнать разрешенные процессоры не удалось.
+*/
+inline vector<int> worker_cpus(size_t threads)
+{
+    vector<int> allowed;
+    cpu_set_t mask;
+    if (sched_getaffinity(0, sizeof mask, &mask) == 0)
+    {
+        vector<int> const& cpus = numa_detail::cpus_by_node();
+        for (size_t i = 0; i != cpus.size(); ++i)
+            if (CPU_ISSET(cpus[i], &mask))
+                allowed.push_back(cpus[i]);
+    }
+
+    vector<int> result;
+    if (!allowed.empty())
+        for (size_t i = 0; i != threads; ++i)
+            result.push_back(allowed[i * allowed.size() / threads]);
+    return result;
+}
+
+namespace numa_detail
+{
+    // Поток i закрепляется за процессором cpus[i], если cpus не пуст.
+    template <typename F>
+    void run_threads(size_t threads, F f, vector<int> const& cpus)
+    {
+        std::unique_ptr<std::thread[]> workers(new std::thread[threads]);
+
+        size_t spawned = 1;
+        try
+        {
+            for (; spawned < threads; ++spawned)
+            {
+                int cpu = cpus.empty() ? -1 : cpus[spawned];
+                workers[spawned] = std::thread([f, cpu](size_t i) mutable {
+                    if (cpu != -1)
+                        pin_thread(cpu);
+                    f(i);
+                }, spawned);
+            }
+        }
+        catch (...)
+        {}
+
+        cpu_set_t saved;
+        bool pinned = !cpus.empty() && sched_getaffinity(0, sizeof saved, &saved) == 0
+                   && pin_thread(cpus[0]);
+
+        for (size_t i = spawned; i < threads; ++i)
+            f(i);
+
+        f(0);
+
+        if (pinned)
+            sched_setaffinity(0, sizeof saved, &saved);
+
+        for (size_t i = 1; i < spawned; ++i)
+            workers[i].join();
+    }
+}
+
+/*
+Вызывает f(i) для i из [0, threads), i == 0 выполняется в текущем потоке.
+f не должна бросать исключений. Если поток создать не удалось, его кусок
+выполняется в текущем потоке. Потоки ни за какими процессорами не
+закрепляются.
+*/
+template <typename F>
+void run_parallel(size_t threads, F f)
+{
+    numa_detail::run_threads(threads, f, vector<int>());
+}
+
+/*
+То же, но поток i закрепляется за процессором worker_cpus(threads)[i],
+текущий поток -- на время вызова, потом его маска восстанавливается. Без
+этого поток, первым коснувшийся страницы в first_touch_reserve, и поток,
+который потом читает тот же кусок, могли бы оказаться на разных узлах.
+Закрепление -- только подсказка: если оно не удалось, f все равно
+вызывается. Единственный поток не закрепляется: он и так касается всех
+страниц сам.
+*/
+template <typename F>
+void run_pinned(size_t threads, F f)
+{
+    if (threads == 1)
+        f(0);
+    else
+        numa_detail::run_threads(threads, f, worker_cpus(threads));
+}
+
+template <typename T, typename Alloc, typename SizeT>
+void first_touch_reserve(vector<T, Alloc, SizeT>& v, size_t n, size_t threads = 0)
+{
+    threads = default_thread_count(threads);
+    v.reserve(n);
+
+    char* base = reinterpret_cast<char*>(v.data());
+    size_t used = v.size() * sizeof(T);
+    size_t page = page_size();
+
+    run_pinned(threads, [=](size_t i) {
+        chunk_range r = parallel_chunk(n, threads, i);
+        size_t first = std::max(r.first * sizeof(T), used);
+        size_t last = r.last * sizeof(T);
+        // Пишем в неинициализированный хвост, живые элементы не трогаем.
+        for (size_t off = first; off < last; off = (off / page + 1) * page)
+            base[off] = 0;
+    });
+}
+
+template <typename T, typename Alloc, typename SizeT>
+void parallel_resize(vector<T, Alloc, SizeT>& v, size_t n, T const& val, size_t threads = 0)
+{
+    while (v.size() > n)
+        v.pop_back();
+
+    if (v.size() == n)
+        return;
+
+    threads = default_thread_count(threads);
+    size_t old_size = v.size();
+
+    v.append_construct(n - old_size, [&](T* dst, size_t) {
+        T* base = dst - old_size;
+        std::unique_ptr<std::exception_ptr[]> errors(new std::exception_ptr[threads]);
+
+        run_pinned(threads, [&](size_t i) {
+            chunk_range r = parallel_chunk(n, threads, i);
+            size_t j = std::max(r.first, old_size);
+            size_t first = j;
+            try
+            {
+                for (; j < r.last; ++j)
+                    new (base + j) T(val);
+            }
+            catch (...)
+            {
+                destroy_all(base + first, j - first);
+                errors[i] = std::current_exception();
+            }
+        });
+
+        std::exception_ptr error;
+        for (size_t i = 0; i != threads; ++i)
+            if (errors[i])
+                error = errors[i];
+
+        if (!error)
+            return;
+
+        for (size_t i = 0; i != threads; ++i)
+        {
+            if (errors[i])
+                continue;
+            chunk_range r = parallel_chunk(n, threads, i);
+            size_t first = std::max(r.first, old_size);
+            if (first < r.last)
+                destroy_all(base + first, r.last - first);
+        }
+        std::rethrow_exception(error);
+    });
+}
+
+#endif // NUMA_H
@@ -0,0 +1,38 @@
+#ifndef PAGE_H
+#define PAGE_H
+
+#include <cstddef>
+#include <new>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+inline size_t page_size()
+{
+    static size_t const value = sysconf(_SC_PAGESIZE);
+    return value;
+}
+
+inline size_t round_to_pages(size_t bytes)
+{
+    size_t page = page_size();
+    return (bytes + page - 1) / page * page;
+}
+
+// Анонимная память прямо из mmap: выровнена на страницу, ее страницы
+// ни с кем не делятся и до первого обращения не занимают физической памяти.
+inline void* map_pages(size_t bytes, int extra_flags = 0)
+{
+    void* p = mmap(nullptr, round_to_pages(bytes), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | extra_flags, -1, 0);
+    if (p == MAP_FAILED)
+        throw std::bad_alloc();
+    return p;
+}
+
+inline void unmap_pages(void* p, size_t bytes)
+{
+    munmap(p, round_to_pages(bytes));
+}
+
+#endif // PAGE_H
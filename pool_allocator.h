@@ -0,0 +1,347 @@
+#ifndef POOL_ALLOCATOR_H
+#define POOL_ALLOCATOR_H
+
+#include "vector.h"
+
+#include <atomic>
+#include <mutex>
+#include <new>
+
+/*
+Пул буферов для векторов.
+
+Размеры округляются вверх до степени двойки от min_class_bytes до
+max_class_bytes, блоки большего размера идут напрямую в operator new.
+Каждый поток держит свой кэш свободных блоков по классам и обращается к
+общему списку класса только пачками по batch_size блоков: когда кэш пуст
+или когда в нем накопилось больше 2 * batch_size блоков. Поэтому в
+установившемся режиме allocate и deallocate не берут никаких блокировок.
+
+Блоки никогда не возвращаются системе: память, освобожденная в пул, будет
+переиспользована следующими векторами того же класса. Общие списки
+нарочно не разрушаются при завершении программы, чтобы вектора в
+статических объектах могли освобождаться в любом порядке.
+
+Статистика собирается в кэше потока и сбрасывается в общие счетчики при
+обмене пачками и при завершении потока, поэтому может немного отставать.
+*/
+
+struct pool_stats
+{
+    size_t allocations;
+    size_t deallocations;
+    size_t cache_hits;
+    size_t central_fetches;
+    size_t central_returns;
+    size_t system_allocations;
+};
+
+struct buffer_pool
+{
+    static size_t const min_class_shift = 5;
+    static size_t const min_class_bytes = size_t(1) << min_class_shift;
+    static size_t const max_class_bytes = 1 << 20;
+    static size_t const class_count = 16;
+    static size_t const batch_size = 32;
+
+    static void* allocate(size_t bytes);
+    static void deallocate(void* p, size_t bytes);
+
+    static pool_stats stats();
+
+    // Отдает блоки кэша текущего потока в общие списки.
+    static void release_thread_cache();
+
+private:
+    struct block
+    {
+        block* next;
+    };
+
+    struct central_list
+    {
+        std::mutex mutex;
+        block* head;
+        size_t count;
+
+        central_list()
+            : head(nullptr)
+            , count(0)
+        {}
+    };
+
+    struct central_state
+    {
+        central_list lists[class_count];
+
+        std::atomic<size_t> allocations;
+        std::atomic<size_t> deallocations;
+        std::atomic<size_t> cache_hits;
+        std::atomic<size_t> central_fetches;
+        std::atomic<size_t> central_returns;
+        std::atomic<size_t> system_allocations;
+
+        central_state()
+            : allocations(0)
+            , deallocations(0)
+            , cache_hits(0)
+            , central_fetches(0)
+            , central_returns(0)
+            , system_allocations(0)
+        {}
+    };
+
+    struct thread_cache
+    {
+        block* heads[class_count];
+        size_t counts[class_count];
+
+        size_t allocations;
+        size_t deallocations;
+        size_t cache_hits;
+
+        thread_cache();
+        ~thread_cache();
+
+        void flush_stats();
+    };
+
+    static size_t class_of(size_t bytes);
+    static size_t class_bytes(size_t index);
+
+    static central_state& central();
+    static thread_cache* cache();
+    static bool& cache_destroyed();
+
+    static void fetch_batch(thread_cache& c, size_t index);
+    static void return_blocks(thread_cache& c, size_t index, size_t count);
+};
+
+// Блоки пула выделяются обычным operator new, поэтому типы с выравниванием
+// больше max_align_t нужно хранить в aligned_allocator.
+template <typename T>
+struct pool_allocator
+{
+    static_assert(alignof(T) <= alignof(std::max_align_t),
+                  "pool_allocator does not support over-aligned types");
+
+    static T* allocate(size_t n)
+    {
+        return static_cast<T*>(buffer_pool::allocate(n * sizeof(T)));
+    }
+
+    static void deallocate(T* p, size_t n)
+    {
+        buffer_pool::deallocate(p, n * sizeof(T));
+    }
+};
+
+inline void* buffer_pool::allocate(size_t bytes)
+{
+    if (bytes > max_class_bytes)
+        return operator new(bytes);
+
+    size_t index = class_of(bytes);
+    thread_cache* c = cache();
+    if (c != nullptr)
+    {
+        ++c->allocations;
+        if (c->heads[index] != nullptr)
+            ++c->cache_hits;
+        else
+            fetch_batch(*c, index);
+
+        if (c->heads[index] != nullptr)
+        {
+            block* b = c->heads[index];
+            c->heads[index] = b->next;
+            --c->counts[index];
+            return b;
+        }
+    }
+
+    central().system_allocations.fetch_add(1, std::memory_order_relaxed);
+    return operator new(class_bytes(index));
+}
+
+inline void buffer_pool::deallocate(void* p, size_t bytes)
+{
+    if (bytes > max_class_bytes)
+    {
+        operator delete(p);
+        return;
+    }
+
+    size_t index = class_of(bytes);
+    block* b = static_cast<block*>(p);
+
+    thread_cache* c = cache();
+    if (c == nullptr)
+    {
+        // Кэш потока уже разрушен (например, освобождается вектор из
+        // статического объекта), поэтому блок идет сразу в общий список.
+        central_list& list = central().lists[index];
+        std::lock_guard<std::mutex> lock(list.mutex);
+        b->next = list.head;
+        list.head = b;
+        ++list.count;
+        return;
+    }
+
+    ++c->deallocations;
+    b->next = c->heads[index];
+    c->heads[index] = b;
+    ++c->counts[index];
+
+    if (c->counts[index] > 2 * batch_size)
+        return_blocks(*c, index, batch_size);
+}
+
+inline pool_stats buffer_pool::stats()
+{
+    if (thread_cache* c = cache())
+        c->flush_stats();
+
+    central_state& s = central();
+    pool_stats result;
+    result.allocations        = s.allocations.load(std::memory_order_relaxed);
+    result.deallocations      = s.deallocations.load(std::memory_order_relaxed);
+    result.cache_hits         = s.cache_hits.load(std::memory_order_relaxed);
+    result.central_fetches    = s.central_fetches.load(std::memory_order_relaxed);
+    result.central_returns    = s.central_returns.load(std::memory_order_relaxed);
+    result.system_allocations = s.system_allocations.load(std::memory_order_relaxed);
+    return result;
+}
+
+inline void buffer_pool::release_thread_cache()
+{
+    thread_cache* c = cache();
+    if (c == nullptr)
+        return;
+
+    for (size_t i = 0; i != class_count; ++i)
+        return_blocks(*c, i, c->counts[i]);
+    c->flush_stats();
+}
+
+inline buffer_pool::thread_cache::thread_cache()
+    : allocations(0)
+    , deallocations(0)
+    , cache_hits(0)
+{
+    for (size_t i = 0; i != class_count; ++i)
+    {
+        heads[i] = nullptr;
+        counts[i] = 0;
+    }
+}
+
+inline buffer_pool::thread_cache::~thread_cache()
+{
+    for (size_t i = 0; i != class_count; ++i)
+        return_blocks(*this, i, counts[i]);
+    flush_stats();
+    cache_destroyed() = true;
+}
+
+inline void buffer_pool::thread_cache::flush_stats()
+{
+    central_state& s = central();
+    s.allocations.fetch_add(allocations, std::memory_order_relaxed);
+    s.deallocations.fetch_add(deallocations, std::memory_order_relaxed);
+    s.cache_hits.fetch_add(cache_hits, std::memory_order_relaxed);
+    allocations = 0;
+    deallocations = 0;
+    cache_hits = 0;
+}
+
+inline size_t buffer_pool::class_of(size_t bytes)
+{
+    if (bytes <= min_class_bytes)
+        return 0;
+
+    // Номер старшего бита (bytes - 1) -- это log2 от ближайшей сверху
+    // степени двойки.
+    size_t bits = sizeof(unsigned long long) * 8 - __builtin_clzll(bytes - 1);
+    return bits - min_class_shift;
+}
+
+inline size_t buffer_pool::class_bytes(size_t index)
+{
+    return min_class_bytes << index;
+}
+
+inline buffer_pool::central_state& buffer_pool::central()
+{
+    static central_state* state = new central_state();
+    return *state;
+}
+
+inline buffer_pool::thread_cache* buffer_pool::cache()
+{
+    if (cache_destroyed())
+        return nullptr;
+
+    static thread_local thread_cache c;
+    return &c;
+}
+
+// Тривиальный флаг переживает деструкторы thread_local объектов потока.
+inline bool& buffer_pool::cache_destroyed()
+{
+    static thread_local bool value = false;
+    return value;
+}
+
+inline void buffer_pool::fetch_batch(thread_cache& c, size_t index)
+{
+    central_state& s = central();
+    central_list& list = s.lists[index];
+
+    {
+        std::lock_guard<std::mutex> lock(list.mutex);
+        for (size_t i = 0; i != batch_size && list.head != nullptr; ++i)
+        {
+            block* b = list.head;
+            list.head = b->next;
+            --list.count;
+
+            b->next = c.heads[index];
+            c.heads[index] = b;
+            ++c.counts[index];
+        }
+    }
+
+    s.central_fetches.fetch_add(1, std::memory_order_relaxed);
+    c.flush_stats();
+}
+
+inline void buffer_pool::return_blocks(thread_cache& c, size_t index, size_t count)
+{
+    if (count == 0)
+        return;
+
+    // Отрезаем цепочку из count блоков без блокировки, под блокировкой
+    // только пристегиваем ее к общему списку.
+    block* first = c.heads[index];
+    block* last = first;
+    for (size_t i = 1; i != count; ++i)
+        last = last->next;
+
+    c.heads[index] = last->next;
+    c.counts[index] -= count;
+
+    central_state& s = central();
+    central_list& list = s.lists[index];
+    {
+        std::lock_guard<std::mutex> lock(list.mutex);
+        last->next = list.head;
+        list.head = first;
+        list.count += count;
+    }
+
+    s.central_returns.fetch_add(1, std::memory_order_relaxed);
+    c.flush_stats();
+}
+
+#endif // POOL_ALLOCATOR_H
@@ -0,0 +1,137 @@
+#ifndef PREFAULT_H
+#define PREFAULT_H
+
+#include "vector.h"
+#include "page.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+
+#include <sys/mman.h>
+
+/*
+Предварительное заполнение страниц буфера.
+
+После reserve(n) страницы большого буфера еще не отображены, и первый
+проход push_back'ов получает page fault на каждые 4 КБ. reserve_populated
+переносит эти fault'ы в момент резервирования: сначала пробуем
+MADV_POPULATE_WRITE (Linux 5.14), а если ядро его не знает, пишем по
+байту в каждую страницу неинициализированного хвоста. Если нужно, чтобы
+страницы не ушли в swap, хвост можно дополнительно закрепить mlock'ом.
+
+Закрепленные страницы учитываются в RLIMIT_MEMLOCK, пока их не открепят,
+а обычный аллокатор при освобождении буфера munlock не вызывает и
+страницы не возвращает. Поэтому reserve_populated с prefault_lock
+открепляет старый буфер после реаллокации, а перед уничтожением или
+shrink_to_fit такого вектора нужно вызвать unlock_populated.
+
+Для векторов, у которых так должна вести себя любая реаллокация, есть
+populated_allocator: он выделяет буфер через mmap с MAP_POPULATE. С
+prefault_lock он закрепляет каждый буфер, бросает std::system_error, если
+mlock не удался, и открепляет буфер при освобождении.
+*/
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+enum prefault_flags
+{
+    prefault_default = 0,
+    prefault_lock    = 1
+};
+
+// Возвращает false, если не удалось закрепить страницы mlock'ом.
+inline bool populate_memory(void* addr, size_t bytes, int flags = prefault_default)
+{
+    if (bytes == 0)
+        return true;
+
+    char* first = static_cast<char*>(addr);
+    char* last = first + bytes;
+
+    // madvise требует выровненного начала, поэтому заполняем только целые
+    // страницы внутри диапазона, а края дотрагиваем вручную.
+    size_t page = page_size();
+    char* inner_first = reinterpret_cast<char*>(
+        (reinterpret_cast<uintptr_t>(first) + page - 1) / page * page);
+    char* inner_last = reinterpret_cast<char*>(
+        reinterpret_cast<uintptr_t>(last) / page * page);
+
+    bool advised = inner_first < inner_last
+        && madvise(inner_first, inner_last - inner_first, MADV_POPULATE_WRITE) == 0;
+
+    if (advised)
+    {
+        if (first != inner_first)
+            *static_cast<char volatile*>(first) = 0;
+        if (last != inner_last)
+            *static_cast<char volatile*>(last - 1) = 0;
+    }
+    else
+    {
+        *static_cast<char volatile*>(first) = 0;
+        for (char* p = inner_first; p < last; p += page)
+            *static_cast<char volatile*>(p) = 0;
+    }
+
+    if (flags & prefault_lock)
+        return mlock(first, bytes) == 0;
+
+    return true;
+}
+
+template <typename T, typename Alloc, typename SizeT>
+bool reserve_populated(vector<T, Alloc, SizeT>& v, size_t n, int flags = prefault_default)
+{
+    // reserve может перевыделить буфер и при n == capacity(), поэтому
+    // реаллокацию узнаем по смене адреса. Старый буфер к этому моменту
+    // уже освобожден: если аллокатор вернул его системе, munlock просто
+    // вернет ENOMEM, а иначе снимет с его страниц ненужное закрепление.
+    uintptr_t old_data = reinterpret_cast<uintptr_t>(v.data());
+    size_t old_capacity = v.capacity();
+
+    v.reserve(n);
+
+    if ((flags & prefault_lock) && old_capacity != 0
+        && reinterpret_cast<uintptr_t>(v.data()) != old_data)
+        munlock(reinterpret_cast<void*>(old_data), old_capacity * sizeof(T));
+
+    // Живые элементы уже были записаны при копировании, трогаем только хвост.
+    return populate_memory(v.data() + v.size(),
+                           (v.capacity() - v.size()) * sizeof(T), flags);
+}
+
+// Открепляет буфер, закрепленный reserve_populated(..., prefault_lock).
+template <typename T, typename Alloc, typename SizeT>
+void unlock_populated(vector<T, Alloc, SizeT>& v)
+{
+    if (v.capacity() != 0)
+        munlock(v.data(), v.capacity() * sizeof(T));
+}
+
+template <typename T, int Flags = prefault_default>
+struct populated_allocator
+{
+    static T* allocate(size_t n)
+    {
+        void* p = map_pages(n * sizeof(T), MAP_POPULATE);
+        if ((Flags & prefault_lock) && mlock(p, n * sizeof(T)) != 0)
+        {
+            int error = errno;
+            unmap_pages(p, n * sizeof(T));
+            throw std::system_error(error, std::generic_category(), "mlock");
+        }
+        return static_cast<T*>(p);
+    }
+
+    static void deallocate(T* p, size_t n)
+    {
+        if (Flags & prefault_lock)
+            munlock(p, n * sizeof(T));
+        unmap_pages(p, n * sizeof(T));
+    }
+};
+
+#endif // PREFAULT_H
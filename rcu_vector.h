@@ -0,0 +1,352 @@
+#ifndef RCU_VECTOR_H
+#define RCU_VECTOR_H
+
+#include "vector.h"
+#include "padded_vector.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+/*
+Вектор для данных, которые читают все потоки, а меняют редко.
+
+Читатель не берет блокировок: он отмечает в своем слоте текущую эпоху
+(epoch pin), читает указатель на опубликованный буфер и работает с ним.
+Писатель под мьютексом писателей копирует текущий вектор, меняет копию и
+атомарно публикует указатель на нее. Старый буфер нельзя освободить сразу,
+потому что его еще могут читать, поэтому он передается в epoch_domain
+вместе с номером эпохи, в которой был заменен.
+
+Освобождение. Каждая замена увеличивает глобальную эпоху. Читатель,
+отметивший эпоху больше e, прочитал глобальную эпоху уже после публикации
+нового буфера и старый видеть не может. Поэтому буфер, замененный в эпохе
+e, освобождается, как только у всех активных читателей эпоха больше e.
+Между записью своей эпохи и чтением указателя читатель ставит seq_cst
+барьер: это единственная стоимость чтения кроме самого обращения к данным.
+
+Слоты читателей выделяются потоку при первом чтении и освобождаются при
+его завершении, их не больше max_threads.
+*/
+
+struct epoch_domain
+{
+    static size_t const max_threads = 1024;
+
+    static epoch_domain& instance();
+
+    ~epoch_domain();
+
+    void pin();
+    void unpin();
+
+    void retire(void* object, void (*deleter)(void*));
+
+    // Освобождает все, что уже никто не может читать. Возвращает число
+    // освобожденных объектов.
+    size_t reclaim();
+
+    // Ждет, пока будут освобождены все объекты, переданные в retire.
+    // Нельзя вызывать, удерживая pin в этом же потоке.
+    void synchronize();
+
+    size_t retired_count();
+
+private:
+    epoch_domain();
+    epoch_domain(epoch_domain const&);
+    epoch_domain& operator=(epoch_domain const&);
+
+    struct alignas(cache_line_size) slot
+    {
+        std::atomic<uint64_t> epoch;
+        std::atomic<bool> used;
+    };
+
+    struct retired
+    {
+        void* object;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    struct registration
+    {
+        size_t index;
+        size_t depth;
+
+        registration();
+        ~registration();
+    };
+
+    static registration& local();
+
+private:
+    std::atomic<uint64_t> global_epoch_;
+    slot slots_[max_threads];
+
+    std::mutex retired_mutex_;
+    vector<retired> retired_;
+};
+
+template <typename T>
+struct rcu_vector
+{
+    // Пока reader жив, вектор, на который он указывает, не освобождается.
+    struct reader
+    {
+        explicit reader(rcu_vector const& owner);
+        ~reader();
+
+        vector<T> const& operator*() const;
+        vector<T> const* operator->() const;
+
+    private:
+        reader(reader const&);
+        reader& operator=(reader const&);
+
+    private:
+        vector<T> const* data_;
+    };
+
+    rcu_vector();
+    explicit rcu_vector(vector<T> const& initial);
+    ~rcu_vector();
+
+    // f получает копию текущего вектора, которую и публикует после возврата.
+    template <typename F>
+    void update(F f);
+
+    // Публикует содержимое v, после вызова v пуст.
+    void publish(vector<T>& v);
+
+private:
+    rcu_vector(rcu_vector const&);
+    rcu_vector& operator=(rcu_vector const&);
+
+    void replace(vector<T>* next);
+
+    static void destroy(void* object);
+
+private:
+    epoch_domain& domain_;
+    std::atomic<vector<T>*> current_;
+    std::mutex writer_mutex_;
+};
+
+inline epoch_domain& epoch_domain::instance()
+{
+    static epoch_domain domain;
+    return domain;
+}
+
+inline epoch_domain::epoch_domain()
+    : global_epoch_(1)
+{
+    for (size_t i = 0; i != max_threads; ++i)
+    {
+        slots_[i].epoch.store(0, std::memory_order_relaxed);
+        slots_[i].used.store(false, std::memory_order_relaxed);
+    }
+}
+
+inline epoch_domain::~epoch_domain()
+{
+    // К этому моменту потоков-читателей уже нет.
+    for (size_t i = 0; i != retired_.size(); ++i)
+        retired_[i].deleter(retired_[i].object);
+}
+
+inline void epoch_domain::pin()
+{
+    registration& r = local();
+    if (r.depth++ != 0)
+        return;
+
+    slot& s = slots_[r.index];
+    s.epoch.store(global_epoch_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+inline void epoch_domain::unpin()
+{
+    registration& r = local();
+    if (--r.depth != 0)
+        return;
+
+    slots_[r.index].epoch.store(0, std::memory_order_release);
+}
+
+inline void epoch_domain::retire(void* object, void (*deleter)(void*))
+{
+    retired r;
+    r.object = object;
+    r.deleter = deleter;
+    r.epoch = global_epoch_.fetch_add(1, std::memory_order_seq_cst);
+
+    std::lock_guard<std::mutex> lock(retired_mutex_);
+    retired_.push_back(r);
+}
+
+inline size_t epoch_domain::reclaim()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    uint64_t min_active = UINT64_MAX;
+    for (size_t i = 0; i != max_threads; ++i)
+    {
+        uint64_t e = slots_[i].epoch.load(std::memory_order_seq_cst);
+        if (e != 0 && e < min_active)
+            min_active = e;
+    }
+
+    vector<retired> ready;
+    {
+        std::lock_guard<std::mutex> lock(retired_mutex_);
+        size_t kept = 0;
+        for (size_t i = 0; i != retired_.size(); ++i)
+        {
+            if (retired_[i].epoch < min_active)
+                ready.push_back(retired_[i]);
+            else
+                retired_[kept++] = retired_[i];
+        }
+        while (retired_.size() != kept)
+            retired_.pop_back();
+    }
+
+    // Деструкторы вызываются без блокировки: они могут быть долгими.
+    for (size_t i = 0; i != ready.size(); ++i)
+        ready[i].deleter(ready[i].object);
+
+    return ready.size();
+}
+
+inline void epoch_domain::synchronize()
+{
+    for (;;)
+    {
+        reclaim();
+        if (retired_count() == 0)
+            return;
+        std::this_thread::yield();
+    }
+}
+
+inline size_t epoch_domain::retired_count()
+{
+    std::lock_guard<std::mutex> lock(retired_mutex_);
+    return retired_.size();
+}
+
+inline epoch_domain::registration::registration()
+    : index(0)
+    , depth(0)
+{
+    epoch_domain& d = instance();
+    for (; index != max_threads; ++index)
+    {
+        bool expected = false;
+        if (d.slots_[index].used.compare_exchange_strong(expected, true))
+            return;
+    }
+    throw std::runtime_error("epoch_domain: too many reader threads");
+}
+
+inline epoch_domain::registration::~registration()
+{
+    epoch_domain& d = instance();
+    d.slots_[index].epoch.store(0, std::memory_order_release);
+    d.slots_[index].used.store(false, std::memory_order_release);
+}
+
+inline epoch_domain::registration& epoch_domain::local()
+{
+    static thread_local registration r;
+    return r;
+}
+
+template <typename T>
+rcu_vector<T>::reader::reader(rcu_vector const& owner)
+    : data_(nullptr)
+{
+    owner.domain_.pin();
+    data_ = owner.current_.load(std::memory_order_acquire);
+}
+
+template <typename T>
+rcu_vector<T>::reader::~reader()
+{
+    epoch_domain::instance().unpin();
+}
+
+template <typename T>
+vector<T> const& rcu_vector<T>::reader::operator*() const
+{
+    return *data_;
+}
+
+template <typename T>
+vector<T> const* rcu_vector<T>::reader::operator->() const
+{
+    return data_;
+}
+
+template <typename T>
+rcu_vector<T>::rcu_vector()
+    : domain_(epoch_domain::instance())
+    , current_(new vector<T>())
+{}
+
+template <typename T>
+rcu_vector<T>::rcu_vector(vector<T> const& initial)
+    : domain_(epoch_domain::instance())
+    , current_(new vector<T>(initial))
+{}
+
+template <typename T>
+rcu_vector<T>::~rcu_vector()
+{
+    delete current_.load(std::memory_order_relaxed);
+    domain_.reclaim();
+}
+
+template <typename T>
+template <typename F>
+void rcu_vector<T>::update(F f)
+{
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+
+    std::unique_ptr<vector<T> > next(new vector<T>(*current_.load(std::memory_order_relaxed)));
+    f(*next);
+    replace(next.release());
+}
+
+template <typename T>
+void rcu_vector<T>::publish(vector<T>& v)
+{
+    std::unique_ptr<vector<T> > next(new vector<T>());
+    next->swap(v);
+
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    replace(next.release());
+}
+
+template <typename T>
+void rcu_vector<T>::replace(vector<T>* next)
+{
+    vector<T>* old = current_.exchange(next, std::memory_order_seq_cst);
+    domain_.retire(old, &destroy);
+    domain_.reclaim();
+}
+
+template <typename T>
+void rcu_vector<T>::destroy(void* object)
+{
+    delete static_cast<vector<T>*>(object);
+}
+
+#endif // RCU_VECTOR_H
@@ -0,0 +1,750 @@
+#ifndef ROPE_H
+#define ROPE_H
+
+#include "vector.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <type_traits>
+#include <utility>
+
+/*
+Rope: последовательность из небольших непрерывных листьев.
+
+Склеить два vector или отрезать от него хвост -- это копирование всех
+элементов через copy_construct_all. rope хранит элементы в листьях по
+leaf_capacity() элементов (около 4 КБ), а листья -- в листьях
+AVL-дерева; внутренние узлы знают размер и высоту своего поддерева.
+Доступ по индексу спускается по размерам поддеревьев, append(rope)
+и split сшивают и разрезают деревья вдоль одной ветви, insert и erase
+меняют один лист и перестраивают путь до корня -- все это O(log n).
+Соседние листья, оказавшиеся на стыке при склейке, сливаются, если
+помещаются в один. Лист, в котором после erase осталось меньше четверти
+leaf_capacity(), сливается с соседним, а если вместе они в один лист не
+помещаются, элементы делятся между ними поровну. Поэтому удаления не
+оставляют за собой почти пустых листьев, которые раздували бы дерево.
+
+for_each_chunk обходит листья по порядку: каждый лист -- непрерывный
+кусок памяти.
+
+Узлы неизменяемы, пока на них есть больше одной ссылки, и разделяются
+между версиями: копирование rope -- O(1), а изменение копии создает
+новые узлы только на пути от корня к измененному листу, оставляя
+остальные общими. Так что любая копия -- это сохраненная версия
+(persistent-вариант бесплатен), а пока копий нет, лист для trivially
+copyable T меняется на месте, без копирования. Счетчики ссылок атомарны:
+разные версии можно читать и менять из разных потоков, одну версию --
+нет.
+
+Все изменяющие операции дают строгую гарантию: новые узлы строятся
+рядом со старыми, а на месте меняются только листья, копирование
+элементов которых не бросает исключений.
+
+Дерево двоичное, а не B+-дерево с широкими узлами: у двоичного склейка
+и разрезание проще, а при листьях в 4 КБ внутренние узлы все равно
+занимают малую долю памяти.
+*/
+
+namespace rope_detail
+{
+    template <typename T>
+    size_t leaf_capacity()
+    {
+        size_t n = 4096 / sizeof(T);
+        return n < 8 ? 8 : n;
+    }
+
+    // Меньше стольких элементов в листе после erase быть не должно.
+    template <typename T>
+    size_t min_leaf_size()
+    {
+        return leaf_capacity<T>() / 4;
+    }
+
+    template <typename T, typename Alloc>
+    struct node;
+
+    // Указатель со счетчиком ссылок в самом узле.
+    template <typename T, typename Alloc>
+    struct node_ptr
+    {
+        node_ptr()
+            : p_(nullptr)
+        {}
+
+        explicit node_ptr(node<T, Alloc>* p)
+            : p_(p)
+        {}
+
+        node_ptr(node_ptr const& other)
+            : p_(other.p_)
+        {
+            if (p_ != nullptr)
+                p_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        node_ptr& operator=(node_ptr const& other)
+        {
+            node_ptr tmp(other);
+            swap(tmp);
+            return *this;
+        }
+
+        ~node_ptr()
+        {
+            if (p_ != nullptr && p_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                delete p_;
+        }
+
+        void swap(node_ptr& other)
+        {
+            std::swap(p_, other.p_);
+        }
+
+        node<T, Alloc>* get() const
+        {
+            return p_;
+        }
+
+        node<T, Alloc>* operator->() const
+        {
+            return p_;
+        }
+
+        explicit operator bool() const
+        {
+            return p_ != nullptr;
+        }
+
+        bool unique() const
+        {
+            return p_->refs.load(std::memory_order_acquire) == 1;
+        }
+
+    private:
+        node<T, Alloc>* p_;
+    };
+
+    // Лист: height == 1, values заполнен, детей нет. Внутренний узел:
+    // оба ребенка есть, values пуст.
+    template <typename T, typename Alloc>
+    struct node
+    {
+        node()
+            : refs(1)
+            , size(0)
+            , height(1)
+        {}
+
+        std::atomic<size_t> refs;
+        size_t size;
+        size_t height;
+        node_ptr<T, Alloc> left;
+        node_ptr<T, Alloc> right;
+        vector<T, Alloc> values;
+
+    private:
+        node(node const&);
+        node& operator=(node const&);
+    };
+
+    template <typename T, typename Alloc>
+    size_t height(node_ptr<T, Alloc> const& t)
+    {
+        return t ? t->height : 0;
+    }
+
+    template <typename T, typename Alloc>
+    size_t size(node_ptr<T, Alloc> const& t)
+    {
+        return t ? t->size : 0;
+    }
+
+    // Лист из копий элементов [first, last) листа t.
+    template <typename T, typename Alloc>
+    node_ptr<T, Alloc> slice(node_ptr<T, Alloc> const& t, size_t first, size_t last, size_t reserve = 0)
+    {
+        node_ptr<T, Alloc> leaf(new node<T, Alloc>());
+        leaf->values.reserve(std::max(last - first, reserve));
+        leaf->values.append_construct(last - first, [&](T* dst, size_t count) {
+            copy_construct_all(dst, t->values.data() + first, count);
+        });
+        leaf->size = last - first;
+        return leaf;
+    }
+
+    // Лист из копий элементов [first, last) листа t и val перед i-м.
+    template <typename T, typename Alloc>
+    node_ptr<T, Alloc> slice_insert(node_ptr<T, Alloc> const& t, size_t first, size_t last,
+                                    size_t i, T const& val, size_t reserve)
+    {
+        node_ptr<T, Alloc> leaf = slice(t, first, i, reserve);
+        leaf->values.push_back(val);
+        leaf->values.append_construct(last - i, [&](T* dst, size_t count) {
+            copy_construct_all(dst, t->values.data() + i, count);
+        });
+        leaf->size = last - first + 1;
+        return leaf;
+    }
+
+    template <typename T, typename Alloc>
+    node_ptr<T, Alloc> make_node(node_ptr<T, Alloc> const& l, node_ptr<T, Alloc> const& r)
+    {
+        node_ptr<T, Alloc> t(new node<T, Alloc>());
+        t->left = l;
+        t->right = r;
+        t->size = l->size + r->size;
+        t->height = std::max(l->height, r->height) + 1;
+        return t;
+    }
+
+    // Узел из поддеревьев, высоты которых различаются не больше чем на 2.
+    template <typename T, typename Alloc>
+    node_ptr<T, Alloc> balance(node_ptr<T, Alloc> const& l, node_ptr<T, Alloc> const& r)
+    {
+        if (!l)
+            return r;
+        if (!r)
+            return l;
+
+        if (l->height > r->height + 1)
+        {
+            node_ptr<T, Alloc> const& ll = l->left;
+            node_ptr<T, Alloc> const& lr = l->right;
+            if (ll->height >= lr->height)
+                return make_node(ll, make_node(lr, r));
+            return make_node(make_node(ll, lr->left), make_node(lr->right, r));
+        }
+
+        if (r->height > l->height + 1)
+        {
+            node_ptr<T, Alloc> const& rl = r->left;
+            node_ptr<T, Alloc> const& rr = r->right;
+            if (rr->height >= rl->height)
+                return make_node(make_node(l, rl), rr);
+            return make_node(make_node(l, rl->left), make_node(rl->right, rr));
+        }
+
+        return make_node(l, r);
+    }
+
+    // Склейка спускается по краю более высокого дерева до поддерева
+    // почти той же высоты, что и другое: O(|height(a) - height(b)| + 1).
+    template <typename T, typename Alloc>
+    node_ptr<T, Alloc> join(node_ptr<T, Alloc> const& a, node_ptr<T, Alloc> const& b)
+    {
+        if (!a)
+            return b;
+        if (!b)
+            return a;
+
+        if (a->height == 1 && b->height == 1 && a->size + b->size <= leaf_capacity<T>())
+        {
+            node_ptr<T, Alloc> leaf = slice(a, 0, a->size, a->size + b->size);
+            leaf->values.append_construct(b->size, [&](T* dst, size_t count) {
+                copy_construct_all(dst, b->values.data(), count);
+            });
+            leaf->size += b->size;
+            return leaf;
+        }
+
+        if (a->height > b->height + 1)
+            return balance(a->left, join(a->right, b));
+        if (b->height > a->height + 1)
+            return balance(join(a, b->left), b->right);
+        return make_node(a, b);
+    }
+
+    // left получает первые i элементов t, right -- остальные.
+    template <typename T, typename Alloc>
+    void split(node_ptr<T, Alloc> const& t, size_t i, node_ptr<T, Alloc>& left, node_ptr<T, Alloc>& right)
+    {
+        node_ptr<T, Alloc> l;
+        node_ptr<T, Alloc> r;
+
+        if (i == 0)
+        {
+            r = t;
+        }
+        else if (i >= size(t))
+        {
+            l = t;
+        }
+        else if (t->height == 1)
+        {
+            l = slice(t, 0, i);
+            r = slice(t, i, t->size);
+        }
+        else if (i < t->left->size)
+        {
+            node_ptr<T, Alloc> b;
+            split(t->left, i, l, b);
+            r = join(b, t->right);
+        }
+        else
+        {
+            node_ptr<T, Alloc> a;
+            split(t->right, i - t->left->size, a, r);
+            l = join(t->left, a);
+        }
+
+        left.swap(l);
+        right.swap(r);
+    }
+
+    template <typename T, typename Alloc>
+    size_t first_leaf_size(node_ptr<T, Alloc> const& t)
+    {
+        node<T, Alloc> const* p = t.get();
+        while (p->height != 1)
+            p = p->left.get();
+        return p->size;
+    }
+
+    template <typename T, typename Alloc>
+    size_t last_leaf_size(node_ptr<T, Alloc> const& t)
+    {
+        node<T, Alloc> const* p = t.get();
+        while (p->height != 1)
+            p = p->right.get();
+        return p->size;
+    }
+
+    // Соседние листья a и b: один лист, если помещаются, иначе два
+    // примерно поровну.
+    template <typename T, typename Alloc>
+    node_ptr<T, Alloc> merge_leaves(node_ptr<T, Alloc> const& a, node_ptr<T, Alloc> const& b)
+    {
+        size_t total = a->size + b->size;
+        if (total <= leaf_capacity<T>())
+            return join(a, b);
+
+        size_t half = total / 2;
+        if (a->size < half)
+        {
+            size_t moved = half - a->size;
+            node_ptr<T, Alloc> l = slice(a, 0, a->size, leaf_capacity<T>());
+            l->values.append_construct(moved, [&](T* dst, size_t count) {
+                copy_construct_all(dst, b->values.data(), count);
+            });
+            l->size = half;
+            return make_node(l, slice(b, moved, b->size, leaf_capacity<T>()));
+        }
+
+        size_t moved = a->size - half;
+        node_ptr<T, Alloc> r = slice(a, half, a->size, leaf_capacity<T>());
+        r->values.append_construct(b->size, [&](T* dst, size_t count) {
+            copy_construct_all(dst, b->values.data(), count);
+        });
+        r->size = moved + b->size;
+        return make_node(slice(a, 0, half, leaf_capacity<T>()), r);
+    }
+
+    // Сливает лист leaf с первым листом дерева rest, стоящего после него.
+    // split по границе листа сам листы не копирует.
+    template <typename T, typename Alloc>
+    node_ptr<T, Alloc> merge_with_next(node_ptr<T, Alloc> const& leaf, node_ptr<T, Alloc> const& rest)
+    {
+        node_ptr<T, Alloc> first;
+        node_ptr<T, Alloc> tail;
+        split(rest, first_leaf_size(rest), first, tail);
+        return join(merge_leaves(leaf, first), tail);
+    }
+
+    // Сливает лист leaf с последним листом дерева rest, стоящего перед ним.
+    template <typename T, typename Alloc>
+    node_ptr<T, Alloc> merge_with_previous(node_ptr<T, Alloc> const& rest, node_ptr<T, Alloc> const& leaf)
+    {
+        node_ptr<T, Alloc> head;
+        node_ptr<T, Alloc> last;
+        split(rest, rest->size - last_leaf_size(rest), head, last);
+        return join(head, merge_leaves(last, leaf));
+    }
+
+    /*
+    insert_at, erase_at и set_at возвращают новое поддерево вместо t.
+    unique -- на t и на всех его предков ровно одна ссылка; тогда лист
+    можно поменять на месте, и результатом будет сам t.
+    */
+    template <typename T, typename Alloc>
+    node_ptr<T, Alloc> insert_at(node_ptr<T, Alloc>& t, size_t i, T const& val, bool unique)
+    {
+        unique = unique && t.unique();
+
+        if (t->height == 1)
+        {
+            size_t capacity = leaf_capacity<T>();
+            if (t->size < capacity && unique && std::is_trivially_copyable<T>::value)
+            {
+                // val может указывать в этот же лист.
+                T copy(val);
+                if (i == t->size)
+                    t->values.push_back(copy);
+                else
+                    t->values.insert(t->values.begin() + i, copy);
+                ++t->size;
+                return t;
+            }
+
+            if (t->size < capacity)
+                return slice_insert(t, 0, t->size, i, val, t->size + 1);
+
+            // Полный лист делится пополам.
+            size_t half = t->size / 2;
+            if (i <= half)
+                return make_node(slice_insert(t, 0, half, i, val, capacity), slice(t, half, t->size, capacity));
+            return make_node(slice(t, 0, half, capacity), slice_insert(t, half, t->size, i, val, capacity));
+        }
+
+        if (i <= t->left->size)
+        {
+            node_ptr<T, Alloc> l = insert_at(t->left, i, val, unique);
+            if (l.get() == t->left.get())
+            {
+                ++t->size;
+                return t;
+            }
+            return balance(l, t->right);
+        }
+
+        node_ptr<T, Alloc> r = insert_at(t->right, i - t->left->size, val, unique);
+        if (r.get() == t->right.get())
+        {
+            ++t->size;
+            return t;
+        }
+        return balance(t->left, r);
+    }
+
+    template <typename T, typename Alloc>
+    node_ptr<T, Alloc> erase_at(node_ptr<T, Alloc>& t, size_t i, bool unique)
+    {
+        unique = unique && t.unique();
+
+        if (t->height == 1)
+        {
+            if (t->size == 1)
+                return node_ptr<T, Alloc>();
+
+            if (unique && std::is_trivially_copyable<T>::value)
+            {
+                t->values.erase(t->values.begin() + i);
+                --t->size;
+                return t;
+            }
+
+            node_ptr<T, Alloc> leaf = slice(t, 0, i, t->size - 1);
+            leaf->values.append_construct(t->size - i - 1, [&](T* dst, size_t count) {
+                copy_construct_all(dst, t->values.data() + i + 1, count);
+            });
+            leaf->size = t->size - 1;
+            return leaf;
+        }
+
+        // Лист, который станет недозаполненным, не меняется на месте:
+        // слияние может бросить, а дерево должно остаться прежним.
+        // После слияния листья могут склеиться, и поддерево станет ниже
+        // больше чем на 1 -- поэтому с соседом его сшивает join, а не
+        // balance.
+        size_t min_leaf = min_leaf_size<T>();
+        if (i < t->left->size)
+        {
+            bool underfull = t->left->height == 1 && t->left->size - 1 < min_leaf;
+            node_ptr<T, Alloc> l = erase_at(t->left, i, unique && !underfull);
+            if (underfull && l)
+                return merge_with_next(l, t->right);
+            if (l.get() == t->left.get())
+            {
+                --t->size;
+                return t;
+            }
+            return join(l, t->right);
+        }
+
+        bool underfull = t->right->height == 1 && t->right->size - 1 < min_leaf;
+        node_ptr<T, Alloc> r = erase_at(t->right, i - t->left->size, unique && !underfull);
+        if (underfull && r)
+            return merge_with_previous(t->left, r);
+        if (r.get() == t->right.get())
+        {
+            --t->size;
+            return t;
+        }
+        return join(t->left, r);
+    }
+
+    template <typename T, typename Alloc>
+    node_ptr<T, Alloc> set_at(node_ptr<T, Alloc>& t, size_t i, T const& val, bool unique)
+    {
+        unique = unique && t.unique();
+
+        if (t->height == 1)
+        {
+            if (unique && std::is_trivially_copyable<T>::value)
+            {
+                t->values[i] = val;
+                return t;
+            }
+
+            node_ptr<T, Alloc> leaf = slice(t, 0, t->size);
+            leaf->values[i] = val;
+            return leaf;
+        }
+
+        if (i < t->left->size)
+        {
+            node_ptr<T, Alloc> l = set_at(t->left, i, val, unique);
+            return l.get() == t->left.get() ? t : make_node(l, t->right);
+        }
+
+        node_ptr<T, Alloc> r = set_at(t->right, i - t->left->size, val, unique);
+        return r.get() == t->right.get() ? t : make_node(t->left, r);
+    }
+
+    template <typename T, typename Alloc, typename F>
+    void for_each_leaf(node_ptr<T, Alloc> const& t, F& f)
+    {
+        if (!t)
+            return;
+
+        if (t->height == 1)
+        {
+            f(static_cast<T const*>(t->values.data()), t->size);
+            return;
+        }
+
+        for_each_leaf(t->left, f);
+        for_each_leaf(t->right, f);
+    }
+
+    // Высоты детей каждого внутреннего узла различаются не больше чем
+    // на 1, а высота и размер узла согласованы с детьми.
+    template <typename T, typename Alloc>
+    bool balanced(node_ptr<T, Alloc> const& t)
+    {
+        if (!t || t->height == 1)
+            return true;
+
+        size_t hl = t->left->height;
+        size_t hr = t->right->height;
+        return (hl > hr ? hl - hr : hr - hl) <= 1
+            && t->height == std::max(hl, hr) + 1
+            && t->size == t->left->size + t->right->size
+            && balanced(t->left) && balanced(t->right);
+    }
+}
+
+template <typename T, typename Alloc = heap_allocator<T> >
+struct rope
+{
+    rope();
+
+    // O(1): копия разделяет с оригиналом все узлы.
+    rope(rope const&);
+    rope& operator=(rope const&);
+
+    T const& operator[](size_t i) const;
+    void set(size_t i, T const& val);
+
+    size_t size() const;
+    bool empty() const;
+
+    void push_back(T const&);
+    void insert(size_t i, T const&);
+    void erase(size_t i);
+
+    template <typename It>
+    void append(It first, It last);
+    // Склейка за O(log n); листья other становятся общими.
+    void append(rope const& other);
+    // Оставляет первые i элементов, остальные переносит в tail.
+    void split(size_t i, rope& tail);
+
+    void clear();
+    void swap(rope&);
+
+    // f(T const* first, size_t count) для каждого листа по порядку.
+    template <typename F>
+    void for_each_chunk(F f) const;
+
+    size_t height() const;
+    // Выполнен ли инвариант AVL во всех узлах; O(n / leaf_capacity()).
+    bool balanced() const;
+    static size_t leaf_capacity();
+
+private:
+    typedef rope_detail::node_ptr<T, Alloc> node_ptr;
+
+    node_ptr root_;
+};
+
+template <typename T, typename Alloc>
+rope<T, Alloc>::rope()
+{}
+
+template <typename T, typename Alloc>
+rope<T, Alloc>::rope(rope const& other)
+    : root_(other.root_)
+{}
+
+template <typename T, typename Alloc>
+rope<T, Alloc>& rope<T, Alloc>::operator=(rope const& other)
+{
+    root_ = other.root_;
+    return *this;
+}
+
+template <typename T, typename Alloc>
+T const& rope<T, Alloc>::operator[](size_t i) const
+{
+    assert(i < size());
+
+    rope_detail::node<T, Alloc> const* t = root_.get();
+    while (t->height != 1)
+    {
+        if (i < t->left->size)
+        {
+            t = t->left.get();
+        }
+        else
+        {
+            i -= t->left->size;
+            t = t->right.get();
+        }
+    }
+    return t->values[i];
+}
+
+template <typename T, typename Alloc>
+void rope<T, Alloc>::set(size_t i, T const& val)
+{
+    assert(i < size());
+
+    node_ptr result = rope_detail::set_at(root_, i, val, true);
+    root_.swap(result);
+}
+
+template <typename T, typename Alloc>
+size_t rope<T, Alloc>::size() const
+{
+    return rope_detail::size(root_);
+}
+
+template <typename T, typename Alloc>
+bool rope<T, Alloc>::empty() const
+{
+    return !root_;
+}
+
+template <typename T, typename Alloc>
+void rope<T, Alloc>::push_back(T const& val)
+{
+    insert(size(), val);
+}
+
+template <typename T, typename Alloc>
+void rope<T, Alloc>::insert(size_t i, T const& val)
+{
+    assert(i <= size());
+
+    node_ptr result;
+    if (!root_)
+    {
+        result = node_ptr(new rope_detail::node<T, Alloc>());
+        result->values.push_back(val);
+        result->size = 1;
+    }
+    else
+    {
+        result = rope_detail::insert_at(root_, i, val, true);
+    }
+    root_.swap(result);
+}
+
+template <typename T, typename Alloc>
+void rope<T, Alloc>::erase(size_t i)
+{
+    assert(i < size());
+
+    node_ptr result = rope_detail::erase_at(root_, i, true);
+    root_.swap(result);
+}
+
+template <typename T, typename Alloc>
+template <typename It>
+void rope<T, Alloc>::append(It first, It last)
+{
+    node_ptr result = root_;
+    while (first != last)
+    {
+        node_ptr leaf(new rope_detail::node<T, Alloc>());
+        leaf->values.reserve(leaf_capacity());
+        for (; first != last && leaf->values.size() != leaf_capacity(); ++first)
+            leaf->values.push_back(*first);
+        leaf->size = leaf->values.size();
+
+        node_ptr joined = rope_detail::join(result, leaf);
+        result.swap(joined);
+    }
+    root_.swap(result);
+}
+
+template <typename T, typename Alloc>
+void rope<T, Alloc>::append(rope const& other)
+{
+    node_ptr result = rope_detail::join(root_, other.root_);
+    root_.swap(result);
+}
+
+template <typename T, typename Alloc>
+void rope<T, Alloc>::split(size_t i, rope& tail)
+{
+    assert(i <= size());
+
+    node_ptr left;
+    node_ptr right;
+    rope_detail::split(root_, i, left, right);
+    root_.swap(left);
+    tail.root_.swap(right);
+}
+
+template <typename T, typename Alloc>
+void rope<T, Alloc>::clear()
+{
+    node_ptr empty;
+    root_.swap(empty);
+}
+
+template <typename T, typename Alloc>
+void rope<T, Alloc>::swap(rope& other)
+{
+    root_.swap(other.root_);
+}
+
+template <typename T, typename Alloc>
+template <typename F>
+void rope<T, Alloc>::for_each_chunk(F f) const
+{
+    rope_detail::for_each_leaf(root_, f);
+}
+
+template <typename T, typename Alloc>
+size_t rope<T, Alloc>::height() const
+{
+    return rope_detail::height(root_);
+}
+
+template <typename T, typename Alloc>
+bool rope<T, Alloc>::balanced() const
+{
+    return rope_detail::balanced(root_);
+}
+
+template <typename T, typename Alloc>
+size_t rope<T, Alloc>::leaf_capacity()
+{
+    return rope_detail::leaf_capacity<T>();
+}
+
+#endif // ROPE_H
@@ -0,0 +1,355 @@
+#ifndef SHM_VECTOR_H
+#define SHM_VECTOR_H
+
+#include "page.h"
+
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+Вектор в именованном сегменте разделяемой памяти POSIX.
+
+Один процесс создает сегмент (shm_open + ftruncate + mmap) и наполняет
+его, остальные подключаются по имени только на чтение, так что N
+процессов держат в памяти одну копию данных. Каждый процесс отображает
+сегмент по своему адресу, поэтому внутри сегмента нет абсолютных
+указателей: заголовок ссылается на данные через offset_ptr, который
+хранит смещение относительно собственного адреса.
+
+Емкость задается при создании и не меняется: перевыделить сегмент, не
+ломая отображения в чужих процессах, нельзя. Страницы сегмента выделяются
+при первой записи, поэтому большая емкость с запасом почти ничего не
+стоит.
+
+Размер публикуется release-записью после того, как элемент записан,
+поэтому читатели, подключенные во время наполнения, видят согласованный
+префикс. Так же, последней release-записью, публикуется magic: процесс,
+подключившийся между shm_open и концом инициализации, увидит нулевой
+magic и получит исключение, а не полузаполненный заголовок.
+
+Заголовку в чужом сегменте читатель не доверяет. Смещение данных и
+емкость проверяются по размеру отображения при подключении, емкость
+запоминается, а размер, который создатель может поменять в любой
+момент, при каждом чтении ограничивается ею. Поэтому испорченный
+сегмент не заставит читателя обращаться за его пределы.
+
+Элементы копируются в сегмент побайтно, так что T должен быть trivially
+copyable и не содержать обычных указателей.
+*/
+
+template <typename T>
+struct offset_ptr
+{
+    offset_ptr()
+        : offset_(0)
+    {}
+
+    offset_ptr(T* p)
+    {
+        set(p);
+    }
+
+    offset_ptr(offset_ptr const& other)
+    {
+        set(other.get());
+    }
+
+    offset_ptr& operator=(offset_ptr const& other)
+    {
+        set(other.get());
+        return *this;
+    }
+
+    T* get() const
+    {
+        if (offset_ == 0)
+            return nullptr;
+        return reinterpret_cast<T*>(reinterpret_cast<intptr_t>(this) + offset_);
+    }
+
+private:
+    // Нулевое смещение (указатель на самого себя) обозначает nullptr.
+    void set(T* p)
+    {
+        offset_ = p ? reinterpret_cast<intptr_t>(p) - reinterpret_cast<intptr_t>(this) : 0;
+    }
+
+private:
+    intptr_t offset_;
+};
+
+template <typename T>
+struct shm_vector
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "shm_vector stores elements as raw bytes");
+
+    typedef T const* const_iterator;
+
+    // Создает новый сегмент. Если сегмент с таким именем уже есть, бросает
+    // std::system_error.
+    shm_vector(char const* name, size_t capacity, mode_t mode = 0600);
+
+    // Подключается к существующему сегменту только на чтение.
+    explicit shm_vector(char const* name);
+
+    ~shm_vector();
+
+    static void remove(char const* name);
+
+    T const& operator[](size_t i) const;
+
+    T const* data() const;
+
+    size_t size() const;
+    size_t capacity() const;
+    bool empty() const;
+    bool writable() const;
+
+    // Изменять сегмент может только создавший его процесс.
+    void push_back(T const&);
+    void set(size_t i, T const& val);
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+private:
+    shm_vector(shm_vector const&);
+    shm_vector& operator=(shm_vector const&);
+
+    static uint64_t const magic = 0x5348564543544f52ull;   // "SHVECTOR"
+    static uint32_t const version = 1;
+
+    struct header
+    {
+        std::atomic<uint64_t> magic;
+        uint32_t version;
+        uint32_t element_size;
+        uint64_t capacity;
+        std::atomic<uint64_t> size;
+        offset_ptr<T> data;
+    };
+
+    static size_t data_offset();
+    void map(int fd, size_t bytes, int prot);
+
+private:
+    header* header_;
+    T* data_;
+    size_t capacity_;
+    size_t mapped_bytes_;
+    bool writable_;
+};
+
+template <typename T>
+shm_vector<T>::shm_vector(char const* name, size_t capacity, mode_t mode)
+    : header_(nullptr)
+    , data_(nullptr)
+    , capacity_(capacity)
+    , mapped_bytes_(0)
+    , writable_(true)
+{
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, mode);
+    if (fd == -1)
+        throw std::system_error(errno, std::generic_category(), "shm_open");
+
+    size_t bytes = round_to_pages(data_offset() + capacity * sizeof(T));
+    if (ftruncate(fd, bytes) != 0)
+    {
+        int error = errno;
+        close(fd);
+        shm_unlink(name);
+        throw std::system_error(error, std::generic_category(), "ftruncate");
+    }
+
+    try
+    {
+        map(fd, bytes, PROT_READ | PROT_WRITE);
+    }
+    catch (...)
+    {
+        shm_unlink(name);
+        throw;
+    }
+
+    header_->version = version;
+    header_->element_size = sizeof(T);
+    header_->capacity = capacity;
+    header_->size.store(0, std::memory_order_relaxed);
+    new (&header_->data) offset_ptr<T>(data_);
+    header_->magic.store(magic, std::memory_order_release);
+}
+
+template <typename T>
+shm_vector<T>::shm_vector(char const* name)
+    : header_(nullptr)
+    , data_(nullptr)
+    , capacity_(0)
+    , mapped_bytes_(0)
+    , writable_(false)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+        throw std::system_error(errno, std::generic_category(), "shm_open");
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "fstat");
+    }
+
+    if (static_cast<size_t>(st.st_size) < data_offset())
+    {
+        close(fd);
+        throw std::runtime_error("shm_vector: segment is too small");
+    }
+
+    map(fd, st.st_size, PROT_READ);
+
+    if (header_->magic.load(std::memory_order_acquire) != magic
+        || header_->version != version
+        || header_->element_size != sizeof(T)
+        || header_->capacity > (mapped_bytes_ - data_offset()) / sizeof(T)
+        || header_->size.load(std::memory_order_acquire) > header_->capacity)
+    {
+        munmap(header_, mapped_bytes_);
+        throw std::runtime_error("shm_vector: segment layout does not match");
+    }
+
+    // Данные должны целиком лежать в отображении после заголовка и быть
+    // выровнены; сравниваются адреса, а не указатели, чтобы не получить UB.
+    uintptr_t first = reinterpret_cast<uintptr_t>(header_) + data_offset();
+    uintptr_t last = reinterpret_cast<uintptr_t>(header_) + mapped_bytes_;
+    uintptr_t data = reinterpret_cast<uintptr_t>(header_->data.get());
+    if (data < first
+        || data > last
+        || data % alignof(T) != 0
+        || (last - data) / sizeof(T) < header_->capacity)
+    {
+        munmap(header_, mapped_bytes_);
+        throw std::runtime_error("shm_vector: data offset is out of the segment");
+    }
+
+    data_ = header_->data.get();
+    capacity_ = header_->capacity;
+}
+
+template <typename T>
+shm_vector<T>::~shm_vector()
+{
+    munmap(header_, mapped_bytes_);
+}
+
+template <typename T>
+void shm_vector<T>::remove(char const* name)
+{
+    shm_unlink(name);
+}
+
+template <typename T>
+T const& shm_vector<T>::operator[](size_t i) const
+{
+    return data_[i];
+}
+
+template <typename T>
+T const* shm_vector<T>::data() const
+{
+    return data_;
+}
+
+template <typename T>
+size_t shm_vector<T>::size() const
+{
+    uint64_t size = header_->size.load(std::memory_order_acquire);
+    return size < capacity_ ? size : capacity_;
+}
+
+template <typename T>
+size_t shm_vector<T>::capacity() const
+{
+    return capacity_;
+}
+
+template <typename T>
+bool shm_vector<T>::empty() const
+{
+    return size() == 0;
+}
+
+template <typename T>
+bool shm_vector<T>::writable() const
+{
+    return writable_;
+}
+
+template <typename T>
+void shm_vector<T>::push_back(T const& val)
+{
+    assert(writable_);
+
+    uint64_t size = header_->size.load(std::memory_order_relaxed);
+    if (size == capacity_)
+        throw std::length_error("shm_vector: capacity exhausted");
+
+    data_[size] = val;
+    header_->size.store(size + 1, std::memory_order_release);
+}
+
+template <typename T>
+void shm_vector<T>::set(size_t i, T const& val)
+{
+    assert(writable_);
+    assert(i < size());
+    data_[i] = val;
+}
+
+template <typename T>
+typename shm_vector<T>::const_iterator shm_vector<T>::begin() const
+{
+    return data_;
+}
+
+template <typename T>
+typename shm_vector<T>::const_iterator shm_vector<T>::end() const
+{
+    return data_ + size();
+}
+
+// Данные начинаются с отдельной кэш-линии после заголовка.
+template <typename T>
+size_t shm_vector<T>::data_offset()
+{
+    size_t align = alignof(T) > 64 ? alignof(T) : 64;
+    return (sizeof(header) + align - 1) / align * align;
+}
+
+template <typename T>
+void shm_vector<T>::map(int fd, size_t bytes, int prot)
+{
+    void* p = mmap(nullptr, bytes, prot, MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+
+    if (p == MAP_FAILED)
+        throw std::system_error(error, std::generic_category(), "mmap");
+
+    header_ = static_cast<header*>(p);
+    data_ = reinterpret_cast<T*>(static_cast<char*>(p) + data_offset());
+    mapped_bytes_ = bytes;
+}
+
+#endif // SHM_VECTOR_H
@@ -0,0 +1,303 @@
+#ifndef SLOT_MAP_H
+#define SLOT_MAP_H
+
+#include "vector.h"
+
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+/*
+Slot map: хранилище с устойчивыми 64-битными ключами поверх vector.
+
+Значения лежат плотно в values_, поэтому обход идет по непрерывному
+массиву. Ключ (slot_handle) -- это номер слота и его поколение. Слот
+хранит, где сейчас лежит значение в values_, а dense_to_slot_ -- обратное
+отображение. Удаление переносит последнее значение на место удаленного
+(поэтому порядок обхода не сохраняется), увеличивает поколение слота и
+кладет слот в список свободных. Ключ, выданный до удаления, больше не
+совпадает по поколению и считается недействительным, даже если слот уже
+занят снова. Вставка, удаление и поиск -- O(1).
+
+Слот, поколение которого дошло до максимума, больше не используется,
+чтобы после переполнения поколения старый ключ не стал снова
+действительным.
+
+Удаление присваивает последнее значение на место удаленного и дает
+только базовую гарантию, если присваивание T может бросить исключение.
+*/
+
+struct slot_handle
+{
+    uint32_t index;
+    uint32_t generation;
+
+    static slot_handle null()
+    {
+        slot_handle h = {UINT32_MAX, 0};
+        return h;
+    }
+
+    uint64_t value() const
+    {
+        return uint64_t(generation) << 32 | index;
+    }
+
+    static slot_handle from_value(uint64_t v)
+    {
+        slot_handle h = {static_cast<uint32_t>(v), static_cast<uint32_t>(v >> 32)};
+        return h;
+    }
+};
+
+inline bool operator==(slot_handle a, slot_handle b)
+{
+    return a.index == b.index && a.generation == b.generation;
+}
+
+inline bool operator!=(slot_handle a, slot_handle b)
+{
+    return !(a == b);
+}
+
+template <typename T, typename Alloc = heap_allocator<T> >
+struct slot_map
+{
+    typedef T* iterator;
+    typedef T const* const_iterator;
+
+    slot_map();
+
+    slot_handle insert(T const&);
+
+    // Возвращает false, если ключ уже недействителен.
+    bool erase(slot_handle);
+    void clear();
+
+    bool contains(slot_handle) const;
+
+    // nullptr, если ключ недействителен.
+    T* get(slot_handle);
+    T const* get(slot_handle) const;
+
+    T& operator[](slot_handle);
+    T const& operator[](slot_handle) const;
+
+    size_t size() const;
+    bool empty() const;
+
+    T* data();
+    T const* data() const;
+
+    // Ключ значения, лежащего в data()[i].
+    slot_handle handle_at(size_t i) const;
+
+    iterator begin();
+    iterator end();
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+private:
+    static uint32_t const npos = UINT32_MAX;
+
+    struct slot
+    {
+        // Для занятого слота -- позиция в values_, для свободного --
+        // следующий свободный слот.
+        uint32_t target;
+        uint32_t generation;
+        bool occupied;
+    };
+
+    size_t find(slot_handle) const;
+
+private:
+    vector<T, Alloc> values_;
+    vector<uint32_t> dense_to_slot_;
+    vector<slot> slots_;
+    uint32_t free_head_;
+};
+
+template <typename T, typename Alloc>
+uint32_t const slot_map<T, Alloc>::npos;
+
+template <typename T, typename Alloc>
+slot_map<T, Alloc>::slot_map()
+    : free_head_(npos)
+{}
+
+// Если вставка бросит исключение, слот-заготовка остается в списке
+// свободных, а значения и ключи не меняются.
+template <typename T, typename Alloc>
+slot_handle slot_map<T, Alloc>::insert(T const& val)
+{
+    if (free_head_ == npos)
+    {
+        if (slots_.size() == npos)
+            throw std::length_error("slot_map: too many slots");
+
+        slot s = {npos, 0, false};
+        slots_.push_back(s);
+        free_head_ = static_cast<uint32_t>(slots_.size() - 1);
+    }
+
+    values_.push_back(val);
+    try
+    {
+        dense_to_slot_.push_back(free_head_);
+    }
+    catch (...)
+    {
+        values_.pop_back();
+        throw;
+    }
+
+    uint32_t index = free_head_;
+    slot& s = slots_[index];
+    free_head_ = s.target;
+    s.target = static_cast<uint32_t>(values_.size() - 1);
+    s.occupied = true;
+
+    slot_handle h = {index, s.generation};
+    return h;
+}
+
+template <typename T, typename Alloc>
+bool slot_map<T, Alloc>::erase(slot_handle h)
+{
+    size_t i = find(h);
+    if (i == npos)
+        return false;
+
+    size_t last = values_.size() - 1;
+    if (i != last)
+    {
+        values_[i] = values_[last];
+        dense_to_slot_[i] = dense_to_slot_[last];
+        slots_[dense_to_slot_[i]].target = static_cast<uint32_t>(i);
+    }
+    values_.pop_back();
+    dense_to_slot_.pop_back();
+
+    slot& s = slots_[h.index];
+    s.occupied = false;
+    if (++s.generation != UINT32_MAX)
+    {
+        s.target = free_head_;
+        free_head_ = h.index;
+    }
+    return true;
+}
+
+template <typename T, typename Alloc>
+void slot_map<T, Alloc>::clear()
+{
+    while (!values_.empty())
+        erase(handle_at(values_.size() - 1));
+}
+
+template <typename T, typename Alloc>
+bool slot_map<T, Alloc>::contains(slot_handle h) const
+{
+    return find(h) != npos;
+}
+
+template <typename T, typename Alloc>
+T* slot_map<T, Alloc>::get(slot_handle h)
+{
+    size_t i = find(h);
+    return i != npos ? values_.data() + i : nullptr;
+}
+
+template <typename T, typename Alloc>
+T const* slot_map<T, Alloc>::get(slot_handle h) const
+{
+    size_t i = find(h);
+    return i != npos ? values_.data() + i : nullptr;
+}
+
+template <typename T, typename Alloc>
+T& slot_map<T, Alloc>::operator[](slot_handle h)
+{
+    assert(contains(h));
+    return values_[slots_[h.index].target];
+}
+
+template <typename T, typename Alloc>
+T const& slot_map<T, Alloc>::operator[](slot_handle h) const
+{
+    assert(contains(h));
+    return values_[slots_[h.index].target];
+}
+
+template <typename T, typename Alloc>
+size_t slot_map<T, Alloc>::size() const
+{
+    return values_.size();
+}
+
+template <typename T, typename Alloc>
+bool slot_map<T, Alloc>::empty() const
+{
+    return values_.empty();
+}
+
+template <typename T, typename Alloc>
+T* slot_map<T, Alloc>::data()
+{
+    return values_.data();
+}
+
+template <typename T, typename Alloc>
+T const* slot_map<T, Alloc>::data() const
+{
+    return values_.data();
+}
+
+template <typename T, typename Alloc>
+slot_handle slot_map<T, Alloc>::handle_at(size_t i) const
+{
+    uint32_t index = dense_to_slot_[i];
+    slot_handle h = {index, slots_[index].generation};
+    return h;
+}
+
+template <typename T, typename Alloc>
+typename slot_map<T, Alloc>::iterator slot_map<T, Alloc>::begin()
+{
+    return values_.begin();
+}
+
+template <typename T, typename Alloc>
+typename slot_map<T, Alloc>::iterator slot_map<T, Alloc>::end()
+{
+    return values_.end();
+}
+
+template <typename T, typename Alloc>
+typename slot_map<T, Alloc>::const_iterator slot_map<T, Alloc>::begin() const
+{
+    return values_.begin();
+}
+
+template <typename T, typename Alloc>
+typename slot_map<T, Alloc>::const_iterator slot_map<T, Alloc>::end() const
+{
+    return values_.end();
+}
+
+template <typename T, typename Alloc>
+size_t slot_map<T, Alloc>::find(slot_handle h) const
+{
+    if (h.index >= slots_.size())
+        return npos;
+
+    slot const& s = slots_[h.index];
+    if (!s.occupied || s.generation != h.generation)
+        return npos;
+    return s.target;
+}
+
+#endif // SLOT_MAP_H
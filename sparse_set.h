@@ -0,0 +1,160 @@
+#ifndef SPARSE_SET_H
+#define SPARSE_SET_H
+
+#include "vector.h"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+/*
+Множество целых чисел из [0, universe()) на двух векторах.
+
+dense_ -- присутствующие числа подряд, sparse_[id] -- позиция id в dense_.
+id присутствует, если sparse_[id] < size() и dense_[sparse_[id]] == id,
+поэтому содержимое sparse_ для отсутствующих чисел может быть любым.
+Отсюда clear() за O(1): он только обнуляет размер dense_, не трогая
+sparse_, и устаревшие позиции в sparse_ отсеиваются той же проверкой.
+Вставка и удаление тоже O(1): удаление переносит последний элемент dense_
+на место удаленного, так что порядок обхода не сохраняется. Обход идет
+только по присутствующим числам.
+
+sparse_ заполняется нулями один раз при создании и при расширении
+universe, чтобы не читать неинициализированную память.
+*/
+
+struct sparse_set
+{
+    typedef uint32_t const* const_iterator;
+
+    explicit sparse_set(size_t universe = 0);
+
+    size_t universe() const;
+    // Только расширяет: числа, уже лежащие в множестве, остаются.
+    void grow_universe(size_t universe);
+
+    // Возвращает false, если id уже был в множестве.
+    bool insert(uint32_t id);
+    // Возвращает false, если id в множестве не было.
+    bool erase(uint32_t id);
+    bool contains(uint32_t id) const;
+    void clear();
+
+    size_t size() const;
+    bool empty() const;
+
+    // i-й присутствующий элемент в порядке обхода.
+    uint32_t operator[](size_t i) const;
+    uint32_t const* data() const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    void swap(sparse_set&);
+
+private:
+    vector<uint32_t> sparse_;
+    vector<uint32_t> dense_;
+};
+
+inline sparse_set::sparse_set(size_t universe)
+{
+    grow_universe(universe);
+}
+
+inline size_t sparse_set::universe() const
+{
+    return sparse_.size();
+}
+
+inline void sparse_set::grow_universe(size_t universe)
+{
+    if (universe <= sparse_.size())
+        return;
+    if (universe - 1 > UINT32_MAX)
+        throw std::length_error("sparse_set: universe exceeds 2^32");
+
+    size_t count = universe - sparse_.size();
+    sparse_.reserve(universe);
+    sparse_.append_construct(count, [](uint32_t* dst, size_t n) {
+        memset(dst, 0, n * sizeof(uint32_t));
+    });
+    dense_.reserve(universe);
+}
+
+inline bool sparse_set::insert(uint32_t id)
+{
+    if (id >= sparse_.size())
+        throw std::out_of_range("sparse_set: id is out of universe");
+    if (contains(id))
+        return false;
+
+    sparse_[id] = static_cast<uint32_t>(dense_.size());
+    dense_.push_back(id);
+    return true;
+}
+
+inline bool sparse_set::erase(uint32_t id)
+{
+    if (!contains(id))
+        return false;
+
+    uint32_t position = sparse_[id];
+    uint32_t last = dense_.back();
+    dense_[position] = last;
+    sparse_[last] = position;
+    dense_.pop_back();
+    return true;
+}
+
+inline bool sparse_set::contains(uint32_t id) const
+{
+    if (id >= sparse_.size())
+        return false;
+
+    uint32_t position = sparse_[id];
+    return position < dense_.size() && dense_[position] == id;
+}
+
+inline void sparse_set::clear()
+{
+    dense_.clear();
+}
+
+inline size_t sparse_set::size() const
+{
+    return dense_.size();
+}
+
+inline bool sparse_set::empty() const
+{
+    return dense_.empty();
+}
+
+inline uint32_t sparse_set::operator[](size_t i) const
+{
+    return dense_[i];
+}
+
+inline uint32_t const* sparse_set::data() const
+{
+    return dense_.data();
+}
+
+inline sparse_set::const_iterator sparse_set::begin() const
+{
+    return dense_.begin();
+}
+
+inline sparse_set::const_iterator sparse_set::end() const
+{
+    return dense_.end();
+}
+
+inline void sparse_set::swap(sparse_set& other)
+{
+    sparse_.swap(other.sparse_);
+    dense_.swap(other.dense_);
+}
+
+#endif // SPARSE_SET_H
@@ -0,0 +1,385 @@
+#ifndef STRING_TABLE_H
+#define STRING_TABLE_H
+
+#include "vector.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+Таблица строк вместо vector<std::string>.
+
+std::string занимает 32 байта заголовка, а строка длиннее 15 символов еще
+и отдельное выделение памяти. string_table кладет символы всех строк
+подряд в один вектор blob_, а offsets_ хранит size() + 1 смещений типа
+uint32_t: строка i -- это blob_[offsets_[i], offsets_[i + 1]). Строки
+доступны через string_ref (указатель и длина, аналог string_view,
+которого нет в C++11), действительный до следующего добавления.
+Суммарная длина строк ограничена 4 ГБ.
+
+Сравнение строк и поиск по префиксу сравнивают по 16 байт инструкциями
+SSE2, если они доступны, и побайтно иначе. Поиск сначала отбрасывает
+строки по длине, которая берется из offsets_ без обращения к символам.
+
+С dedup = true одинаковые строки хранятся один раз: push_back возвращает
+номер уже имеющейся строки, а find ищет по хеш-таблице, а не перебором.
+*/
+
+struct string_ref
+{
+    string_ref()
+        : data_(nullptr)
+        , size_(0)
+    {}
+
+    string_ref(char const* data, size_t size)
+        : data_(data)
+        , size_(size)
+    {}
+
+    string_ref(char const* s)
+        : data_(s)
+        , size_(strlen(s))
+    {}
+
+    string_ref(std::string const& s)
+        : data_(s.data())
+        , size_(s.size())
+    {}
+
+    char const* data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    char operator[](size_t i) const
+    {
+        return data_[i];
+    }
+
+    char const* begin() const
+    {
+        return data_;
+    }
+
+    char const* end() const
+    {
+        return data_ + size_;
+    }
+
+    std::string str() const
+    {
+        return std::string(data_, size_);
+    }
+
+private:
+    char const* data_;
+    size_t size_;
+};
+
+namespace string_table_detail
+{
+    inline bool bytes_equal(char const* a, char const* b, size_t n)
+    {
+        size_t i = 0;
+#ifdef __SSE2__
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(a + i));
+            __m128i y = _mm_loadu_si128(reinterpret_cast<__m128i const*>(b + i));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff)
+                return false;
+        }
+#endif
+        for (; i != n; ++i)
+            if (a[i] != b[i])
+                return false;
+        return true;
+    }
+
+    // FNV-1a.
+    inline uint64_t hash(string_ref s)
+    {
+        uint64_t h = 14695981039346656037ull;
+        for (size_t i = 0; i != s.size(); ++i)
+        {
+            h ^= static_cast<unsigned char>(s[i]);
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+}
+
+inline bool operator==(string_ref a, string_ref b)
+{
+    return a.size() == b.size() && string_table_detail::bytes_equal(a.data(), b.data(), a.size());
+}
+
+inline bool operator!=(string_ref a, string_ref b)
+{
+    return !(a == b);
+}
+
+inline bool starts_with(string_ref s, string_ref prefix)
+{
+    return s.size() >= prefix.size()
+        && string_table_detail::bytes_equal(s.data(), prefix.data(), prefix.size());
+}
+
+struct string_table
+{
+    static size_t const npos = static_cast<size_t>(-1);
+
+    explicit string_table(bool dedup = false);
+
+    string_ref operator[](size_t i) const;
+
+    size_t size() const;
+    bool empty() const;
+    size_t blob_size() const;
+    bool deduplicated() const;
+
+    // Возвращает номер строки; с dedup -- номер уже имеющейся такой же.
+    size_t push_back(string_ref s);
+
+    // Добавляет строки из диапазона, выделяя память один раз.
+    template <typename It>
+    void append(It first, It last);
+
+    void reserve(size_t strings, size_t bytes);
+    void clear();
+    void swap(string_table&);
+
+    // Номер первой строки, равной s, или npos.
+    size_t find(string_ref s) const;
+
+    // Дописывает в out номера всех строк, начинающихся с prefix.
+    void find_prefix(string_ref prefix, vector<uint32_t>& out) const;
+
+private:
+    size_t length(size_t i) const;
+    void check_capacity(size_t bytes) const;
+    size_t add(string_ref s);
+
+    size_t lookup(string_ref s, uint64_t h) const;
+    void insert_index(size_t id, uint64_t h);
+    void rehash(size_t buckets);
+
+private:
+    vector<char> blob_;
+    vector<uint32_t> offsets_;
+
+    // Открытая адресация: номер строки + 1, 0 -- пустая ячейка.
+    bool dedup_;
+    vector<uint32_t> index_;
+};
+
+inline string_table::string_table(bool dedup)
+    : dedup_(dedup)
+{
+    offsets_.push_back(0);
+}
+
+inline string_ref string_table::operator[](size_t i) const
+{
+    return string_ref(blob_.data() + offsets_[i], length(i));
+}
+
+inline size_t string_table::size() const
+{
+    return offsets_.size() - 1;
+}
+
+inline bool string_table::empty() const
+{
+    return size() == 0;
+}
+
+inline size_t string_table::blob_size() const
+{
+    return blob_.size();
+}
+
+inline bool string_table::deduplicated() const
+{
+    return dedup_;
+}
+
+inline size_t string_table::push_back(string_ref s)
+{
+    if (!dedup_)
+        return add(s);
+
+    uint64_t h = string_table_detail::hash(s);
+    size_t existing = lookup(s, h);
+    if (existing != npos)
+        return existing;
+
+    if ((size() + 1) * 2 > index_.size())
+        rehash(index_.empty() ? 16 : index_.size() * 2);
+
+    size_t id = add(s);
+    insert_index(id, h);
+    return id;
+}
+
+template <typename It>
+void string_table::append(It first, It last)
+{
+    size_t count = 0;
+    size_t bytes = 0;
+    for (It i = first; i != last; ++i)
+    {
+        ++count;
+        bytes += string_ref(*i).size();
+    }
+
+    check_capacity(bytes);
+    reserve(size() + count, blob_.size() + bytes);
+    for (; first != last; ++first)
+        push_back(string_ref(*first));
+}
+
+inline void string_table::reserve(size_t strings, size_t bytes)
+{
+    offsets_.reserve(strings + 1);
+    blob_.reserve(bytes);
+}
+
+inline void string_table::clear()
+{
+    blob_.clear();
+    offsets_.clear();
+    offsets_.push_back(0);
+    for (size_t i = 0; i != index_.size(); ++i)
+        index_[i] = 0;
+}
+
+inline void string_table::swap(string_table& other)
+{
+    using std::swap;
+
+    blob_.swap(other.blob_);
+    offsets_.swap(other.offsets_);
+    swap(dedup_, other.dedup_);
+    index_.swap(other.index_);
+}
+
+inline size_t string_table::find(string_ref s) const
+{
+    if (dedup_)
+        return lookup(s, string_table_detail::hash(s));
+
+    for (size_t i = 0; i != size(); ++i)
+        if (length(i) == s.size()
+            && string_table_detail::bytes_equal(blob_.data() + offsets_[i], s.data(), s.size()))
+            return i;
+    return npos;
+}
+
+inline void string_table::find_prefix(string_ref prefix, vector<uint32_t>& out) const
+{
+    for (size_t i = 0; i != size(); ++i)
+        if (length(i) >= prefix.size()
+            && string_table_detail::bytes_equal(blob_.data() + offsets_[i], prefix.data(), prefix.size()))
+            out.push_back(static_cast<uint32_t>(i));
+}
+
+inline size_t string_table::length(size_t i) const
+{
+    return offsets_[i + 1] - offsets_[i];
+}
+
+inline void string_table::check_capacity(size_t bytes) const
+{
+    if (bytes > UINT32_MAX - blob_.size() || size() >= UINT32_MAX - 1)
+        throw std::length_error("string_table: total length exceeds 4 GB");
+}
+
+// Если добавление бросит исключение, таблица не меняется. s может
+// указывать в blob_ (t.push_back(t[0])), а append_construct может перенести
+// blob_, поэтому такая строка запоминается смещением.
+inline size_t string_table::add(string_ref s)
+{
+    check_capacity(s.size());
+
+    std::less_equal<char const*> le;
+    bool inside = !blob_.empty() && le(blob_.data(), s.data()) && le(s.data(), blob_.data() + blob_.size());
+    size_t inside_offset = inside ? s.data() - blob_.data() : 0;
+
+    size_t old_size = blob_.size();
+    blob_.append_construct(s.size(), [&](char* dst, size_t n) {
+        // Здесь blob_ уже в новом буфере вместе со всеми прежними символами.
+        char const* src = inside ? blob_.data() + inside_offset : s.data();
+        if (n != 0)
+            memcpy(dst, src, n);
+    });
+
+    try
+    {
+        offsets_.push_back(static_cast<uint32_t>(blob_.size()));
+    }
+    catch (...)
+    {
+        while (blob_.size() != old_size)
+            blob_.pop_back();
+        throw;
+    }
+    return size() - 1;
+}
+
+inline size_t string_table::lookup(string_ref s, uint64_t h) const
+{
+    if (index_.empty())
+        return npos;
+
+    size_t mask = index_.size() - 1;
+    for (size_t b = h & mask; index_[b] != 0; b = (b + 1) & mask)
+    {
+        size_t id = index_[b] - 1;
+        if ((*this)[id] == s)
+            return id;
+    }
+    return npos;
+}
+
+inline void string_table::insert_index(size_t id, uint64_t h)
+{
+    size_t mask = index_.size() - 1;
+    size_t b = h & mask;
+    while (index_[b] != 0)
+        b = (b + 1) & mask;
+    index_[b] = static_cast<uint32_t>(id + 1);
+}
+
+inline void string_table::rehash(size_t buckets)
+{
+    vector<uint32_t> index;
+    index.append_construct(buckets, [](uint32_t* dst, size_t n) {
+        memset(dst, 0, n * sizeof(uint32_t));
+    });
+    index_.swap(index);
+
+    for (size_t id = 0; id != size(); ++id)
+        insert_index(id, string_table_detail::hash((*this)[id]));
+}
+
+#endif // STRING_TABLE_H
@@ -0,0 +1,417 @@
+#ifndef TIERED_VECTOR_H
+#define TIERED_VECTOR_H
+
+#include "vector.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+/*
+Tiered vector: последовательность с доступом по индексу за O(1) и
+вставкой и удалением в середине за O(sqrt n).
+
+Элементы лежат в блоках по B = 2^k элементов, каждый блок -- кольцевой
+буфер со своим началом head. Все блоки, кроме последнего, заполнены,
+поэтому элемент i -- это элемент i % B блока i / B, а индекс вычисляется
+сдвигом и маской.
+
+vector::insert сдвигает все элементы после позиции вставки. Здесь
+сдвигать приходится только внутри одного блока: вставляемый элемент
+добавляется в конец и переносится к своей позиции обменами, а через
+каждый заполненный блок по пути проходит за O(1): обмен с первым
+элементом следующего блока и сдвиг head на единицу поворачивают весь
+блок. Итого O(B + n / B) обменов; удаление симметрично.
+
+С block_capacity = 0 размер блока подбирается сам: когда блоков
+становится вдвое больше, чем B, все элементы перекладываются в блоки
+вдвое большего размера, так что B остается порядка sqrt(n). Удаления
+размер блока не уменьшают. Явно заданный block_capacity округляется
+вверх до степени двойки и не меняется.
+
+for_each_chunk обходит элементы непрерывными кусками (не больше двух на
+блок), для сканирования без вычисления индекса на каждый элемент.
+
+push_back дает строгую гарантию. insert и erase, как и у vector, только
+базовую: если обмен элементов T бросит исключение, порядок элементов
+может оказаться нарушенным.
+*/
+
+template <typename T, typename Alloc = heap_allocator<T> >
+struct tiered_vector
+{
+    explicit tiered_vector(size_t block_capacity = 0);
+    tiered_vector(tiered_vector const&);
+    tiered_vector& operator=(tiered_vector const&);
+
+    ~tiered_vector();
+
+    T& operator[](size_t i);
+    T const& operator[](size_t i) const;
+
+    size_t size() const;
+    bool empty() const;
+
+    T& front();
+    T const& front() const;
+
+    T& back();
+    T const& back() const;
+
+    size_t block_capacity() const;
+    size_t block_count() const;
+
+    void push_back(T const&);
+    void pop_back();
+
+    void insert(size_t i, T const&);
+    void erase(size_t i);
+
+    void clear();
+    void swap(tiered_vector&);
+
+    // f(T* first, size_t count) для каждого непрерывного куска по порядку.
+    template <typename F>
+    void for_each_chunk(F f);
+    template <typename F>
+    void for_each_chunk(F f) const;
+
+private:
+    struct block
+    {
+        T* data;
+        size_t head;
+        size_t size;
+    };
+
+    T& slot(block const& b, size_t j) const;
+    void bubble_down(block& b, size_t from, size_t to);
+    void bubble_up(block& b, size_t from, size_t to);
+
+    void add_block();
+    void pop_block();
+    void push_back_retier(T const&);
+
+private:
+    vector<block> blocks_;
+    size_t size_;
+    size_t shift_;
+    size_t mask_;
+    bool adaptive_;
+};
+
+template <typename T, typename Alloc>
+tiered_vector<T, Alloc>::tiered_vector(size_t block_capacity)
+    : size_(0)
+    , shift_(4)
+    , adaptive_(block_capacity == 0)
+{
+    if (!adaptive_)
+        for (shift_ = 0; (size_t(1) << shift_) < block_capacity; ++shift_)
+        {}
+    mask_ = (size_t(1) << shift_) - 1;
+}
+
+// Делегирующий конструктор: если копирование бросит, деструктор
+// освободит уже скопированное.
+template <typename T, typename Alloc>
+tiered_vector<T, Alloc>::tiered_vector(tiered_vector const& other)
+    : tiered_vector(other.block_capacity())
+{
+    adaptive_ = other.adaptive_;
+    other.for_each_chunk([this](T const* first, size_t count) {
+        for (size_t i = 0; i != count; ++i)
+            push_back(first[i]);
+    });
+}
+
+template <typename T, typename Alloc>
+tiered_vector<T, Alloc>& tiered_vector<T, Alloc>::operator=(tiered_vector const& other)
+{
+    if (this != &other)
+    {
+        tiered_vector copy(other);
+        swap(copy);
+    }
+    return *this;
+}
+
+template <typename T, typename Alloc>
+tiered_vector<T, Alloc>::~tiered_vector()
+{
+    clear();
+}
+
+template <typename T, typename Alloc>
+T& tiered_vector<T, Alloc>::operator[](size_t i)
+{
+    return slot(blocks_[i >> shift_], i & mask_);
+}
+
+template <typename T, typename Alloc>
+T const& tiered_vector<T, Alloc>::operator[](size_t i) const
+{
+    return slot(blocks_[i >> shift_], i & mask_);
+}
+
+template <typename T, typename Alloc>
+size_t tiered_vector<T, Alloc>::size() const
+{
+    return size_;
+}
+
+template <typename T, typename Alloc>
+bool tiered_vector<T, Alloc>::empty() const
+{
+    return size_ == 0;
+}
+
+template <typename T, typename Alloc>
+T& tiered_vector<T, Alloc>::front()
+{
+    return (*this)[0];
+}
+
+template <typename T, typename Alloc>
+T const& tiered_vector<T, Alloc>::front() const
+{
+    return (*this)[0];
+}
+
+template <typename T, typename Alloc>
+T& tiered_vector<T, Alloc>::back()
+{
+    return (*this)[size_ - 1];
+}
+
+template <typename T, typename Alloc>
+T const& tiered_vector<T, Alloc>::back() const
+{
+    return (*this)[size_ - 1];
+}
+
+template <typename T, typename Alloc>
+size_t tiered_vector<T, Alloc>::block_capacity() const
+{
+    return size_t(1) << shift_;
+}
+
+template <typename T, typename Alloc>
+size_t tiered_vector<T, Alloc>::block_count() const
+{
+    return blocks_.size();
+}
+
+// Как и vector::push_back, умеет вставлять элемент этого же контейнера:
+// add_block не переносит элементы, а push_back_retier копирует val до
+// освобождения старых блоков.
+template <typename T, typename Alloc>
+void tiered_vector<T, Alloc>::push_back(T const& val)
+{
+    if (blocks_.empty() || blocks_.back().size == block_capacity())
+    {
+        if (adaptive_ && blocks_.size() >= 2 * block_capacity())
+        {
+            push_back_retier(val);
+            return;
+        }
+        add_block();
+    }
+
+    block& b = blocks_.back();
+    try
+    {
+        new (&slot(b, b.size)) T(val);
+    }
+    catch (...)
+    {
+        if (b.size == 0)
+            pop_block();
+        throw;
+    }
+    ++b.size;
+    ++size_;
+}
+
+template <typename T, typename Alloc>
+void tiered_vector<T, Alloc>::pop_back()
+{
+    assert(size_ != 0);
+
+    block& b = blocks_.back();
+    slot(b, b.size - 1).~T();
+    --b.size;
+    --size_;
+    if (b.size == 0)
+        pop_block();
+}
+
+template <typename T, typename Alloc>
+void tiered_vector<T, Alloc>::insert(size_t i, T const& val)
+{
+    assert(i <= size_);
+
+    push_back(val);
+    if (i == size_ - 1)
+        return;
+
+    size_t target = i >> shift_;
+    size_t last = blocks_.size() - 1;
+    if (target == last)
+    {
+        bubble_down(blocks_[last], blocks_[last].size - 1, i & mask_);
+        return;
+    }
+
+    bubble_down(blocks_[last], blocks_[last].size - 1, 0);
+    for (size_t k = last; k != target; --k)
+    {
+        block& prev = blocks_[k - 1];
+        using std::swap;
+        swap(slot(blocks_[k], 0), slot(prev, prev.size - 1));
+        if (k - 1 != target)
+            prev.head = (prev.head - 1) & mask_;
+    }
+    bubble_down(blocks_[target], blocks_[target].size - 1, i & mask_);
+}
+
+template <typename T, typename Alloc>
+void tiered_vector<T, Alloc>::erase(size_t i)
+{
+    assert(i < size_);
+
+    size_t target = i >> shift_;
+    size_t last = blocks_.size() - 1;
+    bubble_up(blocks_[target], i & mask_, blocks_[target].size - 1);
+
+    for (size_t k = target + 1; k <= last; ++k)
+    {
+        block& prev = blocks_[k - 1];
+        block& b = blocks_[k];
+        using std::swap;
+        swap(slot(prev, prev.size - 1), slot(b, 0));
+        if (k != last)
+            b.head = (b.head + 1) & mask_;
+        else
+            bubble_up(b, 0, b.size - 1);
+    }
+    pop_back();
+}
+
+template <typename T, typename Alloc>
+void tiered_vector<T, Alloc>::clear()
+{
+    while (!blocks_.empty())
+    {
+        block& b = blocks_.back();
+        size_t first = std::min(b.size, block_capacity() - b.head);
+        destroy_all(b.data + b.head, first);
+        destroy_all(b.data, b.size - first);
+        b.size = 0;
+        pop_block();
+    }
+    size_ = 0;
+}
+
+template <typename T, typename Alloc>
+void tiered_vector<T, Alloc>::swap(tiered_vector& other)
+{
+    using std::swap;
+
+    blocks_.swap(other.blocks_);
+    swap(size_,     other.size_);
+    swap(shift_,    other.shift_);
+    swap(mask_,     other.mask_);
+    swap(adaptive_, other.adaptive_);
+}
+
+template <typename T, typename Alloc>
+template <typename F>
+void tiered_vector<T, Alloc>::for_each_chunk(F f)
+{
+    for (size_t k = 0; k != blocks_.size(); ++k)
+    {
+        block& b = blocks_[k];
+        size_t first = std::min(b.size, block_capacity() - b.head);
+        f(b.data + b.head, first);
+        if (first != b.size)
+            f(b.data, b.size - first);
+    }
+}
+
+template <typename T, typename Alloc>
+template <typename F>
+void tiered_vector<T, Alloc>::for_each_chunk(F f) const
+{
+    for (size_t k = 0; k != blocks_.size(); ++k)
+    {
+        block const& b = blocks_[k];
+        size_t first = std::min(b.size, block_capacity() - b.head);
+        f(static_cast<T const*>(b.data + b.head), first);
+        if (first != b.size)
+            f(static_cast<T const*>(b.data), b.size - first);
+    }
+}
+
+template <typename T, typename Alloc>
+T& tiered_vector<T, Alloc>::slot(block const& b, size_t j) const
+{
+    return b.data[(b.head + j) & mask_];
+}
+
+template <typename T, typename Alloc>
+void tiered_vector<T, Alloc>::bubble_down(block& b, size_t from, size_t to)
+{
+    using std::swap;
+    for (size_t j = from; j != to; --j)
+        swap(slot(b, j), slot(b, j - 1));
+}
+
+template <typename T, typename Alloc>
+void tiered_vector<T, Alloc>::bubble_up(block& b, size_t from, size_t to)
+{
+    using std::swap;
+    for (size_t j = from; j != to; ++j)
+        swap(slot(b, j), slot(b, j + 1));
+}
+
+template <typename T, typename Alloc>
+void tiered_vector<T, Alloc>::add_block()
+{
+    T* data = Alloc::allocate(block_capacity());
+    block b = {data, 0, 0};
+    try
+    {
+        blocks_.push_back(b);
+    }
+    catch (...)
+    {
+        Alloc::deallocate(data, block_capacity());
+        throw;
+    }
+}
+
+template <typename T, typename Alloc>
+void tiered_vector<T, Alloc>::pop_block()
+{
+    assert(blocks_.back().size == 0);
+
+    Alloc::deallocate(blocks_.back().data, block_capacity());
+    blocks_.pop_back();
+}
+
+template <typename T, typename Alloc>
+void tiered_vector<T, Alloc>::push_back_retier(T const& val)
+{
+    tiered_vector tmp(block_capacity() * 2);
+    tmp.adaptive_ = true;
+    tmp.blocks_.reserve(size_ / tmp.block_capacity() + 1);
+    for_each_chunk([&tmp](T const* first, size_t count) {
+        for (size_t i = 0; i != count; ++i)
+            tmp.push_back(first[i]);
+    });
+    tmp.push_back(val);
+    swap(tmp);
+}
+
+#endif // TIERED_VECTOR_H
@@ -0,0 +1,434 @@
+#ifndef TRACKED_VECTOR_H
+#define TRACKED_VECTOR_H
+
+#include "vector.h"
+#include "vector_io.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+Вектор, который помнит, какие блоки изменились, для инкрементальных
+снимков.
+
+Элементы делятся на блоки по block_elements, и на каждый блок заводится
+бит в битовой карте. Модифицирующие операции (неконстантный operator[],
+set, push_back, insert, erase) взводят биты затронутых блоков.
+Запись через указатель из data() не отслеживается: после нее нужно
+вызвать mark_dirty для измененного диапазона.
+
+Полный снимок пишется в формате vector_io.h (write_full_snapshot), дальше
+write_incremental_snapshot пишет только блоки, измененные с предыдущего
+снимка, и сбрасывает биты. Файл инкрементального снимка состоит из
+заголовка delta_header, манифеста (номера блоков, uint64_t) и данных
+блоков в порядке манифеста; последний блок вектора может быть неполным.
+Снимок сначала пишется во временный файл, сбрасывается на диск fsync'ом
+и переименовывается, после чего fsync'ом сбрасывается и каталог. Так по
+пути path всегда лежит целый снимок, в том числе после сбоя питания.
+
+apply_incremental_snapshot накладывает снимок на вектор, восстановленный
+из полного снимка и предыдущих инкрементальных: меняет размер на
+записанный и перезаписывает блоки из манифеста. Новые элементы всегда
+попадают в измененные блоки, поэтому после наложения вектор совпадает с
+тем, что был при записи снимка. Файл сначала читается целиком и
+проверяется, и только потом меняется вектор: испорченный или обрезанный
+снимок оставляет его нетронутым.
+*/
+
+struct delta_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t element_size;
+    uint64_t block_elements;
+    uint64_t size;
+    uint64_t block_count;
+};
+
+namespace tracked_vector_detail
+{
+    char const magic[8] = {'V', 'E', 'C', 'T', 'D', 'L', 'T', '\0'};
+    uint32_t const version = 1;
+
+    // Закрывает файл, если запись прервалась исключением.
+    struct file_guard
+    {
+        explicit file_guard(FILE* file)
+            : file(file)
+        {}
+
+        ~file_guard()
+        {
+            if (file != nullptr)
+                fclose(file);
+        }
+
+        FILE* file;
+    };
+
+    inline void sync_path(std::string const& path, int flags)
+    {
+        int fd = open(path.c_str(), flags);
+        if (fd == -1)
+            vector_io_detail::throw_io_error("open", path);
+        int result = fsync(fd);
+        int error = errno;
+        close(fd);
+        if (result != 0)
+        {
+            errno = error;
+            vector_io_detail::throw_io_error("fsync", path);
+        }
+    }
+
+    // Атомарно заменяет path записанным temp: данные temp попадают на
+    // диск до rename, а сам rename -- после fsync каталога.
+    inline void replace_file(std::string const& temp, std::string const& path)
+    {
+        sync_path(temp, O_RDONLY);
+        if (rename(temp.c_str(), path.c_str()) != 0)
+            vector_io_detail::throw_io_error("rename", path);
+
+        size_t slash = path.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+        sync_path(dir, O_RDONLY | O_DIRECTORY);
+    }
+}
+
+template <typename T, typename Alloc = heap_allocator<T> >
+struct tracked_vector
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "snapshots store elements as raw bytes");
+
+    explicit tracked_vector(size_t block_elements = 4096);
+
+    // Запись через ссылку не видна, поэтому блок помечается сразу.
+    T& operator[](size_t i);
+    T const& operator[](size_t i) const;
+
+    void set(size_t i, T const& val);
+
+    // Запись через data() нужно отмечать вызовом mark_dirty.
+    T* data();
+    T const* data() const;
+
+    size_t size() const;
+    bool empty() const;
+
+    void push_back(T const&);
+    void pop_back();
+    void insert(size_t i, T const&);
+    void erase(size_t i);
+
+    vector<T, Alloc> const& values() const;
+
+    // Помечает измененными блоки, пересекающиеся с [first, last).
+    void mark_dirty(size_t first, size_t last);
+    void mark_all_dirty();
+    void clear_dirty();
+
+    size_t block_elements() const;
+    size_t block_count() const;
+    bool is_dirty(size_t block) const;
+    size_t dirty_block_count() const;
+
+private:
+    void mark_block(size_t block);
+
+private:
+    vector<T, Alloc> values_;
+    vector<uint64_t> dirty_;
+    size_t block_elements_;
+};
+
+template <typename T, typename Alloc>
+tracked_vector<T, Alloc>::tracked_vector(size_t block_elements)
+    : block_elements_(block_elements != 0 ? block_elements : 1)
+{}
+
+template <typename T, typename Alloc>
+T& tracked_vector<T, Alloc>::operator[](size_t i)
+{
+    mark_block(i / block_elements_);
+    return values_[i];
+}
+
+template <typename T, typename Alloc>
+T const& tracked_vector<T, Alloc>::operator[](size_t i) const
+{
+    return values_[i];
+}
+
+template <typename T, typename Alloc>
+void tracked_vector<T, Alloc>::set(size_t i, T const& val)
+{
+    (*this)[i] = val;
+}
+
+template <typename T, typename Alloc>
+T* tracked_vector<T, Alloc>::data()
+{
+    return values_.data();
+}
+
+template <typename T, typename Alloc>
+T const* tracked_vector<T, Alloc>::data() const
+{
+    return values_.data();
+}
+
+template <typename T, typename Alloc>
+size_t tracked_vector<T, Alloc>::size() const
+{
+    return values_.size();
+}
+
+template <typename T, typename Alloc>
+bool tracked_vector<T, Alloc>::empty() const
+{
+    return values_.empty();
+}
+
+template <typename T, typename Alloc>
+void tracked_vector<T, Alloc>::push_back(T const& val)
+{
+    mark_block(values_.size() / block_elements_);
+    values_.push_back(val);
+}
+
+// Размер записывается в снимок, поэтому удаленный хвост помечать не нужно.
+template <typename T, typename Alloc>
+void tracked_vector<T, Alloc>::pop_back()
+{
+    values_.pop_back();
+}
+
+// Сдвиг меняет все элементы от i до конца.
+template <typename T, typename Alloc>
+void tracked_vector<T, Alloc>::insert(size_t i, T const& val)
+{
+    mark_dirty(i, values_.size() + 1);
+    values_.insert(values_.begin() + i, val);
+}
+
+template <typename T, typename Alloc>
+void tracked_vector<T, Alloc>::erase(size_t i)
+{
+    mark_dirty(i, values_.size() - 1);
+    values_.erase(values_.begin() + i);
+}
+
+template <typename T, typename Alloc>
+vector<T, Alloc> const& tracked_vector<T, Alloc>::values() const
+{
+    return values_;
+}
+
+template <typename T, typename Alloc>
+void tracked_vector<T, Alloc>::mark_dirty(size_t first, size_t last)
+{
+    if (first >= last)
+        return;
+
+    for (size_t block = first / block_elements_; block <= (last - 1) / block_elements_; ++block)
+        mark_block(block);
+}
+
+template <typename T, typename Alloc>
+void tracked_vector<T, Alloc>::mark_all_dirty()
+{
+    mark_dirty(0, values_.size());
+}
+
+template <typename T, typename Alloc>
+void tracked_vector<T, Alloc>::clear_dirty()
+{
+    for (size_t i = 0; i != dirty_.size(); ++i)
+        dirty_[i] = 0;
+}
+
+template <typename T, typename Alloc>
+size_t tracked_vector<T, Alloc>::block_elements() const
+{
+    return block_elements_;
+}
+
+template <typename T, typename Alloc>
+size_t tracked_vector<T, Alloc>::block_count() const
+{
+    return (values_.size() + block_elements_ - 1) / block_elements_;
+}
+
+template <typename T, typename Alloc>
+bool tracked_vector<T, Alloc>::is_dirty(size_t block) const
+{
+    return block / 64 < dirty_.size() && (dirty_[block / 64] >> (block % 64) & 1) != 0;
+}
+
+template <typename T, typename Alloc>
+size_t tracked_vector<T, Alloc>::dirty_block_count() const
+{
+    size_t result = 0;
+    for (size_t block = 0; block != block_count(); ++block)
+        result += is_dirty(block);
+    return result;
+}
+
+template <typename T, typename Alloc>
+void tracked_vector<T, Alloc>::mark_block(size_t block)
+{
+    while (dirty_.size() <= block / 64)
+        dirty_.push_back(0);
+    dirty_[block / 64] |= uint64_t(1) << (block % 64);
+}
+
+template <typename T, typename Alloc>
+void write_full_snapshot(std::string const& path, tracked_vector<T, Alloc>& v)
+{
+    std::string temp = path + ".tmp";
+    write_binary(temp, v.values());
+    tracked_vector_detail::replace_file(temp, path);
+
+    v.clear_dirty();
+}
+
+// Возвращает число записанных блоков.
+template <typename T, typename Alloc>
+size_t write_incremental_snapshot(std::string const& path, tracked_vector<T, Alloc>& v)
+{
+    size_t block_elements = v.block_elements();
+
+    vector<uint64_t> manifest;
+    for (size_t block = 0; block != v.block_count(); ++block)
+        if (v.is_dirty(block))
+            manifest.push_back(block);
+
+    delta_header header;
+    memcpy(header.magic, tracked_vector_detail::magic, sizeof header.magic);
+    header.version = tracked_vector_detail::version;
+    header.element_size = sizeof(T);
+    header.block_elements = block_elements;
+    header.size = v.size();
+    header.block_count = manifest.size();
+
+    std::string temp = path + ".tmp";
+    tracked_vector_detail::file_guard guard(fopen(temp.c_str(), "wb"));
+    if (guard.file == nullptr)
+        vector_io_detail::throw_io_error("fopen", temp);
+
+    bool ok = fwrite(&header, sizeof header, 1, guard.file) == 1
+           && (manifest.empty()
+               || fwrite(manifest.data(), sizeof(uint64_t), manifest.size(), guard.file) == manifest.size());
+
+    for (size_t i = 0; ok && i != manifest.size(); ++i)
+    {
+        size_t first = manifest[i] * block_elements;
+        size_t count = std::min(block_elements, v.size() - first);
+        ok = fwrite(v.data() + first, sizeof(T), count, guard.file) == count;
+    }
+
+    if (!ok)
+        vector_io_detail::throw_io_error("fwrite", temp);
+
+    FILE* file = guard.file;
+    guard.file = nullptr;
+    if (fclose(file) != 0)
+        vector_io_detail::throw_io_error("fclose", temp);
+    tracked_vector_detail::replace_file(temp, path);
+
+    v.clear_dirty();
+    return manifest.size();
+}
+
+template <typename T, typename Alloc, typename SizeT>
+void apply_incremental_snapshot(std::string const& path, vector<T, Alloc, SizeT>& v)
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "snapshots store elements as raw bytes");
+
+    tracked_vector_detail::file_guard guard(fopen(path.c_str(), "rb"));
+    if (guard.file == nullptr)
+        vector_io_detail::throw_io_error("fopen", path);
+
+    delta_header header;
+    if (fread(&header, sizeof header, 1, guard.file) != 1
+        || memcmp(header.magic, tracked_vector_detail::magic, sizeof header.magic) != 0
+        || header.version != tracked_vector_detail::version
+        || header.element_size != sizeof(T)
+        || header.block_elements == 0
+        || header.size > std::numeric_limits<size_t>::max() / sizeof(T))
+        throw std::runtime_error("apply_incremental_snapshot: " + path + " is not a snapshot of this type");
+
+    struct stat st;
+    if (fstat(fileno(guard.file), &st) != 0)
+        vector_io_detail::throw_io_error("fstat", path);
+    size_t file_bytes = static_cast<size_t>(st.st_size);
+    if (header.block_count > (file_bytes - sizeof header) / sizeof(uint64_t))
+        throw std::runtime_error("apply_incremental_snapshot: " + path + " is truncated");
+
+    vector<uint64_t> manifest;
+    manifest.append_construct(header.block_count, [&](uint64_t* dst, size_t n) {
+        if (n != 0 && fread(dst, sizeof(uint64_t), n, guard.file) != n)
+            throw std::runtime_error("apply_incremental_snapshot: " + path + " is truncated");
+    });
+
+    size_t block_elements = header.block_elements;
+    size_t size = header.size;
+    size_t blocks = size / block_elements + (size % block_elements != 0);
+    size_t remaining = file_bytes - sizeof header - manifest.size() * sizeof(uint64_t);
+    size_t data_bytes = 0;
+    for (size_t i = 0; i != manifest.size(); ++i)
+    {
+        if (manifest[i] >= blocks)
+            throw std::runtime_error("apply_incremental_snapshot: " + path + " has a block past the end");
+
+        size_t bytes = std::min(block_elements, size - manifest[i] * block_elements) * sizeof(T);
+        if (bytes > remaining - data_bytes)
+            throw std::runtime_error("apply_incremental_snapshot: " + path + " is truncated");
+        data_bytes += bytes;
+    }
+    if (data_bytes != remaining)
+        throw std::runtime_error("apply_incremental_snapshot: " + path + " has trailing data");
+
+    // Данные блоков читаются до того, как вектор меняется, поэтому ошибка
+    // чтения его не портит.
+    vector<T> data;
+    data.append_construct(data_bytes / sizeof(T), [&](T* dst, size_t n) {
+        if (n != 0 && fread(dst, sizeof(T), n, guard.file) != n)
+            vector_io_detail::throw_read_error(guard.file, path);
+    });
+
+    // Дальше бросить может только reserve, и тогда вектор еще не тронут.
+    // Новые элементы лежат в блоках из манифеста и будут перезаписаны.
+    v.reserve(size);
+    while (v.size() > size)
+        v.pop_back();
+    if (v.size() < size)
+    {
+        v.append_construct(size - v.size(), [](T* dst, size_t n) {
+            memset(static_cast<void*>(dst), 0, n * sizeof(T));
+        });
+    }
+
+    T const* src = data.data();
+    for (size_t i = 0; i != manifest.size(); ++i)
+    {
+        size_t first = manifest[i] * block_elements;
+        size_t count = std::min(block_elements, size - first);
+        std::copy(src, src + count, v.data() + first);
+        src += count;
+    }
+}
+
+#endif // TRACKED_VECTOR_H
@@ -0,0 +1,288 @@
+#ifndef TRANSACTIONAL_VECTOR_H
+#define TRANSACTIONAL_VECTOR_H
+
+#include "vector.h"
+
+#include <cassert>
+#include <cstddef>
+
+/*
+Вектор с транзакциями на журнале отмены.
+
+vector::operator= дает строгую гарантию, копируя весь вектор и обменивая
+его с текущим; для пакета изменений это O(n) на каждую транзакцию.
+transactional_vector вместо этого между begin_transaction() и commit()
+записывает в журнал, как отменить каждое изменение: для push_back и
+insert достаточно позиции, а set, pop_back, erase и неконстантный
+operator[] сохраняют старое значение. rollback() проходит журнал с конца
+и отменяет изменения, так что его цена пропорциональна тому, что
+изменила транзакция, а не размеру вектора. commit() просто очищает
+журнал.
+
+Вектор никогда не уменьшает емкость при удалении, поэтому отмена
+удалений не выделяет память, и rollback не бросает исключений, если их не
+бросает копирование T. Бросившие push_back и pop_back не оставляют следов
+в журнале, бросивший set оставляет запись со старым значением, которое и
+так осталось в векторе. insert и erase у vector дают только базовую гарантию:
+если копирование T бросит посреди сдвига, транзакцию уже нельзя точно
+откатить.
+
+Вне транзакции изменения не журналируются. Транзакции не вкладываются.
+Метод называется begin_transaction, а не begin, чтобы не путать его с
+итератором; итерироваться можно по values().
+*/
+
+template <typename T, typename Alloc = heap_allocator<T> >
+struct transactional_vector
+{
+    transactional_vector();
+
+    // Неконстантный operator[] сохраняет старое значение в журнал, даже
+    // если через ссылку только читают; для чтения есть константный.
+    T& operator[](size_t i);
+    T const& operator[](size_t i) const;
+
+    void set(size_t i, T const& val);
+
+    size_t size() const;
+    bool empty() const;
+
+    void push_back(T const&);
+    void pop_back();
+    void insert(size_t i, T const&);
+    void erase(size_t i);
+
+    vector<T, Alloc> const& values() const;
+
+    void begin_transaction();
+    void commit();
+    void rollback();
+
+    bool in_transaction() const;
+    size_t undo_size() const;
+
+private:
+    enum operation
+    {
+        op_set,
+        op_push_back,
+        op_pop_back,
+        op_insert,
+        op_erase
+    };
+
+    struct record
+    {
+        operation op;
+        size_t index;
+    };
+
+    void log(operation op, size_t index);
+    void log(operation op, size_t index, T const& old);
+    void undo(record const& r);
+
+private:
+    vector<T, Alloc> values_;
+    vector<record> undo_;
+    vector<T> saved_;
+    bool active_;
+};
+
+template <typename T, typename Alloc>
+transactional_vector<T, Alloc>::transactional_vector()
+    : active_(false)
+{}
+
+template <typename T, typename Alloc>
+T& transactional_vector<T, Alloc>::operator[](size_t i)
+{
+    if (active_)
+        log(op_set, i, values_[i]);
+    return values_[i];
+}
+
+template <typename T, typename Alloc>
+T const& transactional_vector<T, Alloc>::operator[](size_t i) const
+{
+    return values_[i];
+}
+
+template <typename T, typename Alloc>
+void transactional_vector<T, Alloc>::set(size_t i, T const& val)
+{
+    (*this)[i] = val;
+}
+
+template <typename T, typename Alloc>
+size_t transactional_vector<T, Alloc>::size() const
+{
+    return values_.size();
+}
+
+template <typename T, typename Alloc>
+bool transactional_vector<T, Alloc>::empty() const
+{
+    return values_.empty();
+}
+
+// Запись в журнал делается до изменения: если изменение бросит
+// исключение, запись снимается, и вектор с журналом остаются согласованы.
+template <typename T, typename Alloc>
+void transactional_vector<T, Alloc>::push_back(T const& val)
+{
+    if (!active_)
+    {
+        values_.push_back(val);
+        return;
+    }
+
+    log(op_push_back, values_.size());
+    try
+    {
+        values_.push_back(val);
+    }
+    catch (...)
+    {
+        undo_.pop_back();
+        throw;
+    }
+}
+
+template <typename T, typename Alloc>
+void transactional_vector<T, Alloc>::pop_back()
+{
+    assert(!values_.empty());
+
+    if (active_)
+        log(op_pop_back, values_.size() - 1, values_.back());
+    values_.pop_back();
+}
+
+template <typename T, typename Alloc>
+void transactional_vector<T, Alloc>::insert(size_t i, T const& val)
+{
+    if (!active_)
+    {
+        values_.insert(values_.begin() + i, val);
+        return;
+    }
+
+    log(op_insert, i);
+    try
+    {
+        values_.insert(values_.begin() + i, val);
+    }
+    catch (...)
+    {
+        undo_.pop_back();
+        throw;
+    }
+}
+
+template <typename T, typename Alloc>
+void transactional_vector<T, Alloc>::erase(size_t i)
+{
+    if (active_)
+        log(op_erase, i, values_[i]);
+    values_.erase(values_.begin() + i);
+}
+
+template <typename T, typename Alloc>
+vector<T, Alloc> const& transactional_vector<T, Alloc>::values() const
+{
+    return values_;
+}
+
+template <typename T, typename Alloc>
+void transactional_vector<T, Alloc>::begin_transaction()
+{
+    assert(!active_);
+    active_ = true;
+}
+
+template <typename T, typename Alloc>
+void transactional_vector<T, Alloc>::commit()
+{
+    assert(active_);
+    undo_.clear();
+    saved_.clear();
+    active_ = false;
+}
+
+template <typename T, typename Alloc>
+void transactional_vector<T, Alloc>::rollback()
+{
+    assert(active_);
+    while (!undo_.empty())
+    {
+        undo(undo_.back());
+        undo_.pop_back();
+    }
+    active_ = false;
+}
+
+template <typename T, typename Alloc>
+bool transactional_vector<T, Alloc>::in_transaction() const
+{
+    return active_;
+}
+
+template <typename T, typename Alloc>
+size_t transactional_vector<T, Alloc>::undo_size() const
+{
+    return undo_.size();
+}
+
+template <typename T, typename Alloc>
+void transactional_vector<T, Alloc>::log(operation op, size_t index)
+{
+    record r = {op, index};
+    undo_.push_back(r);
+}
+
+template <typename T, typename Alloc>
+void transactional_vector<T, Alloc>::log(operation op, size_t index, T const& old)
+{
+    saved_.push_back(old);
+    try
+    {
+        log(op, index);
+    }
+    catch (...)
+    {
+        saved_.pop_back();
+        throw;
+    }
+}
+
+template <typename T, typename Alloc>
+void transactional_vector<T, Alloc>::undo(record const& r)
+{
+    switch (r.op)
+    {
+    case op_set:
+        values_[r.index] = saved_.back();
+        saved_.pop_back();
+        break;
+
+    case op_push_back:
+        values_.pop_back();
+        break;
+
+    case op_pop_back:
+        values_.push_back(saved_.back());
+        saved_.pop_back();
+        break;
+
+    case op_insert:
+        values_.erase(values_.begin() + r.index);
+        break;
+
+    case op_erase:
+        values_.insert(values_.begin() + r.index, saved_.back());
+        saved_.pop_back();
+        break;
+    }
+}
+
+#endif // TRANSACTIONAL_VECTOR_H
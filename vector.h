@@ -1,10 +1,15 @@
 #ifndef VECTOR_H
 #define VECTOR_H
 
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <limits>
 #include <new>
+#include <stdexcept>
 #include <type_traits>
 #include <utility>
 
@@ -52,15 +57,93 @@ void copy_construct_all(TT* dst, TT const* src, size_t size,
         memcpy(dst, src, size * sizeof(TT));
 }
 
+template <typename TT>
+void copy_assign_all(TT* dst, TT const* src, size_t size,
+    typename std::enable_if<!std::is_trivially_copyable<TT>::value>::type* = nullptr)
+{
+    for (size_t i = 0; i != size; ++i)
+        dst[i] = src[i];
+}
+
+template <typename TT>
+void copy_assign_all(TT* dst, TT const* src, size_t size,
+    typename std::enable_if<std::is_trivially_copyable<TT>::value>::type* = nullptr)
+{
+    // См. комментарий в copy_construct_all про (size == 0).
+    if (size != 0)
+        memcpy(dst, src, size * sizeof(TT));
+}
+
+/*
+Аллокатор вектора -- это тип со статическими функциями allocate(n) и
+deallocate(p, n). Состояния у него нет, поэтому вектор не становится
+больше и swap остается тривиальным. deallocate получает то же n, что было
+передано в allocate: аллокаторам на основе mmap нужен размер блока.
+
+operator new до C++17 гарантирует только выравнивание max_align_t (16 байт
+на x86-64), поэтому для большего выравнивания блок выделяется с запасом в
+align байт, указатель округляется вверх, а исходный указатель сохраняется
+прямо перед выровненным. Места для него всегда хватает: между ними не
+меньше alignof(max_align_t) байт.
+*/
+template <typename T, size_t Align>
+struct aligned_allocator
+{
+    static_assert((Align & (Align - 1)) == 0, "alignment must be a power of two");
+
+    static size_t const alignment = Align > alignof(T) ? Align : alignof(T);
+    static bool const over_aligned = alignment > alignof(std::max_align_t);
+
+    static T* allocate(size_t n)
+    {
+        // n * sizeof(T) + alignment не должно переполниться: иначе
+        // выделился бы блок меньше запрошенного.
+        if (n > (std::numeric_limits<size_t>::max() - alignment) / sizeof(T))
+            throw std::bad_array_new_length();
+
+        if (!over_aligned)
+            return static_cast<T*>(operator new(n * sizeof(T)));
+
+        char* raw = static_cast<char*>(operator new(n * sizeof(T) + alignment));
+        uintptr_t aligned = (reinterpret_cast<uintptr_t>(raw) + alignment) & ~(uintptr_t)(alignment - 1);
+
+        void** result = reinterpret_cast<void**>(aligned);
+        result[-1] = raw;
+        return reinterpret_cast<T*>(result);
+    }
+
+    static void deallocate(T* p, size_t)
+    {
+        if (!over_aligned)
+            operator delete(p);
+        else
+            operator delete(reinterpret_cast<void**>(p)[-1]);
+    }
+};
+
 template <typename T>
+struct heap_allocator : aligned_allocator<T, alignof(T)>
+{};
+
+/*
+SizeT -- тип, в котором хранятся размер и емкость. С uint32_t заголовок
+вектора занимает 16 байт вместо 24 (см. compact_vector.h), а max_size()
+ограничен 2^32 - 1 элементами: рост сверх него бросает std::length_error.
+Независимо от SizeT буфер не больше PTRDIFF_MAX байт, как у std::vector:
+тогда размер в байтах с запасом на выравнивание не переполняет size_t, а
+разность указателей внутри буфера представима.
+*/
+template <typename T, typename Alloc = heap_allocator<T>, typename SizeT = size_t>
 struct vector
 {
     typedef T* iterator;
     typedef T const* const_iterator;
+    typedef Alloc allocator_type;
 
     vector();
     vector(vector const&);
     vector& operator=(vector const& other);
+    void assign_strong(vector const& other);
 
     ~vector();
 
@@ -81,6 +164,7 @@ struct vector
     bool empty() const;
 
     size_t capacity() const;
+    static size_t max_size();
     void reserve(size_t);
     void shrink_to_fit();
     
@@ -88,6 +172,9 @@ struct vector
     
     void push_back(T const&);
     void pop_back();
+
+    template <typename F>
+    void append_construct(size_t count, F construct);
     
     void swap(vector&);
 
@@ -113,19 +200,19 @@ private:
     
 private:
     T* data_;
-    size_t size_;
-    size_t capacity_;
+    SizeT size_;
+    SizeT capacity_;
 };
 
-template <typename T>
-vector<T>::vector()
+template <typename T, typename Alloc, typename SizeT>
+vector<T, Alloc, SizeT>::vector()
     : data_(nullptr)
     , size_(0)
     , capacity_(0)
 {}
 
-template <typename T>
-vector<T>::vector(vector const& other)
+template <typename T, typename Alloc, typename SizeT>
+vector<T, Alloc, SizeT>::vector(vector const& other)
     : vector()
 {
     new_buffer(other.size());
@@ -133,90 +220,145 @@ vector<T>::vector(vector const& other)
     size_ = other.size_;
 }
 
-template <typename T>
-vector<T>& vector<T>::operator=(vector const& other)
+template <typename T, typename Alloc, typename SizeT>
+vector<T, Alloc, SizeT>& vector<T, Alloc, SizeT>::operator=(vector const& other)
 {
+    /*
+    Раньше operator= был реализован через copy-and-swap:
+
     vector copy(other);
     swap(copy);
+
+    Это дает строгую гарантию, но всегда выделяет новый буфер, даже если
+    текущего capacity_ достаточно. Если в цикле присваивать друг другу
+    вектора одинакового размера, на каждое присваивание приходится лишняя
+    пара malloc/free.
+
+    Поэтому если буфер вмещает other, мы переиспользуем его: общий префикс
+    присваивается поэлементно (memcpy для trivially copyable типов),
+    недостающие элементы конструируются, лишние разрушаются. Такая
+    реализация дает только базовую гарантию: если присваивание элемента
+    бросит исключение, вектор останется валидным, но его содержимое будет
+    частично перезаписано. Кому нужна строгая гарантия, может вызвать
+    assign_strong.
+    */
+    if (this == &other)
+        return *this;
+
+    if (other.size_ > capacity_)
+    {
+        assign_strong(other);
+        return *this;
+    }
+
+    if (size_ >= other.size_)
+    {
+        copy_assign_all(data_, other.data_, other.size_);
+        destroy_all(data_ + other.size_, size_ - other.size_);
+        size_ = other.size_;
+    }
+    else
+    {
+        copy_assign_all(data_, other.data_, size_);
+        copy_construct_all(data_ + size_, other.data_ + size_, other.size_ - size_);
+        size_ = other.size_;
+    }
+
     return *this;
 }
 
-template <typename T>
-vector<T>::~vector()
+template <typename T, typename Alloc, typename SizeT>
+void vector<T, Alloc, SizeT>::assign_strong(vector const& other)
+{
+    vector copy(other);
+    swap(copy);
+}
+
+template <typename T, typename Alloc, typename SizeT>
+vector<T, Alloc, SizeT>::~vector()
 {
     destroy_all(data_, size_);
-    operator delete(data_);
+    if (data_ != nullptr)
+        Alloc::deallocate(data_, capacity_);
 }
 
-template <typename T>
-T& vector<T>::operator[](size_t i)
+template <typename T, typename Alloc, typename SizeT>
+T& vector<T, Alloc, SizeT>::operator[](size_t i)
 {
     return data_[i];
 }
 
-template <typename T>
-T const& vector<T>::operator[](size_t i) const
+template <typename T, typename Alloc, typename SizeT>
+T const& vector<T, Alloc, SizeT>::operator[](size_t i) const
 {
     return data_[i];
 }
 
-template <typename T>
-T* vector<T>::data()
+template <typename T, typename Alloc, typename SizeT>
+T* vector<T, Alloc, SizeT>::data()
 {
     return data_;
 }
 
-template <typename T>
-T const* vector<T>::data() const
+template <typename T, typename Alloc, typename SizeT>
+T const* vector<T, Alloc, SizeT>::data() const
 {
     return data_;
 }
 
-template <typename T>
-size_t vector<T>::size() const
+template <typename T, typename Alloc, typename SizeT>
+size_t vector<T, Alloc, SizeT>::size() const
 {
     return size_;    
 }
 
-template <typename T>
-T& vector<T>::front()
+template <typename T, typename Alloc, typename SizeT>
+T& vector<T, Alloc, SizeT>::front()
 {
     return *data_;
 }
 
-template <typename T>
-T const& vector<T>::front() const
+template <typename T, typename Alloc, typename SizeT>
+T const& vector<T, Alloc, SizeT>::front() const
 {
     return *data_;
 }
 
 
-template <typename T>
-T& vector<T>::back()
+template <typename T, typename Alloc, typename SizeT>
+T& vector<T, Alloc, SizeT>::back()
 {
     return data_[size_ - 1];
 }
 
-template <typename T>
-T const& vector<T>::back() const
+template <typename T, typename Alloc, typename SizeT>
+T const& vector<T, Alloc, SizeT>::back() const
 {
     return data_[size_ - 1];
 }
 
-template <typename T>
-bool vector<T>::empty() const
+template <typename T, typename Alloc, typename SizeT>
+bool vector<T, Alloc, SizeT>::empty() const
 {
     return size_ == 0;
 }
 
-template <typename T>
-size_t vector<T>::capacity() const
+template <typename T, typename Alloc, typename SizeT>
+size_t vector<T, Alloc, SizeT>::capacity() const
 {
     return capacity_;
 }
 
-template <typename T>
-void vector<T>::reserve(size_t desired_capacity)
+template <typename T, typename Alloc, typename SizeT>
+size_t vector<T, Alloc, SizeT>::max_size()
+{
+    size_t by_bytes = static_cast<size_t>(std::numeric_limits<std::ptrdiff_t>::max()) / sizeof(T);
+    size_t by_type = std::numeric_limits<SizeT>::max();
+    return std::min(by_bytes, by_type);
+}
+
+template <typename T, typename Alloc, typename SizeT>
+void vector<T, Alloc, SizeT>::reserve(size_t desired_capacity)
 {
     if (desired_capacity < capacity_)
         return;
@@ -224,8 +366,8 @@ void vector<T>::reserve(size_t desired_capacity)
     new_buffer(desired_capacity);
 }
 
-template <typename T>
-void vector<T>::shrink_to_fit()
+template <typename T, typename Alloc, typename SizeT>
+void vector<T, Alloc, SizeT>::shrink_to_fit()
 {
     if (capacity_ == size_)
         return;
@@ -233,15 +375,15 @@ void vector<T>::shrink_to_fit()
     new_buffer(size_);
 }
 
-template <typename T>
-void vector<T>::clear()
+template <typename T, typename Alloc, typename SizeT>
+void vector<T, Alloc, SizeT>::clear()
 {
     destroy_all(data_, size_);
     size_ = 0;
 }
 
-template <typename T>
-void vector<T>::push_back(T const& val)
+template <typename T, typename Alloc, typename SizeT>
+void vector<T, Alloc, SizeT>::push_back(T const& val)
 {
     /*
     Наивная реализация push_back могла бы выглядеть так:
@@ -278,8 +420,8 @@ void vector<T>::push_back(T const& val)
     }
 }
 
-template <typename T>
-void vector<T>::pop_back()
+template <typename T, typename Alloc, typename SizeT>
+void vector<T, Alloc, SizeT>::pop_back()
 {
     assert(size_ != 0);
 
@@ -287,8 +429,32 @@ void vector<T>::pop_back()
     --size_;
 }
 
-template <typename T>
-void vector<T>::swap(vector& other)
+template <typename T, typename Alloc, typename SizeT>
+template <typename F>
+void vector<T, Alloc, SizeT>::append_construct(size_t count, F construct)
+{
+    /*
+    Низкоуровневое добавление элементов в конец. construct(dst, count)
+    должна сконструировать ровно count элементов в сырой памяти по адресу
+    dst, либо бросить исключение, не оставив ни одного сконструированного
+    элемента. Нужна там, где элементы удобно создавать не по одному:
+    параллельная инициализация, чтение из файла прямо в буфер и т.п.
+
+    Емкость растет как у push_back, не меньше чем в 3/2 раза, иначе
+    последовательность мелких добавлений работала бы за квадрат.
+    */
+    if (count > max_size() - size_)
+        throw std::length_error("vector: size exceeds max_size()");
+
+    if (capacity_ - size_ < count)
+        new_buffer(std::max(size_ + count, increase_capacity()));
+
+    construct(data_ + size_, count);
+    size_ += static_cast<SizeT>(count);
+}
+
+template <typename T, typename Alloc, typename SizeT>
+void vector<T, Alloc, SizeT>::swap(vector& other)
 {
     using std::swap;
 
@@ -297,27 +463,36 @@ void vector<T>::swap(vector& other)
     swap(capacity_, other.capacity_);
 }
 
-template <typename T>
-typename vector<T>::iterator vector<T>::insert(iterator pos, T const& val)
+template <typename T, typename Alloc, typename SizeT>
+typename vector<T, Alloc, SizeT>::iterator vector<T, Alloc, SizeT>::insert(iterator pos, T const& val)
 {
     if (size_ == capacity_)
     {
         vector tmp;
         tmp.new_buffer(increase_capacity());
         copy_construct_all(tmp.data_, data_, pos - begin());
-        tmp.size_ = pos - begin();
+        tmp.size_ = static_cast<SizeT>(pos - begin());
         
         auto result = tmp.end();
 
         tmp.push_back(val);
         
         copy_construct_all(tmp.end(), pos, end() - pos);
-        tmp.size_ += end() - pos;
+        tmp.size_ += static_cast<SizeT>(end() - pos);
         
         swap(tmp);
         return result;
     }
-    
+
+    // Место есть, так что push_back не перевыделит буфер и pos останется
+    // действительным. Вставка в конец идет отдельно: у пустого вектора
+    // нет back(), который можно было бы продублировать.
+    if (pos == end())
+    {
+        push_back(val);
+        return end() - 1;
+    }
+
     push_back(back());
 
     for (auto i = (end() - 1); i != pos; --i)
@@ -330,27 +505,27 @@ typename vector<T>::iterator vector<T>::insert(iterator pos, T const& val)
     return pos;
 }
 
-template <typename T>
-typename vector<T>::iterator vector<T>::insert(const_iterator pos, T const& val)
+template <typename T, typename Alloc, typename SizeT>
+typename vector<T, Alloc, SizeT>::iterator vector<T, Alloc, SizeT>::insert(const_iterator pos, T const& val)
 {
     return insert(data_ + (pos - data_), val);
 }
 
-template <typename T>
-typename vector<T>::iterator vector<T>::erase(iterator pos)
+template <typename T, typename Alloc, typename SizeT>
+typename vector<T, Alloc, SizeT>::iterator vector<T, Alloc, SizeT>::erase(iterator pos)
 {
     return erase(pos, pos + 1);
 }
 
-template <typename T>
-typename vector<T>::iterator vector<T>::erase(const_iterator pos)
+template <typename T, typename Alloc, typename SizeT>
+typename vector<T, Alloc, SizeT>::iterator vector<T, Alloc, SizeT>::erase(const_iterator pos)
 {
     return erase(data_ + (pos - data_));
     
 }
 
-template <typename T>
-typename vector<T>::iterator vector<T>::erase(iterator first, iterator last)
+template <typename T, typename Alloc, typename SizeT>
+typename vector<T, Alloc, SizeT>::iterator vector<T, Alloc, SizeT>::erase(iterator first, iterator last)
 {
     iterator result = first;
 
@@ -363,55 +538,62 @@ typename vector<T>::iterator vector<T>::erase(iterator first, iterator last)
     }
 
     destroy_all(first, last - first);
-    size_ = first - data_;
+    size_ = static_cast<SizeT>(first - data_);
 
     return result;
 }
 
-template <typename T>
-typename vector<T>::iterator vector<T>::erase(const_iterator first, const_iterator last)
+template <typename T, typename Alloc, typename SizeT>
+typename vector<T, Alloc, SizeT>::iterator vector<T, Alloc, SizeT>::erase(const_iterator first, const_iterator last)
 {
     return erase(data_ + (first - data_),
                  data_ + (last  - data_));
 }
 
-template <typename T>
-typename vector<T>::iterator vector<T>::begin()
+template <typename T, typename Alloc, typename SizeT>
+typename vector<T, Alloc, SizeT>::iterator vector<T, Alloc, SizeT>::begin()
 {
     return data_;
 }
 
-template <typename T>
-typename vector<T>::iterator vector<T>::end()
+template <typename T, typename Alloc, typename SizeT>
+typename vector<T, Alloc, SizeT>::iterator vector<T, Alloc, SizeT>::end()
 {
     return data_ + size_;
 }
 
-template <typename T>
-typename vector<T>::const_iterator vector<T>::begin() const
+template <typename T, typename Alloc, typename SizeT>
+typename vector<T, Alloc, SizeT>::const_iterator vector<T, Alloc, SizeT>::begin() const
 {
     return data_;
 }
 
-template <typename T>
-typename vector<T>::const_iterator vector<T>::end() const
+template <typename T, typename Alloc, typename SizeT>
+typename vector<T, Alloc, SizeT>::const_iterator vector<T, Alloc, SizeT>::end() const
 {
     return data_ + size_;
 }
 
-template <typename T>
-size_t vector<T>::increase_capacity() const
+template <typename T, typename Alloc, typename SizeT>
+size_t vector<T, Alloc, SizeT>::increase_capacity() const
 {
-    if (capacity_ == 0)
+    // При capacity_ == 1 рост в 3/2 раза ничего бы не дал, а такая емкость
+    // получается, например, после копирования вектора из одного элемента.
+    if (capacity_ == max_size())
+        throw std::length_error("vector: size exceeds max_size()");
+
+    if (capacity_ < 2)
         return 4;
+    else if (max_size() - capacity_ < capacity_ / 2)
+        return max_size();
     else
-        return capacity_ * 3 / 2;
+        return capacity_ + capacity_ / 2;
 }
 
-template <typename T>
-void vector<T>::push_back_realloc(T const& val)
+template <typename T, typename Alloc, typename SizeT>
+void vector<T, Alloc, SizeT>::push_back_realloc(T const& val)
 {
-    vector<T> tmp;
+    vector tmp;
     tmp.new_buffer(increase_capacity());
     copy_construct_all(tmp.data_, data_, size_);
     tmp.size_ = size_;
@@ -420,16 +602,19 @@ void vector<T>::push_back_realloc(T const& val)
     swap(tmp);
 }
 
-template <typename T>
-void vector<T>::new_buffer(size_t new_capacity)
+template <typename T, typename Alloc, typename SizeT>
+void vector<T, Alloc, SizeT>::new_buffer(size_t new_capacity)
 {
     assert(new_capacity >= size_);
 
-    vector<T> tmp;
+    if (new_capacity > max_size())
+        throw std::length_error("vector: size exceeds max_size()");
+
+    vector tmp;
     if (new_capacity != 0)
     {
-        tmp.data_ = static_cast<T*>(operator new(new_capacity * sizeof(T)));
-        tmp.capacity_ = new_capacity;
+        tmp.data_ = Alloc::allocate(new_capacity);
+        tmp.capacity_ = static_cast<SizeT>(new_capacity);
         copy_construct_all(tmp.data_, data_, size_);
         tmp.size_ = size_;
     }
@@ -437,4 +622,7 @@ void vector<T>::new_buffer(size_t new_capacity)
     swap(tmp);
 }
 
+template <typename T, size_t Align = 64>
+using aligned_vector = vector<T, aligned_allocator<T, Align> >;
+
 #endif // VECTOR_H
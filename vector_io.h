@@ -0,0 +1,246 @@
+#ifndef VECTOR_IO_H
+#define VECTOR_IO_H
+
+#include "vector.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+/*
+Двоичный формат вектора.
+
+Файл начинается с заголовка binary_header: сигнатура "VECTBIN", версия,
+размер элемента и число элементов. Следом идут элементы подряд, байт в
+байт как в памяти, в порядке байт машины, которая их записала. Поэтому
+формат годится только для trivially copyable типов без указателей.
+
+binary_writer и binary_reader работают потоково и нужны там, где файл не
+помещается в память; write_binary и read_binary читают и пишут вектор
+целиком.
+*/
+
+struct binary_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t element_size;
+    uint64_t count;
+};
+
+namespace vector_io_detail
+{
+    char const magic[8] = {'V', 'E', 'C', 'T', 'B', 'I', 'N', '\0'};
+    uint32_t const version = 1;
+
+    inline void throw_io_error(char const* what, std::string const& path)
+    {
+        int error = errno != 0 ? errno : EIO;
+        throw std::system_error(error, std::generic_category(), std::string(what) + " " + path);
+    }
+
+    // Короткий fread без ferror означает конец файла, и errno тогда ничего
+    // не говорит: он остался от какого-то предыдущего вызова.
+    inline void throw_read_error(FILE* file, std::string const& path)
+    {
+        if (ferror(file))
+            throw_io_error("fread", path);
+        throw std::runtime_error("fread " + path + ": file is truncated");
+    }
+}
+
+template <typename T>
+struct binary_writer
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "binary format stores elements as raw bytes");
+
+    explicit binary_writer(std::string const& path);
+    ~binary_writer();
+
+    void write(T const* data, size_t count);
+    void write(T const& val);
+
+    // Дописывает в заголовок число элементов и закрывает файл. Файл, для
+    // которого finish не был вызван, остается с нулевым числом элементов.
+    void finish();
+
+    size_t count() const;
+
+private:
+    binary_writer(binary_writer const&);
+    binary_writer& operator=(binary_writer const&);
+
+private:
+    std::string path_;
+    FILE* file_;
+    size_t count_;
+};
+
+template <typename T>
+struct binary_reader
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "binary format stores elements as raw bytes");
+
+    explicit binary_reader(std::string const& path);
+    ~binary_reader();
+
+    size_t size() const;
+    size_t remaining() const;
+
+    // Читает min(count, remaining()) элементов, возвращает их число.
+    size_t read(T* dst, size_t count);
+
+private:
+    binary_reader(binary_reader const&);
+    binary_reader& operator=(binary_reader const&);
+
+private:
+    std::string path_;
+    FILE* file_;
+    size_t size_;
+    size_t position_;
+};
+
+template <typename T>
+binary_writer<T>::binary_writer(std::string const& path)
+    : path_(path)
+    , file_(fopen(path.c_str(), "wb"))
+    , count_(0)
+{
+    if (file_ == nullptr)
+        vector_io_detail::throw_io_error("fopen", path_);
+
+    binary_header header;
+    memcpy(header.magic, vector_io_detail::magic, sizeof header.magic);
+    header.version = vector_io_detail::version;
+    header.element_size = sizeof(T);
+    header.count = 0;
+
+    if (fwrite(&header, sizeof header, 1, file_) != 1)
+    {
+        fclose(file_);
+        vector_io_detail::throw_io_error("fwrite", path_);
+    }
+}
+
+template <typename T>
+binary_writer<T>::~binary_writer()
+{
+    if (file_ != nullptr)
+        fclose(file_);
+}
+
+template <typename T>
+void binary_writer<T>::write(T const* data, size_t count)
+{
+    if (count != 0 && fwrite(data, sizeof(T), count, file_) != count)
+        vector_io_detail::throw_io_error("fwrite", path_);
+    count_ += count;
+}
+
+template <typename T>
+void binary_writer<T>::write(T const& val)
+{
+    write(&val, 1);
+}
+
+template <typename T>
+void binary_writer<T>::finish()
+{
+    uint64_t count = count_;
+    if (fseek(file_, offsetof(binary_header, count), SEEK_SET) != 0
+        || fwrite(&count, sizeof count, 1, file_) != 1)
+        vector_io_detail::throw_io_error("fwrite", path_);
+
+    FILE* file = file_;
+    file_ = nullptr;
+    if (fclose(file) != 0)
+        vector_io_detail::throw_io_error("fclose", path_);
+}
+
+template <typename T>
+size_t binary_writer<T>::count() const
+{
+    return count_;
+}
+
+template <typename T>
+binary_reader<T>::binary_reader(std::string const& path)
+    : path_(path)
+    , file_(fopen(path.c_str(), "rb"))
+    , size_(0)
+    , position_(0)
+{
+    if (file_ == nullptr)
+        vector_io_detail::throw_io_error("fopen", path_);
+
+    binary_header header;
+    if (fread(&header, sizeof header, 1, file_) != 1
+        || memcmp(header.magic, vector_io_detail::magic, sizeof header.magic) != 0
+        || header.version != vector_io_detail::version
+        || header.element_size != sizeof(T))
+    {
+        fclose(file_);
+        throw std::runtime_error("binary_reader: " + path_ + " is not a vector of this type");
+    }
+
+    size_ = header.count;
+}
+
+template <typename T>
+binary_reader<T>::~binary_reader()
+{
+    fclose(file_);
+}
+
+template <typename T>
+size_t binary_reader<T>::size() const
+{
+    return size_;
+}
+
+template <typename T>
+size_t binary_reader<T>::remaining() const
+{
+    return size_ - position_;
+}
+
+template <typename T>
+size_t binary_reader<T>::read(T* dst, size_t count)
+{
+    if (count > remaining())
+        count = remaining();
+
+    if (count != 0 && fread(dst, sizeof(T), count, file_) != count)
+        vector_io_detail::throw_read_error(file_, path_);
+
+    position_ += count;
+    return count;
+}
+
+template <typename T, typename Alloc, typename SizeT>
+void write_binary(std::string const& path, vector<T, Alloc, SizeT> const& v)
+{
+    binary_writer<T> writer(path);
+    writer.write(v.data(), v.size());
+    writer.finish();
+}
+
+// Дописывает элементы файла в конец v.
+template <typename T, typename Alloc, typename SizeT>
+void read_binary(std::string const& path, vector<T, Alloc, SizeT>& v)
+{
+    binary_reader<T> reader(path);
+    v.append_construct(reader.size(), [&](T* dst, size_t count) {
+        reader.read(dst, count);
+    });
+}
+
+#endif // VECTOR_IO_H